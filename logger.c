@@ -0,0 +1,3524 @@
+/** @file logger.c
+ *
+ * @brief Output backend of the UART-based logging module.
+ *
+ * @author Ignacio Brittez
+ *
+ * Implements the transport used by the `LOG_*` macros declared in `logger.h`:
+ *  - LOGGER_OUTPUT_BLOCKING: messages are sent with `HAL_UART_Transmit()` and `HAL_MAX_DELAY`.
+ *  - LOGGER_OUTPUT_DMA: messages are copied into a lock-free multi-producer ring buffer and
+ *    drained in the background by a chain of `HAL_UART_Transmit_DMA()` transfers, restarted
+ *    from `HAL_UART_TxCpltCallback()` through LOGGER_TX_CPLT_CALLBACK().
+ *
+ *  - LOGGER_OUTPUT_RTOS: messages are posted, without blocking, to a FreeRTOS queue drained by a
+ *    low-priority logger task (LOGGER_TASK()) that owns `LOG_UART` exclusively.
+ *
+ * Messages logged from interrupt context (detected through IPSR) never block nor touch the UART.
+ * In DMA mode they are reserved in the ring like any other message; in the other modes they are
+ * copied into a dedicated staging area and merged into the output stream later, by the next
+ * thread-context log call / LOGGER_PROCESS() or by the logger task.
+ *
+ * The transport above is the built-in UART sink (log_sink_uart()). log_write() fans every message
+ * out to it and to the sinks added with LOGGER_ADD_SINK(), each with its own level filter.
+ *
+ * That is the console channel. With LOG_MAX_CHANNELS the messages of modules bound to another
+ * channel bypass it and go straight to that channel's output, e.g. log_sink_uart_dma() on a UART
+ * with its own ring.
+ *
+ * When `LOGGER_DEFERRED` is enabled it also packs the binary records built by the `LOG_*` macros.
+ *
+ * @note In DMA mode producers reserve ring space with LDREX/STREX and never mask interrupts nor
+ *       take a lock, so tasks and interrupt handlers of any priority can log concurrently. The
+ *       consumer side runs in the UART/DMA interrupt.
+ */
+
+/* =======================================================================
+ * [INCLUDES]
+ * =======================================================================
+ */
+
+#include "logger.h"
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "task.h"
+#endif
+
+/* =======================================================================
+ * [EXTERNAL DATA DECLARATION]
+ * =======================================================================
+ */
+
+// Module registry (see logger_module.h); weak so that an image without modules still links.
+extern log_instance_t *const __start_logger_modules[] __attribute__((weak));
+extern log_instance_t *const __stop_logger_modules[] __attribute__((weak));
+
+/* =======================================================================
+ * [PRIVATE TYPES]
+ * =======================================================================
+ */
+
+// LDREX/STREX exist on every Cortex-M core but the ARMv6-M ones (M0/M0+/M1).
+#if defined(__CORTEX_M) && (__CORTEX_M >= 3U)
+#define LOG_EXCLUSIVE 1
+#else
+#define LOG_EXCLUSIVE 0
+#endif
+
+// In-place formatting needs the ring to be the only copy of the message.
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA && LOG_RING_DIRECT && !LOG_DEDUP &&                    \
+    LOG_PERSIST == LOG_PERSIST_OFF
+#define LOG_DIRECT 1
+#else
+#define LOG_DIRECT 0
+#endif
+
+// Deferred records are encoded by each output: sequence number and compact timestamp delta.
+#if LOG_FRAMING == LOG_FRAMING_COBS || LOG_DEFERRED_COMPACT
+#define LOG_STREAMS 1
+#else
+#define LOG_STREAMS 0
+#endif
+
+/*!
+ * @brief Ring space reserved for a message formatted in place (LOG_RING_DIRECT).
+ */
+typedef struct
+{
+    char *data;     //!< LOG_BUFFER_SIZE contiguous bytes, NULL if the message uses a buffer
+    uint16_t start; //!< Ring index of the reservation
+} log_ring_slot_t;
+
+#if LOGGER_OUTPUT_MODE != LOGGER_OUTPUT_DMA
+
+/*!
+ * @brief Staging slot for a message logged from interrupt context.
+ */
+typedef struct
+{
+    UART_HandleTypeDef *huart;     //!< Destination UART
+    volatile uint16_t len;         //!< Message length once committed, 0 while free or in use
+    uint8_t data[LOG_BUFFER_SIZE]; //!< Message bytes
+} log_stage_slot_t;
+
+/*!
+ * @brief Staging area shared by all interrupt handlers.
+ *
+ * Slots are reserved in order by bumping `head` with interrupts masked (a few instructions),
+ * filled and committed without any lock, and consumed in the same order. A slot reserved by a
+ * preempted handler holds back the ones after it until it is committed, so the output order
+ * always matches the reservation order.
+ */
+typedef struct
+{
+    log_stage_slot_t slot[LOG_ISR_SLOTS]; //!< Slot storage
+    volatile uint32_t head;               //!< Next slot to reserve (free-running)
+    volatile uint32_t tail;               //!< Next slot to consume (free-running)
+    volatile uint32_t dropped;            //!< Messages dropped because all slots were in use
+} log_stage_t;
+
+#endif // LOGGER_OUTPUT_MODE != LOGGER_OUTPUT_DMA
+
+_Static_assert(LOG_BUFFER_SIZE >= 24 + 4 * LOG_HEXDUMP_ROW,
+               "LOG_BUFFER_SIZE is too small for a LOG_HEXDUMP_ROW bytes hex dump row");
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+
+_Static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of two");
+_Static_assert(LOG_RING_SIZE <= 32768, "LOG_RING_SIZE must fit in a single DMA transfer");
+
+/** @brief Bytes past the end of the ring where a message formatted in place may continue. */
+#if LOG_DIRECT
+#define LOG_RING_SLACK LOG_BUFFER_SIZE
+#else
+#define LOG_RING_SLACK 0
+#endif
+
+/*!
+ * @brief Transmit ring buffer, shared by every producer and drained by the DMA chain.
+ *
+ * `state` packs the number of producers still copying their message (upper half) with the
+ * reservation index (lower half), so a single exclusive store both reserves the space and
+ * registers the writer. Producers may finish in any order; once the writer count is back to
+ * zero everything reserved so far is complete, and the consumer moves `head` up to the
+ * reservation index. Bytes are only sent below `head`, so the output follows the reservation
+ * order.
+ *
+ * Indices are free-running 16-bit counters: the number of queued bytes is `head - tail` modulo
+ * 2^16, and the buffer position is the index masked with `LOG_RING_SIZE - 1`.
+ */
+typedef struct
+{
+    //! Ring storage, then LOG_RING_SLACK bytes for messages formatted across the end
+    uint8_t buf[LOG_RING_SIZE + LOG_RING_SLACK];
+    volatile uint32_t state;    //!< Active writers << 16 | reservation index
+    volatile uint16_t head;     //!< End of the complete bytes, only modified by the consumer
+    volatile uint16_t tail;     //!< Read index, only modified by the consumer
+    volatile uint32_t inflight; //!< Bytes of the running transfer, LOG_RING_CLAIMED or 0 (idle)
+    volatile uint8_t flush;     //!< Set by LOGGER_FLUSH(): send without waiting for a batch
+    volatile uint8_t sleeping;  //!< Between LOGGER_SLEEP() and LOGGER_WAKE()
+    volatile uint32_t since;    //!< `HAL_GetTick()` when the ring last became non-empty
+    volatile uint32_t dropped;  //!< Messages dropped because they did not fit
+    UART_HandleTypeDef *huart;  //!< UART draining the ring, NULL for a free one
+} log_ring_t;
+
+/** @brief `inflight` value while a context is starting a transfer. */
+#define LOG_RING_CLAIMED 0xFFFFFFFFUL
+
+/** @brief One producer in the upper half of `log_ring_t::state`. */
+#define LOG_RING_WRITER (1UL << 16)
+
+#endif // LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+
+/*!
+ * @brief Record posted to the logger task queue.
+ */
+typedef struct
+{
+    TickType_t posted;             //!< Tick count when the record was posted
+    UART_HandleTypeDef *huart;     //!< Destination UART
+    uint16_t len;                  //!< Message length
+    uint8_t data[LOG_BUFFER_SIZE]; //!< Message bytes
+} log_queue_record_t;
+
+_Static_assert(LOG_QUEUE_DEPTH <= 256, "LOG_QUEUE_DEPTH must fit slot indexes in one byte");
+
+/*!
+ * @brief Logger task queue and statistics.
+ *
+ * The records live in a pool of slots and the queues only carry slot indexes: a producer takes a
+ * free slot, copies its message into it and posts the index; the logger task sends the slot and
+ * gives it back. Each message is copied once, and no record is built on the producer's stack.
+ */
+typedef struct
+{
+    QueueHandle_t handle;            //!< Posted slots, NULL until LOGGER_RTOS_INIT()
+    QueueHandle_t free;              //!< Free slots
+    log_queue_record_t slots[LOG_QUEUE_DEPTH];
+    volatile uint8_t sending;        //!< A batch of released slots is being transmitted
+    volatile uint32_t high_water;    //!< Highest number of records waiting
+    volatile uint32_t dropped;       //!< Records dropped because the queue was full
+    volatile uint32_t latency_sum;   //!< Sum of post-to-transmit latencies, in ticks
+    volatile uint32_t latency_count; //!< Number of latencies in `latency_sum`
+#if LOG_BATCH_SIZE > 0
+    log_queue_record_t *volatile next; //!< Record taken for the next batch, not copied yet
+    UART_HandleTypeDef *batch_huart;   //!< Destination of the batch
+    volatile uint16_t batch_len;       //!< Bytes copied into `batch`
+    volatile uint8_t batch_tx;         //!< The batch is being transmitted
+    uint8_t batch[LOG_BATCH_SIZE + LOG_BUFFER_SIZE];
+#endif
+} log_queue_t;
+
+#endif // LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+
+#if LOG_PERSIST != LOG_PERSIST_OFF
+
+_Static_assert((LOG_PERSIST_SIZE & (LOG_PERSIST_SIZE - 1)) == 0,
+               "LOG_PERSIST_SIZE must be a power of two");
+
+/** @brief Header magic, combined with the size so a resized log is not trusted. */
+#define LOG_PERSIST_MAGIC (0x4C4F4731UL ^ (uint32_t) LOG_PERSIST_SIZE)
+
+/*!
+ * @brief RAM log that survives a warm reset.
+ *
+ * `head` and `tail` are free-running indices like in the DMA ring. `tail` is the oldest byte
+ * that was not yet replayed, read or flushed; older bytes are overwritten when the log is full.
+ */
+typedef struct
+{
+    uint32_t magic;                //!< LOG_PERSIST_MAGIC once initialized
+    uint32_t head;                 //!< Write index
+    uint32_t tail;                 //!< Read index
+    uint32_t crc;                  //!< CRC-32 of the fields above
+    uint8_t buf[LOG_PERSIST_SIZE]; //!< Log storage
+} log_persist_t;
+
+#endif // LOG_PERSIST != LOG_PERSIST_OFF
+
+#if LOG_FRAMING == LOG_FRAMING_COBS
+
+/*!
+ * @brief Incremental COBS encoder: zero bytes are replaced by the distance to the next one.
+ */
+typedef struct
+{
+    uint8_t *out; //!< Frame being built
+    size_t len;   //!< Bytes written to `out`
+    size_t code;  //!< Position of the current block's code byte
+    uint16_t crc; //!< CRC-16 of the bytes encoded so far
+} log_cobs_t;
+
+#endif // LOG_FRAMING == LOG_FRAMING_COBS
+
+#if LOG_STREAMS
+
+/*!
+ * @brief Output stream of deferred records: a sink, a channel or the RAM log.
+ *
+ * Each destination numbers and timestamps the records it is actually given, so a filtering level
+ * leaves neither a gap nor a wrong delta.
+ */
+typedef struct
+{
+#if LOG_FRAMING == LOG_FRAMING_COBS
+    uint32_t seq; //!< Sequence number of the last frame
+#endif
+#if LOG_DEFERRED_COMPACT
+    uint32_t last;    //!< Timestamp of the last record
+    uint32_t sync;    //!< Records left before an absolute timestamp
+    uint32_t dropped; //!< Channel drops when the last record was encoded
+#endif
+} log_stream_t;
+
+#endif // LOG_STREAMS
+
+/*!
+ * @brief Deferred record on its way to the output streams.
+ */
+typedef struct
+{
+    const uint8_t *data; //!< Record, starting with its length byte
+    size_t len;          //!< Record size, including the length byte
+#if LOG_DEFERRED_COMPACT
+    size_t split;       //!< Offset of the LOG_COMPACT_STAMP bytes left for the timestamp
+    uint32_t timestamp; //!< Timestamp, encoded by each stream
+    uint32_t dropped;   //!< Channel drops when the record was sent
+#endif
+} log_record_t;
+
+/*!
+ * @brief Registered output sink.
+ */
+typedef struct
+{
+    log_sink_write_t write; //!< Write function, NULL for an unused entry
+    void *ctx;              //!< Context pointer passed to `write`
+    log_level_t level;      //!< Minimum severity sent to the sink
+#if LOG_STREAMS
+    log_stream_t stream; //!< Deferred records sent to the sink
+#endif
+} log_sink_t;
+
+#if LOG_MAX_CHANNELS > 1
+
+/*!
+ * @brief Output channel; the console entry only holds its counters.
+ */
+typedef struct
+{
+    log_sink_write_t write;     //!< Output of the channel, NULL until LOGGER_CHANNEL_INIT()
+    void *ctx;                  //!< Context pointer passed to `write`
+    volatile log_level_t level; //!< Minimum severity of the channel
+    volatile uint32_t writes;   //!< Lines or records sent
+    volatile uint32_t bytes;    //!< Bytes sent
+    volatile uint32_t dropped;  //!< Messages logged before LOGGER_CHANNEL_INIT()
+#if LOG_STREAMS
+    log_stream_t stream; //!< Deferred records sent to the channel
+#endif
+} log_channel_t;
+
+#endif // LOG_MAX_CHANNELS > 1
+
+/*!
+ * @brief Colors and tag written around the prefix of each level.
+ */
+typedef struct
+{
+    const char *color;         //!< Escape sequence written before the prefix
+    const char *tag;           //!< Level tag
+    const char *after_prefix;  //!< Written between the prefix and the message
+    const char *after_message; //!< Written after the message
+} log_prefix_t;
+
+/** @brief USART transmit data register: `TDR` on the newer families, `DR` on F1/F2/F4/L1. */
+#if defined(USART_TDR_TDR)
+#define LOG_USART_TDR(usart) ((usart)->TDR)
+#else
+#define LOG_USART_TDR(usart) ((usart)->DR)
+#endif
+
+/* =======================================================================
+ * [PRIVATE DATA]
+ * =======================================================================
+ */
+
+#if LOG_PREFIX_COLOR
+#define LOG_COLOR(code) code
+#else
+#define LOG_COLOR(code) ""
+#endif
+
+#if LOG_PREFIX_LEVEL == LOG_PREFIX_LEVEL_CHAR
+#define LOG_TAG(tag, ch) ch
+#else
+#define LOG_TAG(tag, ch) tag
+#endif
+
+// DEBUG lines are entirely white; other levels only color their prefix.
+static const log_prefix_t kPrefix[LOG_LEVEL_COUNT] = {
+    [LOG_LEVEL_DEBUG] = {LOG_COLOR(KWHT), LOG_TAG("[DBG]", "D"), "", LOG_COLOR(KNRM)},
+    [LOG_LEVEL_INFO] = {LOG_COLOR(KGRN), LOG_TAG("[INF]", "I"), LOG_COLOR(KNRM), ""},
+    [LOG_LEVEL_WARNING] = {LOG_COLOR(KYEL), LOG_TAG("[WRN]", "W"), LOG_COLOR(KNRM), ""},
+    [LOG_LEVEL_ERROR] = {LOG_COLOR(KRED), LOG_TAG("[ERR]", "E"), LOG_COLOR(KNRM), ""},
+};
+
+#if LOGGER_OUTPUT_MODE != LOGGER_OUTPUT_DMA
+static log_stage_t sStage;
+#else
+static volatile uint32_t sSinkDropped; //!< log_sink_uart_blocking() calls from interrupt context
+#endif
+static log_sink_t sSinks[LOG_MAX_SINKS] = {
+    [LOG_SINK_UART] = {.write = log_sink_uart, .level = LOG_LEVEL_DEBUG},
+};
+static volatile uint32_t sTruncated;
+static log_level_t sThresholdLevel = LOG_LEVEL_DEBUG; //!< gLogLevel in the module thresholds
+static volatile uint8_t sPanic; //!< Set by LOGGER_PANIC_FLUSH(): the UART is polled from then on
+
+#if LOG_MAX_CHANNELS > 1
+static log_channel_t sChannels[LOG_MAX_CHANNELS];
+#endif
+
+#if LOG_PERSIST != LOG_PERSIST_OFF
+static log_persist_t sPersist __attribute__((section(LOG_PERSIST_SECTION)));
+static uint8_t sPersistChecked;  //!< Header validated since boot (cleared by the startup code)
+static uint32_t sPersistDropped; //!< Writes that overwrote bytes not yet read or flushed
+#endif
+
+#if LOG_DEDUP
+static uint32_t sDedupHash;  //!< Hash of the last message sent
+static uint32_t sDedupCount; //!< Repetitions of that message not reported yet
+#endif
+
+static uint64_t sTimestampHigh; //!< Upper part of the extended timestamp
+static uint32_t sTimestampLast; //!< Last raw counter value, to detect wraparound
+
+#if LOG_BUFFER_PLACEMENT == LOG_BUFFER_SHARED
+static uint8_t sBuffer[LOG_BUFFER_SIZE]; //!< Format buffer shared by every context
+static volatile uint32_t sBufferBusy;    //!< `sBuffer` is being used
+#endif
+
+#if LOG_STREAMS && LOG_PERSIST != LOG_PERSIST_OFF
+static log_stream_t sPersistStream; //!< Deferred records copied into the RAM log
+#endif
+
+#if LOG_STATS
+static log_stats_t sStats = {.cycles_min = UINT32_MAX}; //!< `cycles_avg` is computed on read
+static uint64_t sStatsCycles;                            //!< Cycles of every timed call
+#endif
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+static log_ring_t sRing = {.huart = &LOG_UART};
+#if LOG_DMA_RINGS > 0
+static log_ring_t sDmaRings[LOG_DMA_RINGS]; //!< Rings of log_sink_uart_dma(), bound at registration
+#endif
+#endif
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+static log_queue_t sQueue;
+#if configSUPPORT_STATIC_ALLOCATION
+static StaticQueue_t sQueueControl;
+static StaticQueue_t sQueueFreeControl;
+static uint8_t sQueueStorage[LOG_QUEUE_DEPTH];
+static uint8_t sQueueFreeStorage[LOG_QUEUE_DEPTH];
+#endif
+#endif
+
+/* =======================================================================
+ * [PRIVATE FUNCTIONS]
+ * =======================================================================
+ */
+
+/*!
+ * @brief Atomically replaces `*ptr` with `desired` if it still holds `expected`.
+ *
+ * @return 1 if the value was replaced, 0 if another context changed it first.
+ */
+static inline int log_cas(volatile uint32_t *ptr, uint32_t expected, uint32_t desired)
+{
+#if LOG_EXCLUSIVE
+    do
+    {
+        if (__LDREXW(ptr) != expected)
+        {
+            __CLREX();
+            return 0;
+        }
+    } while (__STREXW(desired, ptr) != 0);
+
+    return 1;
+#else
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    int swapped = (*ptr == expected);
+
+    if (swapped)
+    {
+        *ptr = desired;
+    }
+
+    __set_PRIMASK(primask);
+    return swapped;
+#endif
+}
+
+/*!
+ * @brief Atomically adds `value` to `*ptr`.
+ *
+ * @return The new value.
+ */
+static inline uint32_t log_atomic_add(volatile uint32_t *ptr, uint32_t value)
+{
+    uint32_t old;
+
+    do
+    {
+        old = *ptr;
+    } while (!log_cas(ptr, old, old + value));
+
+    return old + value;
+}
+
+#if LOG_STATS || LOG_TIMESTAMP == LOG_TIMESTAMP_DWT
+
+/*!
+ * @brief Reads the DWT cycle counter, enabling it on first use.
+ */
+static inline uint32_t log_dwt_cycles(void)
+{
+    if ((DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) == 0)
+    {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+
+    return DWT->CYCCNT;
+}
+
+#endif
+
+#if LOG_STATS
+
+/*!
+ * @brief Accounts a logging call of `level` (LOG_LEVEL_RAW for LOG_RAW()) started at `start`.
+ */
+static void log_stats_call(log_level_t level, uint32_t start)
+{
+    uint32_t cycles = log_dwt_cycles() - start;
+
+    if (level < LOG_LEVEL_COUNT)
+    {
+        sStats.messages[level]++;
+    }
+    else
+    {
+        sStats.raw++;
+    }
+
+    if (cycles < sStats.cycles_min)
+    {
+        sStats.cycles_min = cycles;
+    }
+
+    if (cycles > sStats.cycles_max)
+    {
+        sStats.cycles_max = cycles;
+    }
+
+    sStatsCycles += cycles;
+}
+
+/*!
+ * @brief Records the output backlog if it is the highest seen so far.
+ */
+static inline void log_stats_peak(uint32_t backlog)
+{
+    if (backlog > sStats.peak)
+    {
+        sStats.peak = backlog;
+    }
+}
+
+// Time the body of a public logging function.
+#define LOG_STATS_START() uint32_t stats_start = log_dwt_cycles()
+#define LOG_STATS_STOP(level) log_stats_call((log_level_t) (level), stats_start)
+
+#else
+
+#define LOG_STATS_START() ((void) 0)
+#define LOG_STATS_STOP(level) ((void) 0)
+
+#endif // LOG_STATS
+
+#if LOGGER_OUTPUT_MODE != LOGGER_OUTPUT_DMA
+
+/*!
+ * @brief Copies a message logged from interrupt context for `huart` into the next staging slot.
+ */
+static void log_stage_write(log_stage_t *stage, UART_HandleTypeDef *huart, const uint8_t *data,
+                            size_t len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+
+    if (len > LOG_BUFFER_SIZE)
+    {
+        len = LOG_BUFFER_SIZE;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (stage->head - stage->tail >= LOG_ISR_SLOTS)
+    {
+        stage->dropped++;
+        __set_PRIMASK(primask);
+        return;
+    }
+
+    uint32_t index = stage->head++;
+    __set_PRIMASK(primask);
+
+#if LOG_STATS && LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_BLOCKING
+    log_stats_peak(stage->head - stage->tail);
+#endif
+
+    log_stage_slot_t *slot = &stage->slot[index % LOG_ISR_SLOTS];
+    slot->huart = huart;
+    memcpy(slot->data, data, len);
+
+    // Commit only after the bytes are in memory.
+    __DMB();
+    slot->len = (uint16_t) len;
+}
+
+/*!
+ * @brief Returns the oldest committed staging slot, or NULL if there is none.
+ */
+static log_stage_slot_t *log_stage_peek(log_stage_t *stage)
+{
+    if (stage->tail == stage->head)
+    {
+        return NULL;
+    }
+
+    log_stage_slot_t *slot = &stage->slot[stage->tail % LOG_ISR_SLOTS];
+    return (slot->len != 0) ? slot : NULL;
+}
+
+/*!
+ * @brief Releases the slot returned by log_stage_peek().
+ */
+static void log_stage_release(log_stage_t *stage)
+{
+    stage->slot[stage->tail % LOG_ISR_SLOTS].len = 0;
+    __DMB();
+    stage->tail++;
+}
+
+/*!
+ * @brief Transmits every committed staging slot with the blocking HAL call (thread context).
+ */
+static void log_stage_drain(log_stage_t *stage)
+{
+    log_stage_slot_t *slot;
+
+    while ((slot = log_stage_peek(stage)) != NULL)
+    {
+        HAL_UART_Transmit(slot->huart, slot->data, slot->len, HAL_MAX_DELAY);
+        log_stage_release(stage);
+    }
+}
+
+#endif // LOGGER_OUTPUT_MODE != LOGGER_OUTPUT_DMA
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+
+/*!
+ * @brief Checks whether the queued ring bytes should be sent now or wait for more.
+ */
+static inline int log_batch_ready(const log_ring_t *ring, uint32_t pending)
+{
+#if LOG_LOWPOWER
+    // While sleeping, the UART is only woken up for a full enough ring.
+    if (ring->sleeping && !ring->flush)
+    {
+        return pending >= LOG_LOWPOWER_THRESHOLD;
+    }
+#endif
+
+#if LOG_BATCH_SIZE > 0
+    return ring->flush || pending >= LOG_BATCH_SIZE ||
+           (HAL_GetTick() - ring->since) >= LOG_BATCH_DEADLINE_MS;
+#else
+    (void) ring;
+    (void) pending;
+    return 1;
+#endif
+}
+
+/*!
+ * @brief Starts a DMA transfer if the UART is idle and complete bytes are pending.
+ *
+ * The oldest contiguous chunk of the ring is sent once the batch is ready. Safe to call from
+ * any context: the transfer is started by whichever caller claims the idle `inflight` word, and
+ * a caller that loses the claim leaves the work to the winner, which checks the ring again
+ * before giving the claim back.
+ */
+static void log_dma_kick(log_ring_t *ring)
+{
+    for (;;)
+    {
+        if (!log_cas(&ring->inflight, 0, LOG_RING_CLAIMED))
+        {
+            return;
+        }
+
+        uint32_t state = ring->state;
+
+        if ((state >> 16) == 0)
+        {
+            ring->head = (uint16_t) state;
+        }
+
+        uint32_t pending = (uint16_t) (ring->head - ring->tail);
+
+        if (pending != 0 && log_batch_ready(ring, pending))
+        {
+            uint32_t start = ring->tail & (LOG_RING_SIZE - 1);
+            uint32_t chunk = (pending < LOG_RING_SIZE - start) ? pending : LOG_RING_SIZE - start;
+
+#if LOG_LOWPOWER
+            // The UART is awake now: drain the whole ring before it goes back to sleep.
+            if (ring->sleeping)
+            {
+                ring->flush = 1;
+            }
+#endif
+
+            ring->inflight = chunk;
+
+            if (HAL_UART_Transmit_DMA(ring->huart, &ring->buf[start], (uint16_t) chunk) != HAL_OK)
+            {
+                // UART busy with a foreign transfer: retry on the next write.
+                ring->inflight = 0;
+            }
+
+            return;
+        }
+
+        if (pending == 0)
+        {
+            ring->flush = 0;
+        }
+
+        ring->inflight = 0;
+        __DMB();
+
+        // A producer that finished while the claim was held could not start the transfer.
+        if (ring->state == state)
+        {
+            return;
+        }
+    }
+}
+
+/*!
+ * @brief Checks whether the caller may wait for the ring to drain.
+ *
+ * The transmit-complete interrupt must be able to preempt the caller, and no preempted context
+ * may be holding the ring back (a producer still copying or a transfer being started).
+ */
+static inline int log_ring_can_wait(const log_ring_t *ring, uint32_t state)
+{
+    return __get_PRIMASK() == 0 && __get_IPSR() == 0 && (state >> 16) == 0 &&
+           ring->inflight != LOG_RING_CLAIMED;
+}
+
+/*!
+ * @brief Copies a whole message into the ring, applying the overflow policy.
+ *
+ * The space is reserved with a compare-and-swap on `state`, then filled without any lock. The
+ * message becomes visible to the consumer once no producer is copying anymore, so a producer
+ * preempted mid-copy holds back the later messages until it resumes.
+ */
+static void log_ring_write(log_ring_t *ring, const uint8_t *data, size_t len)
+{
+    if (len == 0)
+    {
+        return;
+    }
+
+    if (len > LOG_RING_SIZE)
+    {
+        log_atomic_add(&ring->dropped, 1);
+        return;
+    }
+
+    uint32_t state;
+    uint32_t used;
+
+    for (;;)
+    {
+        state = ring->state;
+        used = (uint16_t) (state - ring->tail);
+
+        if (LOG_RING_SIZE - used < len)
+        {
+#if LOG_OVERFLOW_POLICY == LOG_OVERFLOW_BLOCK
+            if (log_ring_can_wait(ring, state))
+            {
+                log_dma_kick(ring);
+                continue;
+            }
+#endif
+            log_atomic_add(&ring->dropped, 1);
+            return;
+        }
+
+        uint32_t reserved =
+            ((state + LOG_RING_WRITER) & 0xFFFF0000UL) | (uint16_t) (state + (uint32_t) len);
+
+        if (log_cas(&ring->state, state, reserved))
+        {
+            break;
+        }
+    }
+
+#if LOG_STATS
+    log_stats_peak(used + (uint32_t) len);
+#endif
+
+    uint32_t start = state & (LOG_RING_SIZE - 1);
+    size_t first = LOG_RING_SIZE - start;
+
+    if (first > len)
+    {
+        first = len;
+    }
+
+    memcpy(&ring->buf[start], data, first);
+    memcpy(&ring->buf[0], data + first, len - first);
+
+#if LOG_BATCH_SIZE > 0
+    if (used == 0)
+    {
+        ring->since = HAL_GetTick();
+    }
+#endif
+
+    // Commit only after the bytes are in memory.
+    __DMB();
+    log_atomic_add(&ring->state, (uint32_t) -LOG_RING_WRITER);
+}
+
+#if LOG_DIRECT
+
+/*!
+ * @brief Reserves LOG_BUFFER_SIZE bytes of the ring for a message formatted in place.
+ *
+ * Only taken while no other producer is writing, so that every writer still active when the
+ * reservation is committed started after it.
+ *
+ * @return 1 on success, 0 if the ring is too full or busy: the message must then go through
+ *         log_ring_write(), which applies the overflow policy.
+ */
+static int log_ring_reserve(log_ring_t *ring, log_ring_slot_t *slot)
+{
+    uint32_t state;
+    uint32_t used;
+
+    do
+    {
+        state = ring->state;
+        used = (uint16_t) (state - ring->tail);
+
+        if ((state >> 16) != 0 || LOG_RING_SIZE - used < LOG_BUFFER_SIZE)
+        {
+            return 0;
+        }
+    } while (!log_cas(&ring->state, state,
+                      LOG_RING_WRITER | (uint16_t) (state + LOG_BUFFER_SIZE)));
+
+#if LOG_BATCH_SIZE > 0
+    if (used == 0)
+    {
+        ring->since = HAL_GetTick();
+    }
+#endif
+
+    // The slack past the end keeps the reservation contiguous.
+    slot->start = (uint16_t) state;
+    slot->data = (char *) &ring->buf[state & (LOG_RING_SIZE - 1)];
+    return 1;
+}
+
+/*!
+ * @brief Commits the first `len` bytes of a reservation and gives the rest back.
+ *
+ * Messages written after this one, by interrupt handlers that ran while it was being formatted,
+ * are moved down over the unused space; that move, usually empty, runs with interrupts disabled.
+ * They are complete when producers preempt each other in LIFO order. Otherwise (tasks of the same
+ * priority time-sliced in the middle of a message) the commit waits for them to finish.
+ */
+static void log_ring_commit(log_ring_t *ring, const log_ring_slot_t *slot, size_t len)
+{
+    const uint32_t mask = LOG_RING_SIZE - 1;
+    uint32_t pos = slot->start & mask;
+
+    // The part written in the slack belongs to the start of the ring.
+    if (pos + len > LOG_RING_SIZE)
+    {
+        memcpy(&ring->buf[0], &ring->buf[LOG_RING_SIZE], pos + len - LOG_RING_SIZE);
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    uint32_t state;
+
+    // The other writers started after the reservation: their bytes are moved once they are done.
+    for (;;)
+    {
+        __disable_irq();
+        state = ring->state;
+
+        if ((state >> 16) == 1)
+        {
+            break;
+        }
+
+        __set_PRIMASK(primask);
+    }
+
+    uint16_t to = (uint16_t) (slot->start + len);
+    uint16_t from = (uint16_t) (slot->start + LOG_BUFFER_SIZE);
+    uint16_t count = (uint16_t) ((uint16_t) state - from);
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+        ring->buf[(uint16_t) (to + i) & mask] = ring->buf[(uint16_t) (from + i) & mask];
+    }
+
+    __DMB();
+    ring->state = ((state - LOG_RING_WRITER) & 0xFFFF0000UL) |
+                  (uint16_t) (state - (LOG_BUFFER_SIZE - len));
+
+    __set_PRIMASK(primask);
+
+#if LOG_STATS
+    log_stats_peak((uint16_t) (ring->state - ring->tail));
+#endif
+}
+
+#endif // LOG_DIRECT
+
+/*!
+ * @brief Returns the ring drained by a UART, or NULL if it has none.
+ */
+static log_ring_t *log_ring_find(const UART_HandleTypeDef *huart)
+{
+    if (huart == sRing.huart)
+    {
+        return &sRing;
+    }
+
+#if LOG_DMA_RINGS > 0
+    for (int i = 0; huart != NULL && i < LOG_DMA_RINGS; i++)
+    {
+        if (sDmaRings[i].huart == huart)
+        {
+            return &sDmaRings[i];
+        }
+    }
+#endif
+
+    return NULL;
+}
+
+/*!
+ * @brief Returns the ring of a UART, taking a free one if it has none yet (initialization only).
+ */
+static log_ring_t *log_ring_bind(UART_HandleTypeDef *huart)
+{
+    log_ring_t *ring = log_ring_find(huart);
+
+#if LOG_DMA_RINGS > 0
+    for (int i = 0; huart != NULL && ring == NULL && i < LOG_DMA_RINGS; i++)
+    {
+        if (sDmaRings[i].huart == NULL)
+        {
+            ring = &sDmaRings[i];
+            ring->huart = huart;
+        }
+    }
+#endif
+
+    return ring;
+}
+
+/*!
+ * @brief Sends a ring without waiting for a batch and, when possible, waits until it is empty.
+ */
+static void log_ring_flush(log_ring_t *ring)
+{
+    ring->flush = 1;
+    log_dma_kick(ring);
+
+    for (;;)
+    {
+        uint32_t state = ring->state;
+
+        if (!log_ring_can_wait(ring, state) ||
+            (ring->inflight == 0 && (uint16_t) state == ring->tail))
+        {
+            break;
+        }
+
+        log_dma_kick(ring);
+    }
+}
+
+#endif // LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+
+/*!
+ * @brief Posts a message for `huart` to the logger task without ever blocking the caller.
+ *
+ * Before LOGGER_RTOS_INIT() (e.g. early boot code) the message is transmitted directly.
+ */
+static void log_queue_post(log_queue_t *queue, UART_HandleTypeDef *huart, const uint8_t *data,
+                           size_t len)
+{
+    if (queue->handle == NULL)
+    {
+        HAL_UART_Transmit(huart, (uint8_t *) data, (uint16_t) len, HAL_MAX_DELAY);
+        return;
+    }
+
+    uint8_t slot;
+
+    // Zero timeout: with every slot taken the record is dropped instead of blocking the producer.
+    if (xQueueReceive(queue->free, &slot, 0) != pdTRUE)
+    {
+        queue->dropped++;
+        return;
+    }
+
+    log_queue_record_t *record = &queue->slots[slot];
+
+    if (len > LOG_BUFFER_SIZE)
+    {
+        len = LOG_BUFFER_SIZE;
+    }
+
+    record->posted = xTaskGetTickCount();
+    record->huart = huart;
+    record->len = (uint16_t) len;
+    memcpy(record->data, data, len);
+
+    // Never full: it has room for every slot.
+    (void) xQueueSendToBack(queue->handle, &slot, 0);
+}
+
+#endif // LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+
+/*!
+ * @brief Sends a message to every sink whose level it passes.
+ */
+static void log_fanout(log_level_t level, const uint8_t *data, size_t len)
+{
+    for (int i = 0; i < LOG_MAX_SINKS; i++)
+    {
+        const log_sink_t *sink = &sSinks[i];
+
+        if (sink->write != NULL && sink->level != LOG_LEVEL_OFF && level >= sink->level)
+        {
+            sink->write(sink->ctx, data, len);
+        }
+    }
+}
+
+#if LOG_PERSIST == LOG_PERSIST_BUFFERED
+
+/*!
+ * @brief Returns 1 if at least one sink takes messages of `level`.
+ */
+static int log_fanout_wanted(log_level_t level)
+{
+    for (int i = 0; i < LOG_MAX_SINKS; i++)
+    {
+        const log_sink_t *sink = &sSinks[i];
+
+        if (sink->write != NULL && sink->level != LOG_LEVEL_OFF && level >= sink->level)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+#endif // LOG_PERSIST == LOG_PERSIST_BUFFERED
+
+#if LOG_MAX_CHANNELS > 1
+
+/*!
+ * @brief Counts a line or record sent to a channel.
+ */
+static inline void log_channel_count(log_channel_t *channel, size_t len)
+{
+    channel->writes++;
+    channel->bytes += (uint32_t) len;
+}
+
+#endif // LOG_MAX_CHANNELS > 1
+
+/*!
+ * @brief Sends a line or record to its channel: log_write() for the console, the channel's own
+ *        output otherwise.
+ */
+static void log_output(uint8_t channel, log_level_t level, const uint8_t *data, size_t len)
+{
+#if LOG_MAX_CHANNELS > 1
+    log_channel_t *ch = &sChannels[channel];
+
+    if (channel != LOG_CHANNEL_CONSOLE)
+    {
+        log_sink_write_t write = ch->write;
+
+        if (write == NULL)
+        {
+            ch->dropped++;
+            return;
+        }
+
+        log_channel_count(ch, len);
+        write(ch->ctx, data, len);
+        return;
+    }
+
+    log_channel_count(ch, len);
+#else
+    (void) channel;
+#endif
+
+    log_write(level, data, len);
+}
+
+#if LOG_DEFERRED_COMPACT || LOG_MAX_CHANNELS > 1
+
+/*!
+ * @brief Returns the number of messages a channel dropped.
+ */
+static uint32_t log_channel_dropped(uint8_t channel)
+{
+#if LOG_MAX_CHANNELS > 1
+    if (channel != LOG_CHANNEL_CONSOLE)
+    {
+        const log_channel_t *ch = &sChannels[channel];
+        uint32_t dropped = ch->dropped;
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+        const log_ring_t *ring = (ch->write == log_sink_uart_dma) ? log_ring_find(ch->ctx) : NULL;
+
+        if (ring != NULL && ring != &sRing)
+        {
+            dropped += ring->dropped;
+        }
+#endif
+
+        return dropped;
+    }
+#else
+    (void) channel;
+#endif
+
+    return LOGGER_GET_DROPPED();
+}
+
+#endif // LOG_DEFERRED_COMPACT || LOG_MAX_CHANNELS > 1
+
+#if LOG_PERSIST != LOG_PERSIST_OFF
+
+/* =======================================================================
+ * [PERSISTENT LOG]
+ * =======================================================================
+ */
+
+/*!
+ * @brief Computes a CRC-32 (IEEE 802.3), one nibble at a time to keep the table small.
+ */
+static uint32_t log_crc32(const uint8_t *data, size_t len)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4,
+        0x4DB26158, 0x5005713C, 0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+    uint32_t crc = 0xFFFFFFFFUL;
+
+    while (len--)
+    {
+        crc = (crc >> 4) ^ table[(crc ^ *data) & 0x0F];
+        crc = (crc >> 4) ^ table[(crc ^ (*data >> 4)) & 0x0F];
+        data++;
+    }
+
+    return ~crc;
+}
+
+static inline uint32_t log_persist_crc(const log_persist_t *log)
+{
+    return log_crc32((const uint8_t *) log, offsetof(log_persist_t, crc));
+}
+
+/*!
+ * @brief Validates the RAM log header once per boot and resets it if it cannot be trusted.
+ *
+ * @note Must be called with interrupts disabled.
+ */
+static void log_persist_check(log_persist_t *log)
+{
+    if (sPersistChecked)
+    {
+        return;
+    }
+
+    if (log->magic != LOG_PERSIST_MAGIC || log->crc != log_persist_crc(log) ||
+        (uint32_t) (log->head - log->tail) > LOG_PERSIST_SIZE)
+    {
+        log->magic = LOG_PERSIST_MAGIC;
+        log->head = 0;
+        log->tail = 0;
+        log->crc = log_persist_crc(log);
+    }
+
+    sPersistChecked = 1;
+}
+
+/*!
+ * @brief Appends a message to the RAM log, overwriting the oldest bytes if needed.
+ *
+ * The copy runs with interrupts disabled so that the header always matches the content, even if
+ * the system resets in the middle of a write.
+ */
+static void log_persist_write(log_persist_t *log, const uint8_t *data, size_t len)
+{
+    if (len > LOG_PERSIST_SIZE)
+    {
+        data += len - LOG_PERSIST_SIZE;
+        len = LOG_PERSIST_SIZE;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    log_persist_check(log);
+
+    uint32_t pos = log->head & (LOG_PERSIST_SIZE - 1);
+    size_t first = (len < LOG_PERSIST_SIZE - pos) ? len : LOG_PERSIST_SIZE - pos;
+
+    memcpy(&log->buf[pos], data, first);
+    memcpy(log->buf, data + first, len - first);
+    log->head += (uint32_t) len;
+
+    if ((uint32_t) (log->head - log->tail) > LOG_PERSIST_SIZE)
+    {
+        log->tail = log->head - LOG_PERSIST_SIZE;
+        sPersistDropped++;
+    }
+
+    log->crc = log_persist_crc(log);
+    __set_PRIMASK(primask);
+}
+
+/*!
+ * @brief Removes up to `size` of the oldest bytes from the RAM log.
+ *
+ * @return Number of bytes copied into `dst`.
+ */
+static size_t log_persist_read(log_persist_t *log, uint8_t *dst, size_t size)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    log_persist_check(log);
+
+    size_t len = (size_t) (log->head - log->tail);
+    len = (len < size) ? len : size;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        dst[i] = log->buf[(log->tail + i) & (LOG_PERSIST_SIZE - 1)];
+    }
+
+    log->tail += (uint32_t) len;
+    log->crc = log_persist_crc(log);
+
+    __set_PRIMASK(primask);
+    return len;
+}
+
+#endif // LOG_PERSIST != LOG_PERSIST_OFF
+
+/* =======================================================================
+ * [PANIC OUTPUT]
+ * =======================================================================
+ */
+
+/*!
+ * @brief Sends bytes by polling the USART registers: no HAL call, no lock, no interrupt.
+ */
+static void log_panic_write(UART_HandleTypeDef *huart, const uint8_t *data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        while (!__HAL_UART_GET_FLAG(huart, UART_FLAG_TXE))
+        {
+        }
+
+        LOG_USART_TDR(huart->Instance) = data[i];
+    }
+}
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+
+/*!
+ * @brief Stops the running transfer and sends the ring by polling, from the first byte the DMA
+ *        had not moved to the USART yet up to the reservation index.
+ */
+static void log_panic_drain_ring(log_ring_t *ring)
+{
+    UART_HandleTypeDef *huart = ring->huart;
+    uint16_t tail = ring->tail;
+    uint32_t inflight = ring->inflight;
+
+    // Claimed for good: no context starts a transfer anymore.
+    ring->inflight = LOG_RING_CLAIMED;
+    huart->Instance->CR3 &= ~USART_CR3_DMAT;
+
+    if (inflight != 0 && inflight != LOG_RING_CLAIMED && huart->hdmatx != NULL)
+    {
+        __HAL_DMA_DISABLE(huart->hdmatx);
+        tail = (uint16_t) (tail + inflight - __HAL_DMA_GET_COUNTER(huart->hdmatx));
+    }
+
+    // Messages still being copied are sent as they are: the later ones are complete.
+    uint16_t end = (uint16_t) ring->state;
+
+    for (; tail != end; tail++)
+    {
+        log_panic_write(huart, &ring->buf[tail & (LOG_RING_SIZE - 1)], 1);
+    }
+
+    ring->head = end;
+    ring->tail = end;
+}
+
+#else
+
+/*!
+ * @brief Sends the records queued for the logger task and the staged ISR messages by polling.
+ */
+static void log_panic_drain_queues(void)
+{
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+    uint8_t index;
+
+#if LOG_BATCH_SIZE > 0
+    // The batch goes first, from its first byte not sent, then the record taken for the next one:
+    // their slots left the queue.
+    if (sQueue.sending)
+    {
+        uint16_t sent = 0;
+
+        if (sQueue.batch_tx && sQueue.batch_huart->TxXferCount <= sQueue.batch_len)
+        {
+            sent = (uint16_t) (sQueue.batch_len - sQueue.batch_huart->TxXferCount);
+        }
+
+        log_panic_write(sQueue.batch_huart, &sQueue.batch[sent], sQueue.batch_len - sent);
+        sQueue.sending = 0;
+    }
+
+    if (sQueue.next != NULL)
+    {
+        log_panic_write(sQueue.next->huart, sQueue.next->data, sQueue.next->len);
+        sQueue.next = NULL;
+    }
+#endif
+
+    while (sQueue.handle != NULL && xQueueReceiveFromISR(sQueue.handle, &index, NULL) == pdTRUE)
+    {
+        log_panic_write(sQueue.slots[index].huart, sQueue.slots[index].data,
+                        sQueue.slots[index].len);
+    }
+#endif
+
+    log_stage_slot_t *slot;
+
+    while ((slot = log_stage_peek(&sStage)) != NULL)
+    {
+        log_panic_write(slot->huart, slot->data, slot->len);
+        log_stage_release(&sStage);
+    }
+}
+
+#endif // LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+
+/* =======================================================================
+ * [TIMESTAMPS]
+ * =======================================================================
+ */
+
+/*!
+ * @brief Reads the raw counter of the selected timestamp source.
+ */
+static inline uint32_t log_timestamp_raw(void)
+{
+#if LOG_TIMESTAMP == LOG_TIMESTAMP_DWT
+    return log_dwt_cycles();
+#elif LOG_TIMESTAMP == LOG_TIMESTAMP_TIMER
+    return (uint32_t) (LOG_TIMESTAMP_TIMER_READ());
+#else
+    return HAL_GetTick();
+#endif
+}
+
+/*!
+ * @brief Reads the timestamp source and extends it to 64 bits, counting wraparounds.
+ *
+ * The counter is read inside the critical section: a value read before it could be older than
+ * the one an interrupt stores meanwhile, and would count as a wraparound.
+ */
+static uint64_t log_timestamp_extend(void)
+{
+#if LOG_TIMESTAMP == LOG_TIMESTAMP_TIMER && LOG_TIMESTAMP_TIMER_BITS < 32
+    const uint64_t span = 1ULL << LOG_TIMESTAMP_TIMER_BITS;
+#else
+    const uint64_t span = 1ULL << 32;
+#endif
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    uint32_t now = log_timestamp_raw();
+
+#if LOG_TIMESTAMP == LOG_TIMESTAMP_TIMER && LOG_TIMESTAMP_TIMER_BITS < 32
+    now &= (uint32_t) (span - 1);
+#endif
+
+    if (now < sTimestampLast)
+    {
+        sTimestampHigh += span;
+    }
+
+    sTimestampLast = now;
+    uint64_t timestamp = sTimestampHigh + now;
+
+    __set_PRIMASK(primask);
+    return timestamp;
+}
+
+/* =======================================================================
+ * [MESSAGE HELPERS]
+ * =======================================================================
+ */
+
+static inline const char *log_module_name(const log_instance_t *module)
+{
+    return (module != NULL) ? module->name : NULL;
+}
+
+/*!
+ * @brief Returns the channel of a module, the console for global logging.
+ */
+static inline uint8_t log_module_channel(const log_instance_t *module)
+{
+#if LOG_MAX_CHANNELS > 1
+    return (module != NULL) ? module->channel : LOG_CHANNEL_CONSOLE;
+#else
+    (void) module;
+    return LOG_CHANNEL_CONSOLE;
+#endif
+}
+
+/*!
+ * @brief Takes the format buffer (LOG_BUFFER_SIZE bytes) of the calling context.
+ *
+ * @return The buffer, or NULL if the message must be formatted on the stack.
+ */
+static inline uint8_t *log_buffer_take(void)
+{
+#if LOG_BUFFER_PLACEMENT == LOG_BUFFER_SHARED
+    return log_cas(&sBufferBusy, 0, 1) ? sBuffer : NULL;
+#elif LOG_BUFFER_PLACEMENT == LOG_BUFFER_TASK
+    if (__get_IPSR() != 0 || xTaskGetSchedulerState() != taskSCHEDULER_RUNNING)
+    {
+        return NULL;
+    }
+
+    // The low bit marks the buffer in use, for messages logged while formatting (LOG_DEDUP).
+    uintptr_t slot = (uintptr_t) pvTaskGetThreadLocalStoragePointer(NULL, LOG_TLS_INDEX);
+
+    if (slot == 0)
+    {
+        slot = (uintptr_t) pvPortMalloc(LOG_BUFFER_SIZE);
+    }
+
+    if (slot == 0 || (slot & 1U) != 0)
+    {
+        return NULL;
+    }
+
+    vTaskSetThreadLocalStoragePointer(NULL, LOG_TLS_INDEX, (void *) (slot | 1U));
+    return (uint8_t *) slot;
+#else
+    return NULL;
+#endif
+}
+
+/*!
+ * @brief Returns a buffer obtained from log_buffer_take().
+ */
+static inline void log_buffer_give(uint8_t *buf)
+{
+#if LOG_BUFFER_PLACEMENT == LOG_BUFFER_SHARED
+    (void) buf;
+    __DMB();
+    sBufferBusy = 0;
+#elif LOG_BUFFER_PLACEMENT == LOG_BUFFER_TASK
+    vTaskSetThreadLocalStoragePointer(NULL, LOG_TLS_INDEX, buf);
+#else
+    (void) buf;
+#endif
+}
+
+/*!
+ * @brief Starts a line of text: returns where to format it.
+ *
+ * With LOG_RING_DIRECT, that is a ring reservation when the line goes to the console, the
+ * built-in UART sink is the only one it passes and no panic flush happened. Otherwise it is `buf`,
+ * which may be NULL for a caller that only takes a buffer when there is no reservation.
+ */
+static inline char *log_line_begin(log_level_t level, uint8_t channel, char *buf,
+                                   log_ring_slot_t *slot)
+{
+    slot->data = NULL;
+    slot->start = 0;
+
+#if LOG_DIRECT
+    int uart = 0;
+
+    // After LOGGER_PANIC_FLUSH() nothing drains the ring: the line must reach the polled sink.
+    if (channel != LOG_CHANNEL_CONSOLE || sPanic)
+    {
+        return buf;
+    }
+
+    for (int i = 0; i < LOG_MAX_SINKS; i++)
+    {
+        const log_sink_t *sink = &sSinks[i];
+
+        if (sink->write != NULL && sink->level != LOG_LEVEL_OFF && level >= sink->level)
+        {
+            if (sink->write != log_sink_uart)
+            {
+                return buf;
+            }
+
+            uart++;
+        }
+    }
+
+    if (uart == 1 && log_ring_reserve(&sRing, slot))
+    {
+        return slot->data;
+    }
+#else
+    (void) level;
+    (void) channel;
+#endif
+
+    return buf;
+}
+
+/*!
+ * @brief Sends a line started with log_line_begin().
+ */
+static inline void log_line_end(log_level_t level, uint8_t channel, const char *msg, size_t len,
+                                const log_ring_slot_t *slot)
+{
+#if LOG_DIRECT
+    if (slot->data != NULL)
+    {
+#if LOG_STATS
+        sStats.bytes += (uint32_t) len;
+#endif
+#if LOG_MAX_CHANNELS > 1
+        log_channel_count(&sChannels[LOG_CHANNEL_CONSOLE], len);
+#endif
+        log_ring_commit(&sRing, slot, len);
+        log_dma_kick(&sRing);
+        return;
+    }
+#else
+    (void) slot;
+#endif
+
+    log_output(channel, level, (const uint8_t *) msg, len);
+}
+
+/*!
+ * @brief Appends a string to a message, keeping room for the terminator.
+ *
+ * @return New message length.
+ */
+static size_t log_append(char *buf, size_t len, size_t size, const char *str)
+{
+    while (*str && len + 1 < size)
+    {
+        buf[len++] = *str++;
+    }
+
+    buf[len] = '\0';
+    return len;
+}
+
+/*!
+ * @brief Appends a separator (unless it is `'\0'`) followed by a decimal number to a message.
+ *
+ * @return New message length.
+ */
+static size_t log_append_uint(char *buf, size_t len, size_t size, char sep, uint32_t value)
+{
+    char tmp[12];
+    char *p = tmp + sizeof(tmp);
+
+    *--p = '\0';
+
+    do
+    {
+        *--p = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+
+    if (sep != '\0')
+    {
+        *--p = sep;
+    }
+
+    return log_append(buf, len, size, p);
+}
+
+/*!
+ * @brief Appends the color, level, module and location prefix of a leveled message.
+ *
+ * @return New message length.
+ */
+static size_t log_append_prefix(char *buf, size_t len, size_t size, const log_prefix_t *prefix,
+                                const log_instance_t *module, const char *func, int line)
+{
+    len = log_append(buf, len, size, prefix->color);
+    len = log_append(buf, len, size, prefix->tag);
+
+#if LOG_PREFIX_MODULE == LOG_PREFIX_MODULE_NAME
+    if (module)
+    {
+        len = log_append(buf, len, size, "[");
+        len = log_append(buf, len, size, module->name);
+        len = log_append(buf, len, size, "]");
+    }
+#elif LOG_PREFIX_MODULE == LOG_PREFIX_MODULE_ID
+    int id = log_module_id(module);
+
+    if (id >= 0)
+    {
+        len = log_append_uint(buf, len, size, '[', (uint32_t) id);
+        len = log_append(buf, len, size, "]");
+    }
+#else
+    (void) module;
+#endif
+
+#if LOG_PREFIX_FUNC && LOG_PREFIX_LINE
+    len = log_append(buf, len, size, "[");
+    len = log_append(buf, len, size, func);
+    len = log_append_uint(buf, len, size, ':', (uint32_t) line);
+    len = log_append(buf, len, size, "]");
+#elif LOG_PREFIX_FUNC
+    len = log_append(buf, len, size, "[");
+    len = log_append(buf, len, size, func);
+    len = log_append(buf, len, size, "]");
+    (void) line;
+#elif LOG_PREFIX_LINE
+    len = log_append_uint(buf, len, size, '[', (uint32_t) line);
+    len = log_append(buf, len, size, "]");
+    (void) func;
+#else
+    (void) func;
+    (void) line;
+#endif
+
+    len = log_append(buf, len, size, ": ");
+    len = log_append(buf, len, size, prefix->after_prefix);
+
+    return len;
+}
+
+#if LOG_TIMESTAMP != LOG_TIMESTAMP_NONE
+/*!
+ * @brief Appends a `[seconds.microseconds]` timestamp to a message.
+ *
+ * @return New message length.
+ */
+static size_t log_append_timestamp(char *buf, size_t len, size_t size, uint64_t timestamp)
+{
+    uint32_t hz = (uint32_t) LOG_TIMESTAMP_HZ;
+    uint32_t seconds;
+    uint32_t rest;
+
+    // Seconds first, so that nothing overflows; a 64-bit division only once the counter has
+    // passed 32 bits.
+    if ((timestamp >> 32) == 0)
+    {
+        seconds = (uint32_t) timestamp / hz;
+        rest = (uint32_t) timestamp - seconds * hz;
+    }
+    else
+    {
+        seconds = (uint32_t) (timestamp / hz);
+        rest = (uint32_t) (timestamp - (uint64_t) seconds * hz);
+    }
+
+    uint32_t frac;
+
+    if (hz <= UINT32_MAX / 1000000U)
+    {
+        frac = rest * 1000000U / hz;
+    }
+    else if (hz % 1000000U == 0)
+    {
+        frac = rest / (hz / 1000000U);
+    }
+    else
+    {
+        frac = (uint32_t) (((uint64_t) rest * 1000000U) / hz);
+    }
+
+    char tmp[9];
+
+    tmp[0] = '.';
+    tmp[7] = ']';
+    tmp[8] = '\0';
+
+    for (int i = 6; i > 0; i--)
+    {
+        tmp[i] = (char) ('0' + frac % 10);
+        frac /= 10;
+    }
+
+    len = log_append_uint(buf, len, size, '[', seconds);
+    return log_append(buf, len, size, tmp);
+}
+#endif
+
+#if LOG_DEDUP
+
+/*!
+ * @brief Updates a 32-bit FNV-1a hash.
+ */
+static uint32_t log_hash(uint32_t hash, const uint8_t *data, size_t len)
+{
+    while (len--)
+    {
+        hash = (hash ^ *data++) * 16777619UL;
+    }
+
+    return hash;
+}
+
+/*!
+ * @brief Writes the number of repetitions of the last message, if any.
+ */
+static void log_dedup_flush(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    uint32_t repeated = sDedupCount;
+    sDedupCount = 0;
+
+    __set_PRIMASK(primask);
+
+    if (repeated != 0)
+    {
+        LOG_RAW("last message repeated %lu times\r\n", (unsigned long) repeated);
+    }
+}
+
+/*!
+ * @brief Checks whether a message repeats the previous one.
+ *
+ * @param hash Hash of the message, without its timestamp.
+ *
+ * @return 1 if the message is a repetition and must not be sent.
+ */
+static int log_dedup(uint32_t hash)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    int repeat = (hash == sDedupHash);
+
+    if (repeat)
+    {
+        sDedupCount++;
+    }
+
+    sDedupHash = hash;
+    __set_PRIMASK(primask);
+
+    if (!repeat)
+    {
+        log_dedup_flush();
+    }
+
+    return repeat;
+}
+
+#endif // LOG_DEDUP
+
+/*!
+ * @brief Appends a little-endian value to a deferred record.
+ */
+static inline uint8_t *log_put_le(uint8_t *p, uint64_t value, uint8_t size)
+{
+    for (uint8_t i = 0; i < size; i++)
+    {
+        *p++ = (uint8_t) (value >> (8 * i));
+    }
+
+    return p;
+}
+
+#if LOG_DEFERRED_COMPACT
+
+/*!
+ * @brief Maps signed values to unsigned ones so that small magnitudes stay small: 0, -1, 1, -2...
+ */
+static inline uint64_t log_zigzag(int64_t value)
+{
+    return (value < 0) ? ~((uint64_t) value << 1) : ((uint64_t) value << 1);
+}
+
+/*!
+ * @brief Number of bytes of a varint: 7 bits per byte, the top bit set on all but the last one.
+ */
+static inline uint8_t log_varint_size(uint64_t value)
+{
+    uint8_t size = 1;
+
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+
+    return size;
+}
+
+static inline uint8_t *log_put_varint(uint8_t *p, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *p++ = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+
+    *p++ = (uint8_t) value;
+    return p;
+}
+
+/*!
+ * @brief Encodes the timestamp of a compact record for one stream, with interrupts masked.
+ *
+ * The timestamp is sent as the delta from the previous record of the stream, except every
+ * LOG_COMPACT_SYNC records, after a loss, or when it went backwards (a record written by a
+ * preempted context), where the absolute value lets the decoder resynchronize.
+ *
+ * @return `delta << 1`, or `(timestamp << 1) | 1` for an absolute timestamp.
+ */
+static uint64_t log_compact_timestamp(log_stream_t *stream, const log_record_t *record)
+{
+    uint32_t now = record->timestamp;
+    uint32_t delta = now - stream->last;
+    uint32_t sync = stream->sync;
+    int absolute = (sync == 0 || record->dropped != stream->dropped || delta >= 0x80000000UL);
+
+    stream->last = now;
+    stream->dropped = record->dropped;
+    stream->sync = absolute ? LOG_COMPACT_SYNC - 1 : sync - 1;
+
+    return absolute ? (((uint64_t) now << 1) | 1) : ((uint64_t) delta << 1);
+}
+
+#endif // LOG_DEFERRED_COMPACT
+
+/*!
+ * @brief Size of an integer argument of a deferred record.
+ *
+ * @param size Size of the value in the non-compact encoding: 4 or 8 bytes.
+ */
+static inline uint8_t log_int_size(uint64_t value, uint8_t size)
+{
+#if LOG_DEFERRED_COMPACT
+    return log_varint_size(log_zigzag((size == 8) ? (int64_t) value : (int32_t) (uint32_t) value));
+#else
+    (void) value;
+    return size;
+#endif
+}
+
+/*!
+ * @brief Appends an integer argument to a deferred record.
+ */
+static inline uint8_t *log_put_int(uint8_t *p, uint64_t value, uint8_t size)
+{
+#if LOG_DEFERRED_COMPACT
+    return log_put_varint(p, log_zigzag((size == 8) ? (int64_t) value : (int32_t) (uint32_t) value));
+#else
+    return log_put_le(p, value, size);
+#endif
+}
+
+/** @brief Maximum size of a deferred record, including its length byte. */
+#define LOG_RECORD_SIZE (LOG_BUFFER_SIZE < 256 ? LOG_BUFFER_SIZE : 256)
+
+/** @brief Largest compact timestamp: a varint of up to 33 bits. */
+#define LOG_COMPACT_STAMP 5
+
+/*!
+ * @brief Writes the header of a deferred record: call-site ID, timestamp and module.
+ *
+ * The length byte (`rec[0]`) is filled in once the record is complete. A compact timestamp is a
+ * delta from the previous record of each stream: LOG_COMPACT_STAMP bytes are left for it, and
+ * log_stream_write() encodes it.
+ *
+ * @return Position of the first argument byte.
+ */
+static uint8_t *log_record_begin(log_record_t *record, uint8_t *rec, const log_site_t *site,
+                                 const log_instance_t *module)
+{
+    uint8_t *p = rec + 1;
+    const char *name = log_module_name(module);
+
+    record->data = rec;
+
+#if LOG_DEFERRED_COMPACT
+    p = log_put_varint(p, (uint32_t) (uintptr_t) site);
+    p = log_put_varint(p, (uint32_t) (uintptr_t) name);
+
+    record->split = (size_t) (p - rec);
+    record->timestamp = LOGGER_GET_TIMESTAMP();
+    p += LOG_COMPACT_STAMP;
+#else
+    p = log_put_le(p, (uint32_t) (uintptr_t) site, 4);
+    p = log_put_le(p, LOGGER_GET_TIMESTAMP(), 4);
+    p = log_put_le(p, (uint32_t) (uintptr_t) name, 4);
+#endif
+
+    return p;
+}
+
+#if LOG_FRAMING == LOG_FRAMING_COBS
+
+/** @brief Largest COBS frame: sequence, record, CRC, one code byte per 254 bytes, delimiter. */
+#define LOG_FRAME_SIZE (LOG_RECORD_SIZE + 3 + (LOG_RECORD_SIZE + 3) / 254 + 2)
+
+/*!
+ * @brief Updates a CRC-16/CCITT-FALSE (polynomial 0x1021), one nibble at a time.
+ */
+static uint16_t log_crc16(uint16_t crc, uint8_t byte)
+{
+    static const uint16_t table[16] = {
+        0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+        0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+    };
+
+    crc = (uint16_t) ((crc << 4) ^ table[(crc >> 12) ^ (byte >> 4)]);
+    crc = (uint16_t) ((crc << 4) ^ table[(crc >> 12) ^ (byte & 0x0F)]);
+    return crc;
+}
+
+/*!
+ * @brief Appends bytes to a COBS frame and to its CRC.
+ */
+static void log_cobs_put(log_cobs_t *cobs, const uint8_t *data, size_t len)
+{
+    while (len--)
+    {
+        uint8_t byte = *data++;
+
+        cobs->crc = log_crc16(cobs->crc, byte);
+
+        if (byte != 0)
+        {
+            cobs->out[cobs->len++] = byte;
+        }
+
+        // A block ends at a zero byte, or after 254 non-zero bytes.
+        if (byte == 0 || cobs->len - cobs->code == 0xFF)
+        {
+            cobs->out[cobs->code] = (uint8_t) (cobs->len - cobs->code);
+            cobs->code = cobs->len++;
+        }
+    }
+}
+
+#endif // LOG_FRAMING == LOG_FRAMING_COBS
+
+#if LOG_STREAMS
+
+/*!
+ * @brief Encodes a deferred record for one output stream and writes it there.
+ *
+ * The sequence number and the timestamp delta are taken together, right before the write. A
+ * context preempted in between can still let the next frame through first, which the decoder puts
+ * back in order.
+ *
+ * @return Size written.
+ */
+static size_t log_stream_write(log_stream_t *stream, log_sink_write_t write, void *ctx,
+                               const log_record_t *record)
+{
+    const uint8_t *rec = record->data;
+    size_t len = record->len;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+#if LOG_FRAMING == LOG_FRAMING_COBS
+    uint16_t seq = (uint16_t) ++stream->seq;
+#endif
+#if LOG_DEFERRED_COMPACT
+    uint8_t stamp[LOG_COMPACT_STAMP];
+    size_t stamp_len = (size_t) (log_put_varint(stamp, log_compact_timestamp(stream, record)) -
+                                 stamp);
+#endif
+
+    __set_PRIMASK(primask);
+
+#if LOG_DEFERRED_COMPACT
+    size_t split = record->split;
+    const uint8_t *tail = rec + split + LOG_COMPACT_STAMP;
+    size_t tail_len = len - split - LOG_COMPACT_STAMP;
+#endif
+
+#if LOG_FRAMING == LOG_FRAMING_COBS
+    uint8_t frame[LOG_FRAME_SIZE];
+    log_cobs_t cobs = {frame, 1, 0, 0xFFFF};
+    uint8_t word[2] = {(uint8_t) seq, (uint8_t) (seq >> 8)};
+
+    // Sequence number and record without its length byte, then the CRC of both.
+    log_cobs_put(&cobs, word, sizeof(word));
+#if LOG_DEFERRED_COMPACT
+    log_cobs_put(&cobs, rec + 1, split - 1);
+    log_cobs_put(&cobs, stamp, stamp_len);
+    log_cobs_put(&cobs, tail, tail_len);
+#else
+    log_cobs_put(&cobs, rec + 1, len - 1);
+#endif
+
+    uint16_t crc = cobs.crc;
+    word[0] = (uint8_t) crc;
+    word[1] = (uint8_t) (crc >> 8);
+    log_cobs_put(&cobs, word, sizeof(word));
+
+    frame[cobs.code] = (uint8_t) (cobs.len - cobs.code);
+    frame[cobs.len++] = 0x00;
+
+    write(ctx, frame, cobs.len);
+    return cobs.len;
+#else
+    // Length framing: the record is rebuilt around its timestamp.
+    uint8_t out[LOG_RECORD_SIZE];
+    size_t size = split + stamp_len + tail_len;
+
+    memcpy(out, rec, split);
+    memcpy(out + split, stamp, stamp_len);
+    memcpy(out + split + stamp_len, tail, tail_len);
+    out[0] = (uint8_t) (size - 1);
+
+    write(ctx, out, size);
+    return size;
+#endif
+}
+
+#if LOG_PERSIST != LOG_PERSIST_OFF
+
+static void log_stream_persist(void *ctx, const uint8_t *data, size_t len)
+{
+    log_persist_write((log_persist_t *) ctx, data, len);
+}
+
+#endif
+
+/*!
+ * @brief Frames a deferred record for the RAM log and for every sink whose level it passes, like
+ *        log_write().
+ *
+ * @return Frame size, 0 if no stream took the record.
+ */
+static size_t log_stream_fanout(log_level_t level, const log_record_t *record)
+{
+    size_t size = 0;
+
+#if LOG_PERSIST == LOG_PERSIST_BUFFERED
+    // The RAM log is flushed to every sink: it is their stream.
+    if (log_fanout_wanted(level))
+    {
+        size = log_stream_write(&sPersistStream, log_stream_persist, &sPersist, record);
+    }
+#else
+#if LOG_PERSIST != LOG_PERSIST_OFF
+    size = log_stream_write(&sPersistStream, log_stream_persist, &sPersist, record);
+#endif
+
+    for (int i = 0; i < LOG_MAX_SINKS; i++)
+    {
+        log_sink_t *sink = &sSinks[i];
+        log_sink_write_t write = sink->write;
+
+        if (write != NULL && sink->level != LOG_LEVEL_OFF && level >= sink->level)
+        {
+            size = log_stream_write(&sink->stream, write, sink->ctx, record);
+        }
+    }
+#endif
+
+    return size;
+}
+
+#endif // LOG_STREAMS
+
+/*!
+ * @brief Sends a complete deferred record with the selected framing.
+ *
+ * COBS frames and compact timestamps are encoded by each stream they are written to, see
+ * log_stream_write().
+ */
+static void log_record_write(log_level_t level, uint8_t channel, log_record_t *record)
+{
+#if LOG_STREAMS
+#if LOG_DEFERRED_COMPACT
+    record->dropped = log_channel_dropped(channel);
+#endif
+#if LOG_MAX_CHANNELS > 1
+    log_channel_t *ch = &sChannels[channel];
+
+    if (channel != LOG_CHANNEL_CONSOLE)
+    {
+        log_sink_write_t write = ch->write;
+
+        if (write == NULL)
+        {
+            ch->dropped++;
+            return;
+        }
+
+        log_channel_count(ch, log_stream_write(&ch->stream, write, ch->ctx, record));
+        return;
+    }
+#else
+    (void) channel;
+#endif
+
+    size_t size = log_stream_fanout(level, record);
+
+#if LOG_MAX_CHANNELS > 1
+    log_channel_count(ch, size);
+#endif
+#if LOG_STATS
+    sStats.bytes += (uint32_t) size;
+#endif
+    (void) size;
+#else
+    log_output(channel, level, record->data, record->len);
+#endif
+}
+
+/*!
+ * @brief Formats and sends a leveled message into `msg` (LOG_BUFFER_SIZE bytes): a ring
+ *        reservation from log_line_begin(), or a buffer when `slot` holds none.
+ */
+static void log_vemit_into(char *msg, const log_ring_slot_t *slot, log_level_t level,
+                           const log_instance_t *module, const char *func, int line,
+                           const char *fmt, va_list ap)
+{
+    const log_prefix_t *prefix = &kPrefix[(level < LOG_LEVEL_COUNT) ? level : LOG_LEVEL_ERROR];
+    uint8_t channel = log_module_channel(module);
+    size_t len = 0;
+
+    // The end of the line (the DEBUG color reset) always fits: the rest shares what is left.
+    size_t room = LOG_BUFFER_SIZE - strlen(prefix->after_message);
+
+#if LOG_TIMESTAMP != LOG_TIMESTAMP_NONE
+    len = log_append_timestamp(msg, len, room, LOGGER_GET_TIMESTAMP());
+#endif
+
+    size_t start = len;
+    len = log_append_prefix(msg, len, room, prefix, module, func, line);
+
+    if (len + 1 < room)
+    {
+        len += log_vformat(msg + len, room - len, fmt, ap);
+    }
+    else
+    {
+        // The prefix filled the line: nothing of the message is left.
+        sTruncated++;
+    }
+
+    len = log_append(msg, len, LOG_BUFFER_SIZE, prefix->after_message);
+
+#if LOG_DEDUP
+    // Only the console is deduplicated: the repetition count is written there.
+    if (channel == LOG_CHANNEL_CONSOLE &&
+        log_dedup(log_hash(2166136261UL, (const uint8_t *) msg + start, len - start)))
+    {
+        return;
+    }
+#else
+    (void) start;
+#endif
+
+    log_line_end(level, channel, msg, len, slot);
+}
+
+// The stack variants are kept out of line so that the other paths do not reserve the buffer.
+static __attribute__((noinline)) void log_vemit_stack(const log_ring_slot_t *slot,
+                                                      log_level_t level,
+                                                      const log_instance_t *module,
+                                                      const char *func, int line, const char *fmt,
+                                                      va_list ap)
+{
+    char msg[LOG_BUFFER_SIZE];
+    log_vemit_into(msg, slot, level, module, func, line, fmt, ap);
+}
+
+/*!
+ * @brief Sends the header and rows of a hex dump, using `msg` (LOG_BUFFER_SIZE bytes) as buffer.
+ */
+static void log_hexdump_into(char *msg, log_level_t level, const log_instance_t *module,
+                             const char *func, int line, const void *data, size_t size)
+{
+    static const char kHex[] = "0123456789abcdef";
+    const uint8_t *bytes = (const uint8_t *) data;
+    const log_prefix_t *prefix = &kPrefix[(level < LOG_LEVEL_COUNT) ? level : LOG_LEVEL_ERROR];
+    uint8_t channel = log_module_channel(module);
+    char *buf = msg;
+    log_ring_slot_t slot;
+    size_t len = 0;
+
+    size_t room = LOG_BUFFER_SIZE - strlen(prefix->after_message);
+
+    msg = log_line_begin(level, channel, buf, &slot);
+
+#if LOG_TIMESTAMP != LOG_TIMESTAMP_NONE
+    len = log_append_timestamp(msg, len, room, LOGGER_GET_TIMESTAMP());
+#endif
+
+    len = log_append_prefix(msg, len, room, prefix, module, func, line);
+    len = log_append_uint(msg, len, room, '\0', (uint32_t) size);
+    len = log_append(msg, len, room, " bytes\r\n");
+
+    // A header cut by a long prefix loses its line end.
+    if (msg[len - 1] != '\n')
+    {
+        sTruncated++;
+    }
+
+    if (bytes == NULL || size == 0)
+    {
+        len = log_append(msg, len, LOG_BUFFER_SIZE, prefix->after_message);
+    }
+
+    log_line_end(level, channel, msg, len, &slot);
+
+    size_t shown = (bytes != NULL) ? size : 0;
+
+#if LOGGER_OUTPUT_MODE != LOGGER_OUTPUT_DMA
+    // Each line takes a staging slot in interrupt context: the header, the rows and a line
+    // counting the bytes left out must fit in LOG_ISR_SLOTS.
+    const size_t isr_rows = (LOG_ISR_SLOTS > 2) ? LOG_ISR_SLOTS - 2 : 0;
+
+    if (__get_IPSR() != 0 && shown > isr_rows * LOG_HEXDUMP_ROW)
+    {
+        shown = isr_rows * LOG_HEXDUMP_ROW;
+    }
+#endif
+
+    // One row per LOG_HEXDUMP_ROW bytes: offset, hex bytes, then the printable characters.
+    int digits = (size > 0x10000) ? 8 : 4;
+
+    for (size_t offset = 0; offset < shown; offset += LOG_HEXDUMP_ROW)
+    {
+        size_t count = (shown - offset < LOG_HEXDUMP_ROW) ? shown - offset : LOG_HEXDUMP_ROW;
+
+        msg = log_line_begin(level, channel, buf, &slot);
+        char *p = msg;
+
+        *p++ = ' ';
+        *p++ = ' ';
+
+        for (int shift = 4 * (digits - 1); shift >= 0; shift -= 4)
+        {
+            *p++ = kHex[(offset >> shift) & 0x0F];
+        }
+
+        *p++ = ':';
+
+        for (size_t i = 0; i < LOG_HEXDUMP_ROW; i++)
+        {
+            *p++ = ' ';
+            *p++ = (i < count) ? kHex[bytes[offset + i] >> 4] : ' ';
+            *p++ = (i < count) ? kHex[bytes[offset + i] & 0x0F] : ' ';
+        }
+
+        *p++ = ' ';
+        *p++ = ' ';
+
+        for (size_t i = 0; i < count; i++)
+        {
+            uint8_t c = bytes[offset + i];
+            *p++ = (c >= 0x20 && c < 0x7F) ? (char) c : '.';
+        }
+
+        *p++ = '\r';
+        *p++ = '\n';
+        len = (size_t) (p - msg);
+
+        // DEBUG dumps are entirely white: the color is reset after the last row.
+        if (offset + count == size)
+        {
+            len = log_append(msg, len, LOG_BUFFER_SIZE, prefix->after_message);
+        }
+
+        log_line_end(level, channel, msg, len, &slot);
+    }
+
+    if (bytes != NULL && shown < size)
+    {
+        msg = log_line_begin(level, channel, buf, &slot);
+        len = log_append(msg, 0, LOG_BUFFER_SIZE, "  ... ");
+        len = log_append_uint(msg, len, LOG_BUFFER_SIZE, '\0', (uint32_t) (size - shown));
+        len = log_append(msg, len, LOG_BUFFER_SIZE, " more bytes\r\n");
+        len = log_append(msg, len, LOG_BUFFER_SIZE, prefix->after_message);
+        log_line_end(level, channel, msg, len, &slot);
+    }
+}
+
+static __attribute__((noinline)) void log_hexdump_stack(log_level_t level,
+                                                        const log_instance_t *module,
+                                                        const char *func, int line,
+                                                        const void *data, size_t size)
+{
+    char msg[LOG_BUFFER_SIZE];
+    log_hexdump_into(msg, level, module, func, line, data, size);
+}
+
+/*!
+ * @brief Formats and sends a raw message into `msg` (LOG_BUFFER_SIZE bytes), see
+ *        log_vemit_into().
+ */
+static void log_vraw_into(char *msg, const log_ring_slot_t *slot, const char *fmt, va_list ap)
+{
+    size_t len = log_vformat(msg, LOG_BUFFER_SIZE, fmt, ap);
+    log_line_end(LOG_LEVEL_RAW, LOG_CHANNEL_CONSOLE, msg, len, slot);
+}
+
+static __attribute__((noinline)) void log_vraw_stack(const log_ring_slot_t *slot,
+                                                     const char *fmt, va_list ap)
+{
+    char msg[LOG_BUFFER_SIZE];
+    log_vraw_into(msg, slot, fmt, ap);
+}
+
+/*!
+ * @brief Packs and sends a deferred record, using `rec` (LOG_RECORD_SIZE bytes) as buffer.
+ */
+static void log_emit_deferred_into(uint8_t *rec, const log_site_t *site,
+                                   const log_instance_t *module, uint8_t nargs,
+                                   const log_arg_t *args)
+{
+    uint8_t channel = log_module_channel(module);
+    const uint8_t *end = rec + LOG_RECORD_SIZE;
+    log_record_t record;
+    uint8_t *p = log_record_begin(&record, rec, site, module);
+#if LOG_DEDUP
+    const uint8_t *packed = p;
+#endif
+
+    for (uint8_t i = 0; i < nargs; i++)
+    {
+        const log_arg_t *arg = &args[i];
+
+        if (arg->kind == LOG_ARG_STR)
+        {
+            const char *str = arg->value.str ? arg->value.str : "(null)";
+            size_t room = (size_t) (end - p);
+            size_t len = strlen(str);
+
+            if (room == 0)
+            {
+                break;
+            }
+
+            if (len > room - 1)
+            {
+                len = room - 1;
+            }
+
+            *p++ = (uint8_t) len;
+            memcpy(p, str, len);
+            p += len;
+            continue;
+        }
+
+        if (arg->kind == LOG_ARG_F32)
+        {
+            uint32_t bits;
+            memcpy(&bits, &arg->value.f32, sizeof(bits));
+
+            if ((size_t) (end - p) < sizeof(bits))
+            {
+                break;
+            }
+
+            p = log_put_le(p, bits, sizeof(bits));
+            continue;
+        }
+
+        uint8_t size = (arg->kind == LOG_ARG_U64) ? 8 : 4;
+        uint64_t value = (arg->kind == LOG_ARG_U64) ? arg->value.u64 : arg->value.u32;
+
+        if ((size_t) (end - p) < log_int_size(value, size))
+        {
+            break;
+        }
+
+        p = log_put_int(p, value, size);
+    }
+
+    rec[0] = (uint8_t) (p - rec - 1);
+    record.len = (size_t) (p - rec);
+
+#if LOG_DEDUP
+    // Hash the site, module and arguments but not the timestamp, so that repetitions hash the same.
+    uint32_t hash = log_hash(2166136261UL, (const uint8_t *) &site, sizeof(site));
+    hash = log_hash(hash, (const uint8_t *) &module, sizeof(module));
+    hash = log_hash(hash, packed, (size_t) (p - packed));
+
+    // A repetition never reaches the streams: the next delta is taken from the last record sent.
+    if (site->level == LOG_SITE_RAW || channel != LOG_CHANNEL_CONSOLE || !log_dedup(hash))
+#endif
+    {
+        log_record_write((log_level_t) site->level, channel, &record);
+    }
+}
+
+static __attribute__((noinline)) void log_emit_deferred_stack(const log_site_t *site,
+                                                              const log_instance_t *module,
+                                                              uint8_t nargs, const log_arg_t *args)
+{
+    uint8_t rec[LOG_RECORD_SIZE];
+    log_emit_deferred_into(rec, site, module, nargs, args);
+}
+
+/*!
+ * @brief Packs and sends a deferred hex dump, using `rec` (LOG_RECORD_SIZE bytes) as buffer.
+ */
+static void log_hexdump_deferred_into(uint8_t *rec, const log_site_t *site,
+                                      const log_instance_t *module, const void *data, size_t size)
+{
+    log_record_t record;
+    uint8_t *p = log_record_begin(&record, rec, site, module);
+
+    // Total size, then as many bytes as fit in the record, prefixed with their count.
+    p = log_put_int(p, (uint32_t) size, 4);
+
+    size_t count = (size_t) (rec + LOG_RECORD_SIZE - p - 1);
+    count = (data == NULL) ? 0 : (size < count) ? size : count;
+
+    *p++ = (uint8_t) count;
+    memcpy(p, data, count);
+    p += count;
+
+    rec[0] = (uint8_t) (p - rec - 1);
+    record.len = (size_t) (p - rec);
+    log_record_write((log_level_t) site->level, log_module_channel(module), &record);
+}
+
+static __attribute__((noinline)) void log_hexdump_deferred_stack(const log_site_t *site,
+                                                                 const log_instance_t *module,
+                                                                 const void *data, size_t size)
+{
+    uint8_t rec[LOG_RECORD_SIZE];
+    log_hexdump_deferred_into(rec, site, module, data, size);
+}
+
+/*!
+ * @brief Checks a message that passed its module threshold again if gLogLevel changed since the
+ *        thresholds were computed.
+ *
+ * An initialized definition of the common symbol sets gLogLevel without
+ * LOGGER_SET_LOGGING_LEVEL(): the first message that gets here folds it into every threshold.
+ *
+ * @return 1 if the message is to be sent.
+ */
+static int log_threshold_passes(log_level_t level, const log_instance_t *module)
+{
+    if (gLogLevel == sThresholdLevel)
+    {
+        return 1;
+    }
+
+    log_module_thresholds_update();
+
+    // Constant modules and global messages were checked against gLogLevel itself.
+    return module == NULL || module->fixed || (uint8_t) level >= module->threshold;
+}
+
+/* =======================================================================
+ * [PUBLIC FUNCTIONS]
+ * =======================================================================
+ */
+
+uint8_t log_module_threshold(log_level_t level, uint8_t channel)
+{
+    log_level_t floor = gLogLevel;
+
+#if LOG_MAX_CHANNELS > 1
+    if (channel != LOG_CHANNEL_CONSOLE)
+    {
+        floor = (channel < LOG_MAX_CHANNELS && sChannels[channel].write != NULL)
+                    ? sChannels[channel].level
+                    : LOG_LEVEL_OFF;
+    }
+#else
+    (void) channel;
+#endif
+
+    return (uint8_t) ((level > floor) ? level : floor);
+}
+
+void log_module_thresholds_update(void)
+{
+    sThresholdLevel = gLogLevel;
+
+    if (__start_logger_modules == NULL)
+    {
+        return;
+    }
+
+    for (log_instance_t *const *entry = __start_logger_modules; entry < __stop_logger_modules;
+         entry++)
+    {
+        // Constant modules are in flash, and their level is checked at compile time.
+        if (!(*entry)->fixed)
+        {
+            (*entry)->threshold = log_module_threshold((*entry)->level, (*entry)->channel);
+        }
+    }
+}
+
+size_t log_vformat(char *buf, size_t size, const char *fmt, va_list ap)
+{
+    if (size == 0)
+    {
+        return 0;
+    }
+
+    int len = LOG_VSNPRINTF(buf, size, fmt, ap);
+
+    if (len < 0)
+    {
+        buf[0] = '\0';
+        return 0;
+    }
+
+    if ((size_t) len < size)
+    {
+        return (size_t) len;
+    }
+
+    // Truncated: make it visible at the end of the line instead of silently cutting it.
+    size_t marker = sizeof(LOG_TRUNCATION_MARKER) - 1;
+
+    if (marker > size - 1)
+    {
+        marker = size - 1;
+    }
+
+    memcpy(buf + size - 1 - marker, LOG_TRUNCATION_MARKER, marker);
+    buf[size - 1] = '\0';
+    sTruncated++;
+
+    return size - 1;
+}
+
+size_t log_format(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    size_t len = log_vformat(buf, size, fmt, ap);
+    va_end(ap);
+
+    return len;
+}
+
+uint32_t LOGGER_GET_TRUNCATED(void)
+{
+    return sTruncated;
+}
+
+uint64_t LOGGER_GET_TIMESTAMP(void)
+{
+    return log_timestamp_extend();
+}
+
+void log_vemit(log_level_t level, const log_instance_t *module, const char *func, int line,
+               const char *fmt, va_list ap)
+{
+    if (!log_threshold_passes(level, module))
+    {
+        return;
+    }
+
+    log_ring_slot_t slot;
+    char *msg = log_line_begin(level, log_module_channel(module), NULL, &slot);
+
+    // A line formatted in place needs no buffer.
+    if (msg != NULL)
+    {
+        log_vemit_into(msg, &slot, level, module, func, line, fmt, ap);
+        return;
+    }
+
+    uint8_t *buf = log_buffer_take();
+
+    if (buf == NULL)
+    {
+        log_vemit_stack(&slot, level, module, func, line, fmt, ap);
+        return;
+    }
+
+    log_vemit_into((char *) buf, &slot, level, module, func, line, fmt, ap);
+    log_buffer_give(buf);
+}
+
+void log_emit(log_level_t level, const log_instance_t *module, const char *func, int line,
+              const char *fmt, ...)
+{
+    va_list ap;
+    LOG_STATS_START();
+
+    va_start(ap, fmt);
+    log_vemit(level, module, func, line, fmt, ap);
+    va_end(ap);
+
+    LOG_STATS_STOP(level);
+}
+
+void log_hexdump(log_level_t level, const log_instance_t *module, const char *func, int line,
+                 const void *data, size_t size)
+{
+    if (!log_threshold_passes(level, module))
+    {
+        return;
+    }
+
+    uint8_t *buf = log_buffer_take();
+    LOG_STATS_START();
+
+    if (buf == NULL)
+    {
+        log_hexdump_stack(level, module, func, line, data, size);
+    }
+    else
+    {
+        log_hexdump_into((char *) buf, level, module, func, line, data, size);
+        log_buffer_give(buf);
+    }
+
+    LOG_STATS_STOP(level);
+}
+
+void log_raw(const char *fmt, ...)
+{
+    log_ring_slot_t slot;
+    char *msg = log_line_begin(LOG_LEVEL_RAW, LOG_CHANNEL_CONSOLE, NULL, &slot);
+    uint8_t *buf = (msg == NULL) ? log_buffer_take() : NULL;
+    va_list ap;
+    LOG_STATS_START();
+
+    va_start(ap, fmt);
+
+    if (msg != NULL)
+    {
+        log_vraw_into(msg, &slot, fmt, ap);
+    }
+    else if (buf == NULL)
+    {
+        log_vraw_stack(&slot, fmt, ap);
+    }
+    else
+    {
+        log_vraw_into((char *) buf, &slot, fmt, ap);
+        log_buffer_give(buf);
+    }
+
+    va_end(ap);
+    LOG_STATS_STOP(LOG_LEVEL_RAW);
+}
+
+int log_ratelimit(log_ratelimit_t *rl, uint32_t per_sec, uint32_t *suppressed)
+{
+    const uint32_t cost = 1000U;
+    uint32_t now = HAL_GetTick();
+    uint32_t elapsed = now - rl->last;
+
+    // Credit is kept in thousandths of a message, so one millisecond refills `per_sec` of it.
+    if (!rl->started || elapsed >= 1000U)
+    {
+        rl->credit = per_sec * cost;
+        rl->started = 1;
+    }
+    else
+    {
+        rl->credit += elapsed * per_sec;
+        rl->credit = (rl->credit < per_sec * cost) ? rl->credit : per_sec * cost;
+    }
+
+    rl->last = now;
+
+    if (rl->credit < cost)
+    {
+        rl->suppressed++;
+        return 0;
+    }
+
+    rl->credit -= cost;
+    *suppressed = rl->suppressed;
+    rl->suppressed = 0;
+    return 1;
+}
+
+void log_emit_deferred(const log_site_t *site, const log_instance_t *module, uint8_t nargs,
+                       const log_arg_t *args)
+{
+    if (!log_threshold_passes((log_level_t) site->level, module))
+    {
+        return;
+    }
+
+    uint8_t *buf = log_buffer_take();
+    LOG_STATS_START();
+
+    if (buf == NULL)
+    {
+        log_emit_deferred_stack(site, module, nargs, args);
+    }
+    else
+    {
+        log_emit_deferred_into(buf, site, module, nargs, args);
+        log_buffer_give(buf);
+    }
+
+    LOG_STATS_STOP(site->level);
+}
+
+void log_hexdump_deferred(const log_site_t *site, const log_instance_t *module, const void *data,
+                          size_t size)
+{
+    if (!log_threshold_passes((log_level_t) site->level, module))
+    {
+        return;
+    }
+
+    uint8_t *buf = log_buffer_take();
+    LOG_STATS_START();
+
+    if (buf == NULL)
+    {
+        log_hexdump_deferred_stack(site, module, data, size);
+    }
+    else
+    {
+        log_hexdump_deferred_into(buf, site, module, data, size);
+        log_buffer_give(buf);
+    }
+
+    LOG_STATS_STOP(site->level);
+}
+
+void log_write(log_level_t level, const uint8_t *data, size_t len)
+{
+#if LOG_STATS
+    sStats.bytes += (uint32_t) len;
+#endif
+
+#if LOG_PERSIST == LOG_PERSIST_BUFFERED
+    // The RAM log keeps no levels: it holds only what some sink takes, and is flushed to all.
+    if (log_fanout_wanted(level))
+    {
+        log_persist_write(&sPersist, data, len);
+    }
+#else
+#if LOG_PERSIST != LOG_PERSIST_OFF
+    log_persist_write(&sPersist, data, len);
+#endif
+    log_fanout(level, data, len);
+#endif
+}
+
+int LOGGER_ADD_SINK(log_sink_write_t write, void *ctx, log_level_t level)
+{
+    if (write == NULL)
+    {
+        return -1;
+    }
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+    if (write == log_sink_uart_dma && log_ring_bind((UART_HandleTypeDef *) ctx) == NULL)
+    {
+        return -1;
+    }
+#endif
+
+    for (int i = 0; i < LOG_MAX_SINKS; i++)
+    {
+        if (sSinks[i].write == NULL)
+        {
+            sSinks[i].ctx = ctx;
+            sSinks[i].level = level;
+            sSinks[i].write = write;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void LOGGER_SET_SINK_LEVEL(int sink, log_level_t level)
+{
+    if (sink >= 0 && sink < LOG_MAX_SINKS)
+    {
+        sSinks[sink].level = level;
+    }
+}
+
+#if LOG_MAX_CHANNELS > 1
+
+int LOGGER_CHANNEL_INIT(int channel, log_sink_write_t write, void *ctx, log_level_t level)
+{
+    if (channel <= LOG_CHANNEL_CONSOLE || channel >= LOG_MAX_CHANNELS || write == NULL)
+    {
+        return -1;
+    }
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+    if (write == log_sink_uart_dma && log_ring_bind((UART_HandleTypeDef *) ctx) == NULL)
+    {
+        return -1;
+    }
+#endif
+
+    log_channel_t *ch = &sChannels[channel];
+
+    ch->ctx = ctx;
+    ch->level = level;
+    __DMB();
+    ch->write = write;
+
+    log_module_thresholds_update();
+    return 0;
+}
+
+void LOGGER_CHANNEL_SET_LEVEL(int channel, log_level_t level)
+{
+    if (channel == LOG_CHANNEL_CONSOLE)
+    {
+        LOGGER_SET_LOGGING_LEVEL(level);
+    }
+    else if (channel > LOG_CHANNEL_CONSOLE && channel < LOG_MAX_CHANNELS)
+    {
+        sChannels[channel].level = level;
+        log_module_thresholds_update();
+    }
+}
+
+void LOGGER_GET_CHANNEL_STATS(int channel, log_channel_stats_t *stats)
+{
+    if (stats == NULL || channel < 0 || channel >= LOG_MAX_CHANNELS)
+    {
+        return;
+    }
+
+    stats->writes = sChannels[channel].writes;
+    stats->bytes = sChannels[channel].bytes;
+    stats->dropped = log_channel_dropped((uint8_t) channel);
+}
+
+#endif // LOG_MAX_CHANNELS > 1
+
+void log_sink_uart(void *ctx, const uint8_t *data, size_t len)
+{
+    (void) ctx;
+
+    // After a fault, the UART is polled directly, whatever the output mode.
+    if (sPanic)
+    {
+        log_panic_write(&LOG_UART, data, len);
+        return;
+    }
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+    // Every context, interrupt handlers included, reserves its message in the ring.
+    log_ring_write(&sRing, data, len);
+    log_dma_kick(&sRing);
+#else
+    // Interrupt handlers never touch the UART: they only fill a staging slot.
+    if (__get_IPSR() != 0)
+    {
+        log_stage_write(&sStage, &LOG_UART, data, len);
+        return;
+    }
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+    log_queue_post(&sQueue, &LOG_UART, data, len);
+#else
+    log_stage_drain(&sStage);
+    HAL_UART_Transmit(&LOG_UART, (uint8_t *) data, (uint16_t) len, HAL_MAX_DELAY);
+#endif
+#endif
+}
+
+void log_sink_uart_blocking(void *ctx, const uint8_t *data, size_t len)
+{
+    UART_HandleTypeDef *huart = (UART_HandleTypeDef *) ctx;
+
+    if (huart == NULL)
+    {
+        return;
+    }
+
+    if (sPanic)
+    {
+        log_panic_write(huart, data, len);
+        return;
+    }
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+    // No staging slots in this mode: an interrupt handler must not wait for the UART.
+    if (__get_IPSR() != 0)
+    {
+        sSinkDropped++;
+        return;
+    }
+#else
+    // Like the built-in sink, interrupt handlers only fill a staging slot.
+    if (__get_IPSR() != 0)
+    {
+        log_stage_write(&sStage, huart, data, len);
+        return;
+    }
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_BLOCKING
+    log_stage_drain(&sStage);
+#endif
+#endif
+
+    HAL_UART_Transmit(huart, (uint8_t *) data, (uint16_t) len, HAL_MAX_DELAY);
+}
+
+void log_sink_uart_dma(void *ctx, const uint8_t *data, size_t len)
+{
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+    UART_HandleTypeDef *huart = (UART_HandleTypeDef *) ctx;
+    log_ring_t *ring = log_ring_find(huart);
+
+    if (ring == NULL)
+    {
+        return;
+    }
+
+    if (sPanic)
+    {
+        log_panic_write(huart, data, len);
+        return;
+    }
+
+    log_ring_write(ring, data, len);
+    log_dma_kick(ring);
+#elif LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+    // Queued to the logger task like the built-in UART sink, which transmits it on `huart`.
+    UART_HandleTypeDef *huart = (UART_HandleTypeDef *) ctx;
+
+    if (huart == NULL)
+    {
+        return;
+    }
+
+    if (sPanic)
+    {
+        log_panic_write(huart, data, len);
+        return;
+    }
+
+    if (__get_IPSR() != 0)
+    {
+        log_stage_write(&sStage, huart, data, len);
+        return;
+    }
+
+    log_queue_post(&sQueue, huart, data, len);
+#else
+    log_sink_uart_blocking(ctx, data, len);
+#endif
+}
+
+#if LOG_PERSIST != LOG_PERSIST_OFF
+
+void LOGGER_PERSIST_REPLAY(void)
+{
+    uint8_t chunk[LOG_BUFFER_SIZE];
+    size_t len;
+
+    while ((len = log_persist_read(&sPersist, chunk, sizeof(chunk))) != 0)
+    {
+        HAL_UART_Transmit(&LOG_UART, chunk, (uint16_t) len, HAL_MAX_DELAY);
+    }
+}
+
+size_t LOGGER_PERSIST_READ(uint8_t *dst, size_t size)
+{
+    if (dst == NULL)
+    {
+        return 0;
+    }
+
+    return log_persist_read(&sPersist, dst, size);
+}
+
+#if LOG_PERSIST == LOG_PERSIST_BUFFERED
+void LOGGER_PERSIST_FLUSH(void)
+{
+    uint8_t chunk[LOG_BUFFER_SIZE];
+    size_t len;
+
+    while ((len = log_persist_read(&sPersist, chunk, sizeof(chunk))) != 0)
+    {
+        log_fanout(LOG_LEVEL_RAW, chunk, len);
+    }
+}
+#endif
+
+#endif // LOG_PERSIST != LOG_PERSIST_OFF
+
+void LOGGER_PROCESS(void)
+{
+#if LOG_DEDUP
+    log_dedup_flush();
+#endif
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+    log_dma_kick(&sRing);
+#if LOG_DMA_RINGS > 0
+    for (int i = 0; i < LOG_DMA_RINGS; i++)
+    {
+        if (sDmaRings[i].huart != NULL)
+        {
+            log_dma_kick(&sDmaRings[i]);
+        }
+    }
+#endif
+#elif LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_BLOCKING
+    log_stage_drain(&sStage);
+#endif
+}
+
+void LOGGER_FLUSH(void)
+{
+#if LOG_PERSIST == LOG_PERSIST_BUFFERED
+    LOGGER_PERSIST_FLUSH();
+#endif
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+    log_ring_flush(&sRing);
+#if LOG_DMA_RINGS > 0
+    for (int i = 0; i < LOG_DMA_RINGS; i++)
+    {
+        if (sDmaRings[i].huart != NULL)
+        {
+            log_ring_flush(&sDmaRings[i]);
+        }
+    }
+#endif
+#elif LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+    if (sQueue.handle != NULL && __get_IPSR() == 0 &&
+        xTaskGetSchedulerState() == taskSCHEDULER_RUNNING)
+    {
+        // The logger task gives every slot back once its record is transmitted.
+        while (uxQueueMessagesWaiting(sQueue.free) != LOG_QUEUE_DEPTH || sQueue.sending ||
+               sStage.head != sStage.tail)
+        {
+            vTaskDelay(1);
+        }
+    }
+#else
+    if (__get_IPSR() == 0)
+    {
+        log_stage_drain(&sStage);
+    }
+#endif
+}
+
+void LOGGER_PANIC_FLUSH(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    sPanic = 1;
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+    log_panic_drain_ring(&sRing);
+#if LOG_DMA_RINGS > 0
+    for (int i = 0; i < LOG_DMA_RINGS; i++)
+    {
+        if (sDmaRings[i].huart != NULL)
+        {
+            log_panic_drain_ring(&sDmaRings[i]);
+
+            while (!__HAL_UART_GET_FLAG(sDmaRings[i].huart, UART_FLAG_TC))
+            {
+            }
+        }
+    }
+#endif
+#else
+    log_panic_drain_queues();
+#endif
+
+#if LOG_PERSIST == LOG_PERSIST_BUFFERED
+    LOGGER_PERSIST_FLUSH();
+#endif
+
+    while (!__HAL_UART_GET_FLAG(&LOG_UART, UART_FLAG_TC))
+    {
+    }
+
+    __set_PRIMASK(primask);
+}
+
+void LOGGER_PANIC_DUMP(const uint32_t *frame)
+{
+    if (frame != NULL)
+    {
+        LOG_RAW("panic r0 %08lx r1 %08lx r2 %08lx r3 %08lx\r\n", (unsigned long) frame[0],
+                (unsigned long) frame[1], (unsigned long) frame[2], (unsigned long) frame[3]);
+        LOG_RAW("panic r12 %08lx lr %08lx pc %08lx psr %08lx\r\n", (unsigned long) frame[4],
+                (unsigned long) frame[5], (unsigned long) frame[6], (unsigned long) frame[7]);
+    }
+
+#if defined(SCB_CFSR_MEMFAULTSR_Pos)
+    LOG_RAW("panic cfsr %08lx hfsr %08lx mmfar %08lx bfar %08lx\r\n", (unsigned long) SCB->CFSR,
+            (unsigned long) SCB->HFSR, (unsigned long) SCB->MMFAR, (unsigned long) SCB->BFAR);
+#endif
+
+    // The words the interrupted code had pushed before the exception frame.
+    for (int i = 0; frame != NULL && i < LOG_PANIC_STACK_WORDS; i += 4)
+    {
+        const uint32_t *p = &frame[8 + i];
+        LOG_RAW("panic %08lx: %08lx %08lx %08lx %08lx\r\n", (unsigned long) (uintptr_t) p,
+                (unsigned long) p[0], (unsigned long) p[1], (unsigned long) p[2],
+                (unsigned long) p[3]);
+    }
+}
+
+/*!
+ * @brief Checks whether the last byte has left the UART of a sink or channel, 1 if not on a UART.
+ */
+static int log_output_idle(log_sink_write_t write, void *ctx)
+{
+    if (write != log_sink_uart_dma && write != log_sink_uart_blocking)
+    {
+        return 1;
+    }
+
+    return __HAL_UART_GET_FLAG((UART_HandleTypeDef *) ctx, UART_FLAG_TC) ? 1 : 0;
+}
+
+int LOGGER_IS_IDLE(void)
+{
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+    if (sRing.inflight != 0 && !sPanic)
+    {
+        return 0;
+    }
+
+#if LOG_DMA_RINGS > 0
+    for (int i = 0; i < LOG_DMA_RINGS; i++)
+    {
+        const log_ring_t *ring = &sDmaRings[i];
+
+        if (ring->huart != NULL &&
+            ((ring->inflight != 0 && !sPanic) || !__HAL_UART_GET_FLAG(ring->huart, UART_FLAG_TC)))
+        {
+            return 0;
+        }
+    }
+#endif
+#elif LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+    // The FromISR variant takes no lock: it may run with the scheduler suspended. The slots of a
+    // batch are given back before its transmit, so `sending` covers the batch being gathered.
+    if (sQueue.sending ||
+        (sQueue.handle != NULL && uxQueueMessagesWaitingFromISR(sQueue.handle) != 0))
+    {
+        return 0;
+    }
+#endif
+
+    // The rings above only cover the DMA UARTs; the polled ones are found by their sink.
+    for (int i = 0; i < LOG_MAX_SINKS; i++)
+    {
+        if (!log_output_idle(sSinks[i].write, sSinks[i].ctx))
+        {
+            return 0;
+        }
+    }
+
+#if LOG_MAX_CHANNELS > 1
+    for (int i = LOG_CHANNEL_CONSOLE + 1; i < LOG_MAX_CHANNELS; i++)
+    {
+        if (!log_output_idle(sChannels[i].write, sChannels[i].ctx))
+        {
+            return 0;
+        }
+    }
+#endif
+
+    return __HAL_UART_GET_FLAG(&LOG_UART, UART_FLAG_TC) ? 1 : 0;
+}
+
+#if LOG_LOWPOWER
+
+void LOGGER_SLEEP(void)
+{
+    sRing.sleeping = 1;
+
+#if LOG_DMA_RINGS > 0
+    for (int i = 0; i < LOG_DMA_RINGS; i++)
+    {
+        sDmaRings[i].sleeping = 1;
+    }
+#endif
+}
+
+void LOGGER_WAKE(void)
+{
+    sRing.sleeping = 0;
+    log_dma_kick(&sRing);
+
+#if LOG_DMA_RINGS > 0
+    for (int i = 0; i < LOG_DMA_RINGS; i++)
+    {
+        sDmaRings[i].sleeping = 0;
+
+        if (sDmaRings[i].huart != NULL)
+        {
+            log_dma_kick(&sDmaRings[i]);
+        }
+    }
+#endif
+}
+
+#endif // LOG_LOWPOWER
+
+uint32_t LOGGER_GET_DROPPED(void)
+{
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+    uint32_t dropped = sRing.dropped + sSinkDropped;
+#elif LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+    uint32_t dropped = sStage.dropped + sQueue.dropped;
+#else
+    uint32_t dropped = sStage.dropped;
+#endif
+
+#if LOG_PERSIST == LOG_PERSIST_BUFFERED
+    dropped += sPersistDropped;
+#endif
+
+    return dropped;
+}
+
+#if LOG_STATS
+
+void LOGGER_GET_STATS(log_stats_t *stats)
+{
+    if (stats == NULL)
+    {
+        return;
+    }
+
+    *stats = sStats;
+    stats->truncated = LOGGER_GET_TRUNCATED();
+    stats->dropped = LOGGER_GET_DROPPED();
+
+    uint32_t calls = sStats.raw;
+
+    for (int i = 0; i < LOG_LEVEL_COUNT; i++)
+    {
+        calls += sStats.messages[i];
+    }
+
+    stats->cycles_avg = (calls != 0) ? (uint32_t) (sStatsCycles / calls) : 0;
+    stats->cycles_min = (calls != 0) ? sStats.cycles_min : 0;
+}
+
+void LOGGER_RESET_STATS(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    memset(&sStats, 0, sizeof(sStats));
+    sStats.cycles_min = UINT32_MAX;
+    sStatsCycles = 0;
+
+    __set_PRIMASK(primask);
+}
+
+void LOGGER_DUMP_STATS(void)
+{
+    log_stats_t stats;
+
+    // Take the snapshot first: the dump itself is accounted as LOG_RAW() calls.
+    LOGGER_GET_STATS(&stats);
+
+    LOG_RAW("log dbg %lu inf %lu wrn %lu err %lu raw %lu\r\n",
+            (unsigned long) stats.messages[LOG_LEVEL_DEBUG],
+            (unsigned long) stats.messages[LOG_LEVEL_INFO],
+            (unsigned long) stats.messages[LOG_LEVEL_WARNING],
+            (unsigned long) stats.messages[LOG_LEVEL_ERROR], (unsigned long) stats.raw);
+    LOG_RAW("log bytes %lu truncated %lu dropped %lu peak %lu\r\n", (unsigned long) stats.bytes,
+            (unsigned long) stats.truncated, (unsigned long) stats.dropped,
+            (unsigned long) stats.peak);
+    LOG_RAW("log cycles min %lu avg %lu max %lu\r\n", (unsigned long) stats.cycles_min,
+            (unsigned long) stats.cycles_avg, (unsigned long) stats.cycles_max);
+}
+
+#endif // LOG_STATS
+
+void LOGGER_TX_CPLT_CALLBACK(UART_HandleTypeDef *huart)
+{
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+    log_ring_t *ring = log_ring_find(huart);
+
+    // After LOGGER_PANIC_FLUSH(), a completion still pending is stale.
+    if (ring == NULL || sPanic)
+    {
+        return;
+    }
+
+    ring->tail = (uint16_t) (ring->tail + ring->inflight);
+    __DMB();
+    ring->inflight = 0;
+    log_dma_kick(ring);
+#else
+    (void) huart;
+#endif
+}
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+
+void LOGGER_RTOS_INIT(void)
+{
+    if (sQueue.handle != NULL)
+    {
+        return;
+    }
+
+#if configSUPPORT_STATIC_ALLOCATION
+    sQueue.free = xQueueCreateStatic(LOG_QUEUE_DEPTH, 1, sQueueFreeStorage, &sQueueFreeControl);
+#else
+    sQueue.free = xQueueCreate(LOG_QUEUE_DEPTH, 1);
+#endif
+
+    for (int i = 0; i < LOG_QUEUE_DEPTH; i++)
+    {
+        uint8_t slot = (uint8_t) i;
+
+        (void) xQueueSendToBack(sQueue.free, &slot, 0);
+    }
+
+    // Created last: producers only use the queues once `handle` is set.
+#if configSUPPORT_STATIC_ALLOCATION
+    sQueue.handle = xQueueCreateStatic(LOG_QUEUE_DEPTH, 1, sQueueStorage, &sQueueControl);
+#else
+    sQueue.handle = xQueueCreate(LOG_QUEUE_DEPTH, 1);
+#endif
+}
+
+/*!
+ * @brief Updates the queue statistics for a record taken by the logger task.
+ */
+static void log_queue_account(log_queue_t *queue, const log_queue_record_t *record)
+{
+    uint32_t waiting = (uint32_t) uxQueueMessagesWaiting(queue->handle) + 1;
+
+    if (waiting > queue->high_water)
+    {
+        queue->high_water = waiting;
+    }
+
+#if LOG_STATS
+    log_stats_peak(waiting);
+#endif
+
+    queue->latency_sum += (uint32_t) (xTaskGetTickCount() - record->posted);
+    queue->latency_count++;
+}
+
+/*!
+ * @brief Takes the next posted slot, waiting up to `wait` ticks.
+ *
+ * @return The slot's record, or NULL if none was posted in time.
+ */
+static log_queue_record_t *log_queue_take(log_queue_t *queue, TickType_t wait)
+{
+    uint8_t slot;
+
+    if (xQueueReceive(queue->handle, &slot, wait) != pdTRUE)
+    {
+        return NULL;
+    }
+
+    log_queue_record_t *record = &queue->slots[slot];
+
+    log_queue_account(queue, record);
+    return record;
+}
+
+/*!
+ * @brief Gives a slot taken by log_queue_take() back to the producers.
+ */
+static void log_queue_release(log_queue_t *queue, const log_queue_record_t *record)
+{
+    uint8_t slot = (uint8_t) (record - queue->slots);
+
+    (void) xQueueSendToBack(queue->free, &slot, 0);
+}
+
+#if LOG_BATCH_SIZE > 0
+
+/*!
+ * @brief Copies `queue->next` and the records following it for up to LOG_BATCH_DEADLINE_MS, then
+ *        transmits them at once.
+ *
+ * The slots are given back before the transmit: `sending` tells LOGGER_FLUSH(), and the panic
+ * flush sends `batch` itself. A record for another UART ends the batch and is left in `next`.
+ */
+static void log_queue_batch(log_queue_t *queue)
+{
+    log_queue_record_t *record = queue->next;
+    TickType_t start = xTaskGetTickCount();
+    TickType_t wait = pdMS_TO_TICKS(LOG_BATCH_DEADLINE_MS);
+
+    queue->batch_huart = record->huart;
+    queue->batch_len = 0;
+    queue->batch_tx = 0;
+    queue->sending = 1;
+
+    for (;;)
+    {
+        memcpy(&queue->batch[queue->batch_len], record->data, record->len);
+        __DMB();
+
+        // Counted before `next` is cleared: a fault in between sends the record twice, not never.
+        queue->batch_len = (uint16_t) (queue->batch_len + record->len);
+        queue->next = NULL;
+        log_queue_release(queue, record);
+
+        TickType_t spent = xTaskGetTickCount() - start;
+
+        if (queue->batch_len >= LOG_BATCH_SIZE || spent >= wait ||
+            (record = queue->next = log_queue_take(queue, wait - spent)) == NULL ||
+            record->huart != queue->batch_huart)
+        {
+            break;
+        }
+    }
+
+    queue->batch_tx = 1;
+    HAL_UART_Transmit(queue->batch_huart, queue->batch, queue->batch_len, HAL_MAX_DELAY);
+    queue->sending = 0;
+}
+
+#endif // LOG_BATCH_SIZE > 0
+
+void LOGGER_TASK(void *argument)
+{
+    (void) argument;
+    LOGGER_RTOS_INIT();
+
+    for (;;)
+    {
+        // Bounded wait so messages staged by interrupt handlers never wait for thread logs.
+#if LOG_BATCH_SIZE > 0
+        if (sQueue.next == NULL)
+        {
+            sQueue.next = log_queue_take(&sQueue, pdMS_TO_TICKS(LOG_TASK_POLL_MS));
+        }
+
+        if (sQueue.next != NULL)
+        {
+            log_queue_batch(&sQueue);
+        }
+#else
+        log_queue_record_t *record = log_queue_take(&sQueue, pdMS_TO_TICKS(LOG_TASK_POLL_MS));
+
+        if (record != NULL)
+        {
+            HAL_UART_Transmit(record->huart, record->data, record->len, HAL_MAX_DELAY);
+            log_queue_release(&sQueue, record);
+        }
+#endif
+
+        log_stage_drain(&sStage);
+    }
+}
+
+void LOGGER_GET_QUEUE_STATS(log_queue_stats_t *stats)
+{
+    if (stats == NULL)
+    {
+        return;
+    }
+
+    stats->high_water = sQueue.high_water;
+    stats->dropped = sQueue.dropped;
+    stats->avg_latency =
+        (sQueue.latency_count != 0) ? (sQueue.latency_sum / sQueue.latency_count) : 0;
+}
+
+#endif // LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+
+/*** end of file ***/
@@ -11,8 +11,15 @@
  *
  * @note Before using this module:
  *  - The USART1 peripheral must be properly configured and initialized.
- *  - A global instance `UART_HandleTypeDef huart1` must exist and be accessible.
- *  - Logging is performed using `HAL_UART_Transmit()` in blocking mode with `HAL_MAX_DELAY`.
+ *  - A global instance `UART_HandleTypeDef huart1` must exist and be accessible (another handle
+ *    can be selected with `LOG_UART`).
+ *  - `logger.c`, `logger_format.c` and `logger_sink.c` must be compiled and linked into the
+ *    project.
+ *  - The macros may be used from interrupt handlers: those messages never block.
+ *  - By default, logging is performed using `HAL_UART_Transmit()` in blocking mode with
+ *    `HAL_MAX_DELAY`. Define `LOGGER_OUTPUT_MODE` as `LOGGER_OUTPUT_DMA` to queue messages in a
+ *    ring buffer drained in the background by `HAL_UART_Transmit_DMA()` instead, or as
+ *    `LOGGER_OUTPUT_RTOS` to post them to a FreeRTOS logger task.
  *
  * @details
  * This implementation is heavily inspired by a console logger originally developed by Agustín 
@@ -28,16 +35,30 @@
  */
 
 #include <assert.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
-#include "stm32f1xx_hal.h"
+
+/** @brief HAL header of the target family, e.g. `"stm32f4xx_hal.h"`, or a host stub. */
+#ifndef LOGGER_HAL_HEADER
+#define LOGGER_HAL_HEADER "stm32f1xx_hal.h"
+#endif
+
+#include LOGGER_HAL_HEADER
 
 /* =======================================================================
  * [EXTERNAL DATA DECLARATION]
  * =======================================================================
  */
 
-extern UART_HandleTypeDef huart1;
+/** @brief UART handle used by the built-in UART sink. */
+#ifndef LOG_UART
+#define LOG_UART huart1
+#endif
+
+extern UART_HandleTypeDef LOG_UART;
 
 /* =======================================================================
  * [TYPEDEFS]
@@ -58,6 +79,19 @@ typedef enum
     LOG_LEVEL_OFF = 99   //!< Disable all logging output
 } log_level_t;
 
+/**
+ * @brief Logging instance for a specific module (see logger_module.h).
+ */
+typedef struct
+{
+    const char *name;  /**< Module name (used as log prefix). */
+    log_level_t level; /**< Minimum severity level to log for this module. */
+    uint8_t fixed;     /**< 1 for LOG_MODULE_REGISTER_CONST() modules, whose level is constant. */
+    uint8_t threshold; /**< Higher of `level` and the channel level: what the macros compare. */
+    uint8_t channel;   /**< Output channel of the module, LOG_CHANNEL_CONSOLE by default. */
+    uint8_t id;        /**< Registry ID + 1 once cached by log_module_id(), 0 before. */
+} log_instance_t;
+
 /* =======================================================================
  * [GLOBAL LOG LEVEL]
  * =======================================================================
@@ -67,10 +101,26 @@ typedef enum
  * @brief Current global log level.
  *
  * @note Do NOT modify this directly. Use LOGGER_SET_LOGGING_LEVEL() instead.
- *       This variable is defined as a common symbol so it can be overridden.
+ *       This variable is defined as a common symbol so it can be overridden. The initial value of
+ *       such a definition is folded into the module thresholds by the first message that passes
+ *       them: messages below it are then dropped after that check.
  */
 __attribute__((common)) log_level_t gLogLevel;
 
+/*!
+ * @brief Helper function, the effective threshold of a module with the given level and channel.
+ *
+ * That is the higher of `level` and the level of the channel: the global level for the console,
+ * LOG_LEVEL_OFF for a channel that was not initialized.
+ */
+uint8_t log_module_threshold(log_level_t level, uint8_t channel);
+
+/*!
+ * @brief Recomputes the cached threshold of every registered module after a global or channel
+ *        level change.
+ */
+void log_module_thresholds_update(void);
+
 /*!
  * @brief Sets the global logging level.
  *
@@ -82,6 +132,7 @@ static inline void LOGGER_SET_LOGGING_LEVEL(log_level_t level)
 {
     assert(level >= LOG_LEVEL_DEBUG && level < LOG_LEVEL_COUNT);
     gLogLevel = level;
+    log_module_thresholds_update();
 }
 
 /*!
@@ -92,13 +143,391 @@ static inline void LOGGER_SET_LOGGING_LEVEL(log_level_t level)
  */
 #define CHECK_LOG_LEVEL(severity) ((severity) >= gLogLevel ? 1 : 0)
 
+/*!
+ * @brief Helper macro, expansion of a message compiled out by LOG_LEVEL_COMPILE_MIN.
+ *
+ * Keeps the format string and arguments type-checked without evaluating them.
+ */
+#define LOG_DISCARD(fmt, ...)                                                                      \
+        do                                                                                         \
+        {                                                                                          \
+            if (0)                                                                                 \
+            {                                                                                      \
+                log_format_check(fmt, ##__VA_ARGS__);                                              \
+            }                                                                                      \
+        } while (0)
+
 /* =======================================================================
  * [CONFIGURATION CONSTANTS]
  * =======================================================================
  */
 
+/**
+ * @brief Lowest severity compiled into the image.
+ *
+ * Must be a plain number usable by the preprocessor: 0 (DEBUG), 1 (INFO), 2 (WARNING),
+ * 3 (ERROR) or 99 (OFF). Macros below this level expand to a no-op whose arguments are still
+ * type-checked but never evaluated, so their strings and formatting code are not linked in.
+ */
+#ifndef LOG_LEVEL_COMPILE_MIN
+#define LOG_LEVEL_COMPILE_MIN 0
+#endif
+
 /** @brief Maximum size of the temporary buffer for formatted log messages. */
+#ifndef LOG_BUFFER_SIZE
 #define LOG_BUFFER_SIZE 128
+#endif
+
+/** @brief Marker written over the end of messages that do not fit in LOG_BUFFER_SIZE. */
+#ifndef LOG_TRUNCATION_MARKER
+#define LOG_TRUNCATION_MARKER "...\r\n"
+#endif
+
+/** @brief Number of bytes per row of LOG_HEXDUMP(). */
+#ifndef LOG_HEXDUMP_ROW
+#define LOG_HEXDUMP_ROW 16
+#endif
+
+/** @brief Timestamp source: none in text mode (`HAL_GetTick()` in deferred records). */
+#define LOG_TIMESTAMP_NONE 0
+
+/** @brief Timestamp source: `HAL_GetTick()`, 1 ms resolution. */
+#define LOG_TIMESTAMP_TICK 1
+
+/** @brief Timestamp source: DWT cycle counter, one count per core clock cycle. */
+#define LOG_TIMESTAMP_DWT 2
+
+/** @brief Timestamp source: free-running timer read with LOG_TIMESTAMP_TIMER_READ(). */
+#define LOG_TIMESTAMP_TIMER 3
+
+/**
+ * @brief Selected timestamp source.
+ *
+ * The timestamp is captured when the message enters the logger. Text lines get a
+ * `[seconds.microseconds]` prefix, deferred records carry the low 32 bits of the raw counter.
+ * Counter wraparound is extended to 64 bits, which requires at least one message per wrap period.
+ */
+#ifndef LOG_TIMESTAMP
+#define LOG_TIMESTAMP LOG_TIMESTAMP_NONE
+#endif
+
+#if LOG_TIMESTAMP == LOG_TIMESTAMP_TIMER
+#if !defined(LOG_TIMESTAMP_TIMER_READ) || !defined(LOG_TIMESTAMP_TIMER_HZ)
+#error "LOG_TIMESTAMP_TIMER requires LOG_TIMESTAMP_TIMER_READ() and LOG_TIMESTAMP_TIMER_HZ"
+#endif
+/** @brief Width in bits of the timestamp timer counter. */
+#ifndef LOG_TIMESTAMP_TIMER_BITS
+#define LOG_TIMESTAMP_TIMER_BITS 16
+#endif
+#endif
+
+/** @brief Frequency in Hz of the selected timestamp counter. */
+#if LOG_TIMESTAMP == LOG_TIMESTAMP_DWT
+#define LOG_TIMESTAMP_HZ SystemCoreClock
+#elif LOG_TIMESTAMP == LOG_TIMESTAMP_TIMER
+#define LOG_TIMESTAMP_HZ LOG_TIMESTAMP_TIMER_HZ
+#else
+#define LOG_TIMESTAMP_HZ 1000U
+#endif
+
+/** @brief Formatter: newlib `snprintf()`. */
+#define LOGGER_FORMATTER_SNPRINTF 0
+
+/** @brief Formatter: built-in integer/hex/string/fixed-point formatter (logger_format.c). */
+#define LOGGER_FORMATTER_BUILTIN 1
+
+/** @brief Selected formatter (LOGGER_FORMATTER_SNPRINTF or LOGGER_FORMATTER_BUILTIN). */
+#ifndef LOGGER_FORMATTER
+#define LOGGER_FORMATTER LOGGER_FORMATTER_SNPRINTF
+#endif
+
+/** @brief Output mode: every message is sent with a blocking `HAL_UART_Transmit()`. */
+#define LOGGER_OUTPUT_BLOCKING 0
+
+/** @brief Output mode: messages are queued in a ring buffer and drained with UART DMA. */
+#define LOGGER_OUTPUT_DMA 1
+
+/** @brief Output mode: messages are posted to a FreeRTOS queue drained by a logger task. */
+#define LOGGER_OUTPUT_RTOS 2
+
+/** @brief Selected output mode (LOGGER_OUTPUT_BLOCKING, _DMA or _RTOS). */
+#ifndef LOGGER_OUTPUT_MODE
+#define LOGGER_OUTPUT_MODE LOGGER_OUTPUT_BLOCKING
+#endif
+
+/** @brief Format buffer placement: on the stack of the logging call (LOG_BUFFER_SIZE bytes). */
+#define LOG_BUFFER_STACK 0
+
+/**
+ * @brief Format buffer placement: one static buffer shared by every context.
+ *
+ * A context that finds it in use (an interrupt, or a task preempting another one mid-message)
+ * formats on its own stack instead.
+ */
+#define LOG_BUFFER_SHARED 1
+
+/**
+ * @brief Format buffer placement: one buffer per FreeRTOS task, kept in thread-local storage
+ *        pointer LOG_TLS_INDEX (RTOS mode only).
+ *
+ * Each buffer is allocated with `pvPortMalloc()` on the first message of the task and is not
+ * freed if the task is deleted. Interrupt handlers run on the main stack and still use it.
+ */
+#define LOG_BUFFER_TASK 2
+
+/** @brief Selected format buffer placement (LOG_BUFFER_STACK, _SHARED or _TASK). */
+#ifndef LOG_BUFFER_PLACEMENT
+#define LOG_BUFFER_PLACEMENT LOG_BUFFER_STACK
+#endif
+
+/** @brief Thread-local storage pointer holding the task buffer (LOG_BUFFER_TASK only). */
+#ifndef LOG_TLS_INDEX
+#define LOG_TLS_INDEX 0
+#endif
+
+#if LOG_BUFFER_PLACEMENT == LOG_BUFFER_TASK && LOGGER_OUTPUT_MODE != LOGGER_OUTPUT_RTOS
+#error "LOG_BUFFER_TASK requires LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS"
+#endif
+
+/** @brief Size in bytes of the transmit ring buffer (DMA mode only, must be a power of two). */
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 1024
+#endif
+
+/** @brief Overflow policy: a message that does not fit in the ring is dropped and counted. */
+#define LOG_OVERFLOW_DROP 0
+
+/** @brief Overflow policy: the caller waits until the message fits (thread context only). */
+#define LOG_OVERFLOW_BLOCK 1
+
+/** @brief Selected ring buffer overflow policy (LOG_OVERFLOW_DROP or LOG_OVERFLOW_BLOCK). */
+#ifndef LOG_OVERFLOW_POLICY
+#define LOG_OVERFLOW_POLICY LOG_OVERFLOW_DROP
+#endif
+
+/**
+ * @brief 1 to format text messages directly in the ring instead of copying them (DMA mode only).
+ *
+ * Each line reserves LOG_BUFFER_SIZE bytes of the ring, is formatted in place, and gives the unused
+ * part back when committed. The ring grows by LOG_BUFFER_SIZE bytes so that a reservation stays
+ * contiguous across its end. Only used when the built-in UART sink is the single destination of the
+ * message and no other producer is writing to the ring, and not with LOG_DEDUP or LOG_PERSIST.
+ * A commit waits for the producers that started after it, which only happens when they do not
+ * preempt each other in LIFO order (tasks of the same priority, time-sliced).
+ */
+#ifndef LOG_RING_DIRECT
+#define LOG_RING_DIRECT 0
+#endif
+
+/**
+ * @brief Minimum number of bytes gathered into one transfer (DMA and RTOS modes, 0 disables).
+ *
+ * Short messages are then sent together instead of one HAL call each. Smaller batches are sent
+ * once their oldest byte has waited LOG_BATCH_DEADLINE_MS, or by LOGGER_FLUSH().
+ */
+#ifndef LOG_BATCH_SIZE
+#define LOG_BATCH_SIZE 0
+#endif
+
+/** @brief Maximum delay in ms added by batching. */
+#ifndef LOG_BATCH_DEADLINE_MS
+#define LOG_BATCH_DEADLINE_MS 5
+#endif
+
+/**
+ * @brief 1 to hold the ring back while the system sleeps (DMA mode only).
+ *
+ * Between LOGGER_SLEEP() and LOGGER_WAKE(), messages stay in the ring instead of waking the UART,
+ * until LOG_LOWPOWER_THRESHOLD bytes are queued: the whole ring is then sent in one go.
+ * LOGGER_WAKE() sends what was held back.
+ */
+#ifndef LOG_LOWPOWER
+#define LOG_LOWPOWER 0
+#endif
+
+/** @brief Bytes queued while sleeping that start a transfer anyway. */
+#ifndef LOG_LOWPOWER_THRESHOLD
+#define LOG_LOWPOWER_THRESHOLD (LOG_RING_SIZE / 2)
+#endif
+
+#if LOG_LOWPOWER && LOGGER_OUTPUT_MODE != LOGGER_OUTPUT_DMA
+#error "LOG_LOWPOWER requires LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA"
+#endif
+
+// The ring must be able to reach the threshold with room left for one more message.
+#if LOG_LOWPOWER && LOG_LOWPOWER_THRESHOLD > LOG_RING_SIZE - LOG_BUFFER_SIZE
+#error "LOG_LOWPOWER_THRESHOLD must not exceed LOG_RING_SIZE - LOG_BUFFER_SIZE"
+#endif
+
+/** @brief Number of records of the logger task queue, at most 256 (RTOS mode only). */
+#ifndef LOG_QUEUE_DEPTH
+#define LOG_QUEUE_DEPTH 16
+#endif
+
+/** @brief Maximum wait in ms of the logger task before sending staged ISR messages (RTOS mode). */
+#ifndef LOG_TASK_POLL_MS
+#define LOG_TASK_POLL_MS 10
+#endif
+
+/** @brief Stack words printed by LOGGER_PANIC_DUMP() after the exception frame. */
+#ifndef LOG_PANIC_STACK_WORDS
+#define LOG_PANIC_STACK_WORDS 16
+#endif
+
+/** @brief Number of staging slots (of LOG_BUFFER_SIZE bytes) for messages logged from ISRs
+ *         (blocking and RTOS modes; in DMA mode interrupt handlers write to the ring). */
+#ifndef LOG_ISR_SLOTS
+#define LOG_ISR_SLOTS 4
+#endif
+
+/**
+ * @brief Deferred (binary) logging: 1 to ship call-site IDs and raw arguments instead of text.
+ *
+ * In deferred mode the format string never gets expanded on the target. Each `LOG_*` call site
+ * owns a descriptor in the `.logger_sites` section, and only its address (the ID), a timestamp
+ * and the packed arguments are sent. `tools/logdecode.py` rebuilds the text from the ELF file.
+ */
+#ifndef LOGGER_DEFERRED
+#define LOGGER_DEFERRED 0
+#endif
+
+/** @brief Deferred record framing: each record is preceded by its length byte. */
+#define LOG_FRAMING_LENGTH 0
+
+/**
+ * @brief Deferred record framing: each record is a COBS frame terminated by a 0x00 byte, with a
+ *        16-bit sequence number and a CRC-16.
+ *
+ * Corrupted frames are detected, lost ones are counted from the sequence gap, and the decoder
+ * resynchronizes on the next 0x00 byte, which never appears inside a frame.
+ */
+#define LOG_FRAMING_COBS 1
+
+/** @brief Selected deferred record framing (LOG_FRAMING_LENGTH or LOG_FRAMING_COBS). */
+#ifndef LOG_FRAMING
+#define LOG_FRAMING LOG_FRAMING_LENGTH
+#endif
+
+/**
+ * @brief Compact deferred records: 1 to send integers as zigzag varints and timestamps as deltas.
+ *
+ * Small values of either sign take one byte instead of four, and so do the timestamps of records
+ * that follow each other within the same tick range. Decode with `logdecode.py --compact`.
+ */
+#ifndef LOG_DEFERRED_COMPACT
+#define LOG_DEFERRED_COMPACT 0
+#endif
+
+/** @brief Compact records between two absolute timestamps, sent for decoders attached mid-stream. */
+#ifndef LOG_COMPACT_SYNC
+#define LOG_COMPACT_SYNC 32
+#endif
+
+/** @brief Persistent log: disabled. */
+#define LOG_PERSIST_OFF 0
+
+/** @brief Persistent log: every message is also copied into the RAM log. */
+#define LOG_PERSIST_MIRROR 1
+
+/** @brief Persistent log: messages only go to the RAM log until LOGGER_PERSIST_FLUSH(). */
+#define LOG_PERSIST_BUFFERED 2
+
+/**
+ * @brief Selected persistent log mode.
+ *
+ * The RAM log lives in a section that the startup code does not clear, so its content survives
+ * a warm reset (watchdog, fault handler, `NVIC_SystemReset()`) and can be replayed at boot. A
+ * magic value and a CRC of the header detect a cold boot or a corrupted log.
+ */
+#ifndef LOG_PERSIST
+#define LOG_PERSIST LOG_PERSIST_OFF
+#endif
+
+/** @brief Size in bytes of the RAM log (must be a power of two). */
+#ifndef LOG_PERSIST_SIZE
+#define LOG_PERSIST_SIZE 1024
+#endif
+
+/** @brief Linker section of the RAM log, must not be initialized by the startup code. */
+#ifndef LOG_PERSIST_SECTION
+#define LOG_PERSIST_SECTION ".noinit"
+#endif
+
+/**
+ * @brief Collapses consecutive identical messages into a "last message repeated N times" line.
+ *
+ * The count is written when a different message arrives, or by LOGGER_PROCESS().
+ */
+#ifndef LOG_DEDUP
+#define LOG_DEDUP 0
+#endif
+
+/**
+ * @brief Collects statistics about the logger itself, see LOGGER_GET_STATS().
+ *
+ * Every logging call is timed with the DWT cycle counter, which is enabled on first use.
+ */
+#ifndef LOG_STATS
+#define LOG_STATS 0
+#endif
+
+/**
+ * @brief Number of times log_sink_itm() polls a full ITM FIFO for one byte before it drops the
+ *        rest of the message (slow SWO clock, or no debugger draining the port).
+ */
+#ifndef LOG_ITM_WAIT_POLLS
+#define LOG_ITM_WAIT_POLLS 10000U
+#endif
+
+/** @brief Builds log_sink_rtt(), requires the SEGGER RTT sources. */
+#ifndef LOG_SINK_RTT
+#define LOG_SINK_RTT 0
+#endif
+
+/** @brief Builds log_sink_usb_cdc(), requires the CubeMX USB device CDC middleware. */
+#ifndef LOG_SINK_USB_CDC
+#define LOG_SINK_USB_CDC 0
+#endif
+
+/** @brief Color the prefix of each line with ANSI escape codes. */
+#ifndef LOG_PREFIX_COLOR
+#define LOG_PREFIX_COLOR 1
+#endif
+
+/** @brief Level in the prefix: three-letter tag, e.g. `[WRN]`. */
+#define LOG_PREFIX_LEVEL_TAG 0
+
+/** @brief Level in the prefix: single character, e.g. `W`. */
+#define LOG_PREFIX_LEVEL_CHAR 1
+
+/** @brief Selected level format. */
+#ifndef LOG_PREFIX_LEVEL
+#define LOG_PREFIX_LEVEL LOG_PREFIX_LEVEL_TAG
+#endif
+
+/** @brief Module in the prefix: omitted. */
+#define LOG_PREFIX_MODULE_NONE 0
+
+/** @brief Module in the prefix: name, e.g. `[radio]`. */
+#define LOG_PREFIX_MODULE_NAME 1
+
+/** @brief Module in the prefix: registry ID, e.g. `[3]` (needs `logger_shell.c`). */
+#define LOG_PREFIX_MODULE_ID 2
+
+/** @brief Selected module format. */
+#ifndef LOG_PREFIX_MODULE
+#define LOG_PREFIX_MODULE LOG_PREFIX_MODULE_NAME
+#endif
+
+/** @brief Function name in the prefix. When disabled, `__func__` is not stored in the image. */
+#ifndef LOG_PREFIX_FUNC
+#define LOG_PREFIX_FUNC 1
+#endif
+
+/** @brief Line number in the prefix. */
+#ifndef LOG_PREFIX_LINE
+#define LOG_PREFIX_LINE 1
+#endif
 
 /** @brief ANSI escape codes for terminal colors. */
 #define KNRM "\x1B[0m"
@@ -111,168 +540,979 @@ static inline void LOGGER_SET_LOGGING_LEVEL(log_level_t level)
 #define KWHT "\x1B[37m"
 
 /* =======================================================================
- * [LOGGING MACROS]
+ * [FORMATTER]
  * =======================================================================
  */
 
 /*!
- * @brief Logs a raw, unformatted message without severity or color codes.
+ * @brief Built-in `vsnprintf()` replacement, see logger_format.c for the supported subset.
+ *
+ * @return Number of characters the complete output needs, excluding the terminator (as C99).
  */
-#define LOG_RAW(fmt, ...)                                                                          \
-        do                                                                                         \
-        {                                                                                          \
-            char msg[LOG_BUFFER_SIZE];                                                             \
-            (void) snprintf(msg, LOG_BUFFER_SIZE, fmt, ##__VA_ARGS__);                             \
-            HAL_UART_Transmit(&huart1, (uint8_t *) msg, strlen(msg), HAL_MAX_DELAY);               \
-        } while (0)
+int log_vsnprintf(char *buf, size_t size, const char *fmt, va_list ap);
+
+/*!
+ * @brief Built-in `snprintf()` replacement.
+ */
+int log_snprintf(char *buf, size_t size, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/*!
+ * @brief Helper macro, formatter used by the logging macros.
+ */
+#if LOGGER_FORMATTER == LOGGER_FORMATTER_BUILTIN
+#define LOG_VSNPRINTF log_vsnprintf
+#else
+#define LOG_VSNPRINTF vsnprintf
+#endif
+
+/*!
+ * @brief Formats a message and returns the exact number of bytes written.
+ *
+ * If the message does not fit, its end is replaced by `LOG_TRUNCATION_MARKER` and the
+ * truncation counter is incremented. The returned length is the one every backend sends, so
+ * the message is never rescanned with `strlen()`.
+ *
+ * @param buf  Destination buffer.
+ * @param size Destination size, including the terminator.
+ * @param fmt  printf-style format string.
+ * @return Number of bytes written, excluding the terminator.
+ */
+size_t log_format(char *buf, size_t size, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/*!
+ * @brief va_list form of log_format().
+ */
+size_t log_vformat(char *buf, size_t size, const char *fmt, va_list ap);
+
+/*!
+ * @brief Returns the number of messages truncated to fit in LOG_BUFFER_SIZE.
+ */
+uint32_t LOGGER_GET_TRUNCATED(void);
+
+/*!
+ * @brief Returns the current timestamp, extended to 64 bits, in LOG_TIMESTAMP_HZ units.
+ *
+ * The DWT cycle counter is enabled on first use.
+ */
+uint64_t LOGGER_GET_TIMESTAMP(void);
+
+/*!
+ * @brief Returns the registry ID of a module, -1 if it is NULL or not registered.
+ *
+ * The registry is searched once per module: the ID is then cached in the instance. Constant
+ * modules (LOG_MODULE_REGISTER_CONST()) are in flash and searched on every call, as are the ones
+ * past the 254th. Used for LOG_PREFIX_MODULE_ID, implemented in `logger_shell.c`.
+ */
+int log_module_id(const log_instance_t *inst);
+
+/*!
+ * @brief Formats a leveled message with its prefix and sends it to the module's channel.
+ *
+ * Shared out-of-line body of the text-mode `LOG_*` macros: the call site only checks the level
+ * and passes its arguments, while the buffer and the formatting live here.
+ *
+ * @param level  Severity of the message.
+ * @param module Module, or NULL for global logging (console channel).
+ * @param func   Name of the calling function.
+ * @param line   Source line of the call.
+ * @param fmt    printf-style format string.
+ * @param ap     Format arguments.
+ */
+void log_vemit(log_level_t level, const log_instance_t *module, const char *func, int line,
+               const char *fmt, va_list ap);
+
+/*!
+ * @brief Variadic form of log_vemit(), called by the `LOG_*` macros.
+ */
+void log_emit(log_level_t level, const log_instance_t *module, const char *func, int line,
+              const char *fmt, ...) __attribute__((format(printf, 5, 6)));
+
+/*!
+ * @brief Writes a binary buffer as a hex dump (LOG_HEXDUMP()).
+ *
+ * A header line with the usual prefix and the size is followed by one row per LOG_HEXDUMP_ROW
+ * bytes. Rows are encoded with a lookup table, without any printf call.
+ */
+void log_hexdump(log_level_t level, const log_instance_t *module, const char *func, int line,
+                 const void *data, size_t size);
+
+/*!
+ * @brief Formats a message without prefix and sends it through log_write() (LOG_RAW()).
+ */
+void log_raw(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
 
 /* =======================================================================
- * [MODULE LOGGING MACROS]
+ * [DEFERRED LOGGING]
  * =======================================================================
  */
 
-#ifdef MODULE_REGISTRED
+/*!
+ * @brief Compile-time description of a deferred `LOG_*` call site.
+ *
+ * Read only by the host decoder; the target just uses the descriptor address as the ID, so the
+ * section may be placed in a non-loaded (INFO) output section of the linker script.
+ */
+typedef struct
+{
+    const char *fmt;  //!< Format string, as written at the call site
+    const char *func; //!< Name of the enclosing function
+    uint16_t line;    //!< Source line of the call site
+    uint8_t level;    //!< Severity (log_level_t), or LOG_SITE_RAW for LOG_RAW()
+} log_site_t;
+
+/** @brief Level stored in the descriptor of LOG_RAW() call sites (no prefix is rendered). */
+#define LOG_SITE_RAW 0xFF
 
 /*!
- * @brief Logs a DEBUG-level message.
+ * @brief Wire encoding of a deferred argument.
  */
-#define LOG_DEBUG(fmt, ...)                                                                        \
-        do                                                                                         \
-        {                                                                                          \
-            if (CHECK_LOG_LEVEL(LOG_LEVEL_DEBUG))                                                  \
-            {                                                                                      \
-                if ((CURRENT_LOG_MODULE) && (LOG_LEVEL_DEBUG >= CURRENT_LOG_MODULE->level))        \
-                {                                                                                  \
-                    char msg[LOG_BUFFER_SIZE];                                                     \
-                    (void) snprintf(msg, LOG_BUFFER_SIZE, KWHT "[DBG][%s][%s:%d]: " fmt KNRM,      \
-                                    CURRENT_LOG_MODULE->name, __func__, __LINE__, ##__VA_ARGS__);  \
-                    HAL_UART_Transmit(&huart1, (uint8_t *) msg, strlen(msg), HAL_MAX_DELAY);       \
-                }                                                                                  \
-            }                                                                                      \
-        } while (0)
+typedef enum
+{
+    LOG_ARG_U32 = 0, //!< Any integer up to 32 bits, characters and pointers: 4 bytes
+    LOG_ARG_U64,     //!< 64-bit integers: 8 bytes
+    LOG_ARG_F32,     //!< float and double, sent as a 32-bit float: 4 bytes
+    LOG_ARG_STR      //!< Strings: 1 length byte followed by the characters (no terminator)
+} log_arg_kind_t;
 
 /*!
- * @brief Logs an INFO-level message.
+ * @brief A deferred argument captured at the call site.
  */
-#define LOG_INFO(fmt, ...)                                                                         \
-        do                                                                                         \
-        {                                                                                          \
-            if (CHECK_LOG_LEVEL(LOG_LEVEL_INFO))                                                   \
-            {                                                                                      \
-                if ((CURRENT_LOG_MODULE) && (LOG_LEVEL_INFO >= CURRENT_LOG_MODULE->level))         \
-                {                                                                                  \
-                    char msg[LOG_BUFFER_SIZE];                                                     \
-                    (void) snprintf(msg, LOG_BUFFER_SIZE, KGRN "[INF][%s][%s:%d]: " KNRM fmt,      \
-                                    CURRENT_LOG_MODULE->name, __func__, __LINE__, ##__VA_ARGS__);  \
-                    HAL_UART_Transmit(&huart1, (uint8_t *) msg, strlen(msg), HAL_MAX_DELAY);       \
-                }                                                                                  \
-            }                                                                                      \
-        } while (0)
+typedef struct
+{
+    log_arg_kind_t kind; //!< How the value is packed on the wire
+    union
+    {
+        uint32_t u32;
+        uint64_t u64;
+        float f32;
+        const char *str;
+    } value; //!< Captured value
+} log_arg_t;
+
+static inline log_arg_t log_arg_u32(uint32_t v)
+{
+    log_arg_t arg = {LOG_ARG_U32, {.u32 = v}};
+    return arg;
+}
+
+static inline log_arg_t log_arg_u64(uint64_t v)
+{
+    log_arg_t arg = {LOG_ARG_U64, {.u64 = v}};
+    return arg;
+}
+
+static inline log_arg_t log_arg_f32(double v)
+{
+    log_arg_t arg = {LOG_ARG_F32, {.f32 = (float) v}};
+    return arg;
+}
+
+static inline log_arg_t log_arg_str(const char *v)
+{
+    log_arg_t arg = {LOG_ARG_STR, {.str = v}};
+    return arg;
+}
+
+static inline log_arg_t log_arg_ptr(const void *v)
+{
+    log_arg_t arg = {LOG_ARG_U32, {.u32 = (uint32_t) (uintptr_t) v}};
+    return arg;
+}
 
 /*!
- * @brief Logs a WARNING-level message.
+ * @brief Compile-time printf format check, never called.
+ */
+static inline void __attribute__((format(printf, 1, 2))) log_format_check(const char *fmt, ...)
+{
+    (void) fmt;
+}
+
+/*!
+ * @brief Helper macro, captures one argument with the encoding matching its type.
+ *
+ * Only `char *` is captured as a string: byte buffers (`uint8_t *`) are pointers, as they are not
+ * NUL-terminated.
+ */
+#define LOG_ARG(x)                                                                                 \
+        _Generic((x),                                                                              \
+                char *: log_arg_str,                                                               \
+                const char *: log_arg_str,                                                         \
+                signed char *: log_arg_ptr,                                                        \
+                const signed char *: log_arg_ptr,                                                  \
+                unsigned char *: log_arg_ptr,                                                      \
+                const unsigned char *: log_arg_ptr,                                                \
+                void *: log_arg_ptr,                                                               \
+                const void *: log_arg_ptr,                                                         \
+                float: log_arg_f32,                                                                \
+                double: log_arg_f32,                                                               \
+                long long: log_arg_u64,                                                            \
+                unsigned long long: log_arg_u64,                                                   \
+                default: log_arg_u32)(x)
+
+/*!
+ * @brief Helper macros, count (up to 8) and capture the variadic arguments of a call site.
+ */
+#define LOG_NARGS(...)                          LOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+#define LOG_CAT(a, b)                           LOG_CAT_(a, b)
+#define LOG_CAT_(a, b)                          a##b
+#define LOG_ARGS_0()
+#define LOG_ARGS_1(a)                           , LOG_ARG(a)
+#define LOG_ARGS_2(a, ...)                      , LOG_ARG(a) LOG_ARGS_1(__VA_ARGS__)
+#define LOG_ARGS_3(a, ...)                      , LOG_ARG(a) LOG_ARGS_2(__VA_ARGS__)
+#define LOG_ARGS_4(a, ...)                      , LOG_ARG(a) LOG_ARGS_3(__VA_ARGS__)
+#define LOG_ARGS_5(a, ...)                      , LOG_ARG(a) LOG_ARGS_4(__VA_ARGS__)
+#define LOG_ARGS_6(a, ...)                      , LOG_ARG(a) LOG_ARGS_5(__VA_ARGS__)
+#define LOG_ARGS_7(a, ...)                      , LOG_ARG(a) LOG_ARGS_6(__VA_ARGS__)
+#define LOG_ARGS_8(a, ...)                      , LOG_ARG(a) LOG_ARGS_7(__VA_ARGS__)
+#define LOG_ARG_ARRAY(...)                                                                         \
+        (&((const log_arg_t[]){{0} LOG_CAT(LOG_ARGS_, LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)})[1])
+
+/*!
+ * @brief Packs a deferred record and sends it to the module's channel.
+ *
+ * Record layout (little endian): 1 length byte (size of the rest of the record), the 32-bit
+ * call-site ID, the low 32 bits of the timestamp (`HAL_GetTick()` unless LOG_TIMESTAMP selects
+ * another source), the 32-bit address of the module name
+ * (0 without a module) and the packed arguments.
+ *
+ * With LOG_DEFERRED_COMPACT the record holds varints instead: the call-site ID, the module address,
+ * the timestamp (`delta << 1`, or `(timestamp << 1) | 1` when absolute) and the arguments, with
+ * integers zigzag-encoded. Floats and strings are packed as above.
+ *
+ * @param site   Call-site descriptor; only its address is used on the target.
+ * @param module Module, or NULL.
+ * @param nargs  Number of captured arguments.
+ * @param args   Captured arguments.
  */
-#define LOG_WARNING(fmt, ...)                                                                      \
+void log_emit_deferred(const log_site_t *site, const log_instance_t *module, uint8_t nargs,
+                       const log_arg_t *args);
+
+/*!
+ * @brief Helper macro, emits a deferred record for the current call site.
+ */
+#define LOG_DEFERRED(severity, module, fmt, ...)                                                   \
         do                                                                                         \
         {                                                                                          \
-            if (CHECK_LOG_LEVEL(LOG_LEVEL_WARNING))                                                \
+            static const char log_fmt_[] __attribute__((section(".logger_str"))) = fmt;            \
+            static const log_site_t log_site_ __attribute__((section(".logger_sites"), used)) = {  \
+                log_fmt_, __func__, __LINE__, (severity)};                                         \
+            log_emit_deferred(&log_site_, (module), LOG_NARGS(__VA_ARGS__),                        \
+                              LOG_ARG_ARRAY(__VA_ARGS__));                                         \
+            if (0)                                                                                 \
             {                                                                                      \
-                if ((CURRENT_LOG_MODULE) && (LOG_LEVEL_WARNING >= CURRENT_LOG_MODULE->level))      \
-                {                                                                                  \
-                    char msg[LOG_BUFFER_SIZE];                                                     \
-                    (void) snprintf(msg, LOG_BUFFER_SIZE, KYEL "[WRN][%s][%s:%d]: " KNRM fmt,      \
-                                    CURRENT_LOG_MODULE->name, __func__, __LINE__, ##__VA_ARGS__);  \
-                    HAL_UART_Transmit(&huart1, (uint8_t *) msg, strlen(msg), HAL_MAX_DELAY);       \
-                }                                                                                  \
+                log_format_check(fmt, ##__VA_ARGS__);                                              \
             }                                                                                      \
         } while (0)
 
+/** @brief Format string of hex dump sites: `%H` is rendered by the host decoder. */
+#define LOG_HEXDUMP_FMT "%lu bytes%H"
+
 /*!
- * @brief Logs an ERROR-level message.
+ * @brief Packs a hex dump record: the 32-bit total size, then a count byte and the raw bytes
+ *        (as many as fit in the record).
+ */
+void log_hexdump_deferred(const log_site_t *site, const log_instance_t *module, const void *data,
+                          size_t size);
+
+/*!
+ * @brief Helper macro, emits a deferred hex dump record for the current call site.
  */
-#define LOG_ERROR(fmt, ...)                                                                        \
+#define LOG_DEFERRED_HEXDUMP(severity, module, ptr, len)                                           \
         do                                                                                         \
         {                                                                                          \
-            if (CHECK_LOG_LEVEL(LOG_LEVEL_ERROR))                                                  \
-            {                                                                                      \
-                if ((CURRENT_LOG_MODULE) && (LOG_LEVEL_ERROR >= CURRENT_LOG_MODULE->level))        \
-                {                                                                                  \
-                    char msg[LOG_BUFFER_SIZE];                                                     \
-                    (void) snprintf(msg, LOG_BUFFER_SIZE, KRED "[ERR][%s][%s:%d]: " KNRM fmt,      \
-                                    CURRENT_LOG_MODULE->name, __func__, __LINE__, ##__VA_ARGS__);  \
-                    HAL_UART_Transmit(&huart1, (uint8_t *) msg, strlen(msg), HAL_MAX_DELAY);       \
-                }                                                                                  \
-            }                                                                                      \
+            static const char log_fmt_[] __attribute__((section(".logger_str"))) =                 \
+                LOG_HEXDUMP_FMT;                                                                   \
+            static const log_site_t log_site_ __attribute__((section(".logger_sites"), used)) = {  \
+                log_fmt_, __func__, __LINE__, (severity)};                                         \
+            log_hexdump_deferred(&log_site_, (module), (ptr), (len));                              \
         } while (0)
 
+/* =======================================================================
+ * [OUTPUT BACKEND]
+ * =======================================================================
+ */
+
+/** @brief Level passed to log_write() for raw messages: accepted by every enabled sink. */
+#define LOG_LEVEL_RAW ((log_level_t) 0xFF)
+
+/** @brief Maximum number of output sinks, including the built-in UART sink. */
+#ifndef LOG_MAX_SINKS
+#define LOG_MAX_SINKS 4
+#endif
+
+/** @brief Index of the built-in UART sink, registered at startup. */
+#define LOG_SINK_UART 0
+
+/*!
+ * @brief Output sink write function.
+ *
+ * Called in the context of the `LOG_*` call, including interrupt handlers, so it should not block
+ * for long. `data` is only valid during the call.
+ *
+ * @param ctx  Context pointer given to LOGGER_ADD_SINK().
+ * @param data Pointer to the message bytes.
+ * @param len  Number of bytes to send.
+ */
+typedef void (*log_sink_write_t)(void *ctx, const uint8_t *data, size_t len);
+
+/*!
+ * @brief Sends an already formatted message to every sink whose level it passes.
+ *
+ * @param level Severity of the message, LOG_LEVEL_RAW for raw messages.
+ * @param data  Pointer to the message bytes.
+ * @param len   Number of bytes to send.
+ */
+void log_write(log_level_t level, const uint8_t *data, size_t len);
+
+/*!
+ * @brief Adds an output sink.
+ *
+ * Sinks are meant to be added during initialization, before messages are logged from
+ * interrupt handlers or other tasks.
+ *
+ * @param write Sink write function, e.g. one of the `log_sink_*()` functions below.
+ * @param ctx   Context pointer passed to `write`.
+ * @param level Minimum severity sent to this sink.
+ *
+ * @return Index of the sink, or -1 if LOG_MAX_SINKS sinks are already registered.
+ */
+int LOGGER_ADD_SINK(log_sink_write_t write, void *ctx, log_level_t level);
+
+/*!
+ * @brief Sets the minimum severity sent to a sink (LOG_LEVEL_OFF disables it).
+ *
+ * @param sink  Sink index returned by LOGGER_ADD_SINK(), or LOG_SINK_UART.
+ * @param level New minimum severity.
+ */
+void LOGGER_SET_SINK_LEVEL(int sink, log_level_t level);
+
+/*!
+ * @brief Built-in UART sink: sends a message through the selected output mode on `LOG_UART`.
+ *
+ * In blocking mode the message is transmitted before returning. In DMA mode it is copied into
+ * the ring buffer as a whole (never partially) and the call returns immediately; the ring is
+ * lock-free, so it can be called from any task or interrupt handler.
+ *
+ * In the other modes, when called from an interrupt handler (IPSR != 0) the message is copied
+ * into a staging slot instead, which never blocks, and is sent later in order with the rest of
+ * the output.
+ */
+void log_sink_uart(void *ctx, const uint8_t *data, size_t len);
+
+/*!
+ * @brief Sink that transmits on any UART in blocking mode; `ctx` is its `UART_HandleTypeDef *`.
+ *
+ * Never waits in interrupt context: outside DMA mode the message takes a staging slot, like with
+ * the built-in UART sink, and is sent with the rest of the staged output. In DMA mode, where there
+ * are no staging slots, it is dropped and counted by LOGGER_GET_DROPPED(); use
+ * log_sink_uart_dma() for UARTs that interrupt handlers log to.
+ */
+void log_sink_uart_blocking(void *ctx, const uint8_t *data, size_t len);
+
+/*!
+ * @brief Sink that transmits on any UART through its own DMA ring; `ctx` is its
+ *        `UART_HandleTypeDef *`.
+ *
+ * In DMA mode each UART gets one of the LOG_DMA_RINGS rings when the sink is registered with
+ * LOGGER_ADD_SINK() or LOGGER_CHANNEL_INIT() (`LOG_UART` shares the built-in ring), and behaves
+ * like the built-in UART sink: lock-free, usable from any context, drained by DMA. In RTOS mode
+ * the message goes through the logger task queue, like with the built-in UART sink, and the task
+ * transmits it on this UART. In blocking mode it is log_sink_uart_blocking().
+ */
+void log_sink_uart_dma(void *ctx, const uint8_t *data, size_t len);
+
+/*!
+ * @brief Sink that writes to an ITM stimulus port (SWO); `ctx` is the port number.
+ *
+ * Nothing is written while no debugger has enabled the ITM and the port. Interrupts are only
+ * masked for one byte at a time, so a message logged by an interrupt handler may land inside the
+ * one it interrupted; a FIFO that stays full for LOG_ITM_WAIT_POLLS polls drops the rest of the
+ * message.
+ */
+void log_sink_itm(void *ctx, const uint8_t *data, size_t len);
+
+#if LOG_SINK_RTT
+/*!
+ * @brief Sink that writes to a SEGGER RTT up-buffer; `ctx` is the buffer index.
+ */
+void log_sink_rtt(void *ctx, const uint8_t *data, size_t len);
+#endif
+
+#if LOG_SINK_USB_CDC
+/*!
+ * @brief Sink that sends messages over the USB CDC device (`CDC_Transmit_FS()`).
+ *
+ * Messages are dropped while the previous transfer is still in progress or the device is not
+ * configured.
+ */
+void log_sink_usb_cdc(void *ctx, const uint8_t *data, size_t len);
+#endif
+
+/*!
+ * @brief Transmits the messages staged from interrupt context.
+ *
+ * In blocking mode, staged messages otherwise wait for the next thread-context log call; call
+ * this periodically (e.g. from the main loop) if interrupts log while thread code is silent.
+ * In DMA mode it only restarts the DMA chain if it is idle, and sends a batch whose deadline
+ * has expired: with LOG_BATCH_SIZE, call it at least every LOG_BATCH_DEADLINE_MS. With LOG_DEDUP
+ * it also reports the repetitions of the last message counted so far.
+ *
+ * @note Thread context only.
+ */
+void LOGGER_PROCESS(void);
+
+/*!
+ * @brief Sends everything queued so far, ignoring LOG_BATCH_SIZE, and waits until it is out.
+ *
+ * Use it at critical points (before a reset, entering low-power mode, ...). In DMA mode it only
+ * starts the transfer when called with interrupts disabled or from an interrupt handler, since
+ * the transmit-complete interrupt could not run. In RTOS mode, called from a task, it waits until
+ * the logger task has transmitted every queued and staged message, polling once per tick; a
+ * batch the task is gathering still waits for LOG_BATCH_DEADLINE_MS. From an interrupt handler or
+ * before the scheduler starts it returns at once.
+ */
+void LOGGER_FLUSH(void);
+
+/*!
+ * @brief Checks whether the logger UARTs may be stopped (clock gated, STOP mode, ...).
+ *
+ * @return 1 when no transfer is running and the last byte has left the shift register of
+ *         `LOG_UART` and of every UART of a log_sink_uart_dma() or log_sink_uart_blocking()
+ *         sink or channel. Messages may still be queued in RAM, but not in the RTOS queue or in
+ *         a batch the logger task is gathering.
+ *         To act on the result atomically, call it with interrupts disabled, as the tickless idle
+ *         hooks of FreeRTOS do.
+ */
+int LOGGER_IS_IDLE(void);
+
+/*!
+ * @brief Emergency flush for fault handlers and assert failures: gets every queued byte out.
+ *
+ * Masks interrupts, stops the running DMA transfer and sends what it had not transmitted yet,
+ * then the rest of the ring (or the logger task's batch, the RTOS queue and the interrupt staging
+ * slots) by polling the USART data register directly, without HAL calls or locks. It returns once the last byte is out.
+ *
+ * The logger stays in this polling mode until reset: messages logged afterwards, e.g. by
+ * LOGGER_PANIC_DUMP(), are sent synchronously. A message the fault interrupted mid-copy may come
+ * out garbled.
+ */
+void LOGGER_PANIC_FLUSH(void);
+
+/*!
+ * @brief Prints the exception frame, the fault status registers and the top of the stack.
+ *
+ * Meant to follow LOGGER_PANIC_FLUSH() in a fault handler. The lines are LOG_RAW() messages.
+ *
+ * @param frame Stacked exception frame (r0-r3, r12, lr, pc, xPSR), i.e. the MSP or PSP value on
+ *              entry of the handler, or NULL to print the fault registers only.
+ */
+void LOGGER_PANIC_DUMP(const uint32_t *frame);
+
+#if LOG_LOWPOWER
+
+/*!
+ * @brief Opens a sleep window: new messages are held in the ring instead of being sent.
+ *
+ * Call it just before entering a low-power mode. Only a ring holding LOG_LOWPOWER_THRESHOLD bytes
+ * or LOGGER_FLUSH() start a transfer until LOGGER_WAKE().
+ */
+void LOGGER_SLEEP(void);
+
+/*!
+ * @brief Closes the sleep window and sends the messages held back.
+ *
+ * Call it after waking up, once the UART clock is back. Any context.
+ */
+void LOGGER_WAKE(void);
+
+#endif // LOG_LOWPOWER
+
+/*!
+ * @brief Returns the number of messages dropped because the ring buffer or the interrupt
+ *        staging area was full.
+ */
+uint32_t LOGGER_GET_DROPPED(void);
+
+/*!
+ * @brief Transmit-complete hook for the DMA output mode.
+ *
+ * Must be called from `HAL_UART_TxCpltCallback()` so the logger can release the transmitted
+ * bytes and start the next DMA transfer. Calls for UART handles without a logger ring are
+ * ignored.
+ *
+ * @param huart UART handle passed to `HAL_UART_TxCpltCallback()`.
+ */
+void LOGGER_TX_CPLT_CALLBACK(UART_HandleTypeDef *huart);
+
+#if LOG_PERSIST != LOG_PERSIST_OFF
+
+/*!
+ * @brief Sends the content of the RAM log over `LOG_UART` and empties it.
+ *
+ * Call it at boot, before the first message, to recover what the previous run logged before a
+ * reset. Transmission is blocking regardless of the output mode. If the log wrapped, its first
+ * message may be incomplete.
+ */
+void LOGGER_PERSIST_REPLAY(void);
+
+/*!
+ * @brief Copies the oldest bytes of the RAM log into a buffer and removes them from the log.
+ *
+ * @param dst  Destination buffer.
+ * @param size Size of the destination buffer.
+ *
+ * @return Number of bytes copied, 0 when the log is empty.
+ */
+size_t LOGGER_PERSIST_READ(uint8_t *dst, size_t size);
+
+#if LOG_PERSIST == LOG_PERSIST_BUFFERED
+
+/*!
+ * @brief Sends the messages waiting in the RAM log through the selected output mode.
+ *
+ * In LOG_PERSIST_BUFFERED mode messages are kept in RAM at memory speed during bursts and only
+ * transmitted when the application calls this function (e.g. from its idle loop).
+ *
+ * The RAM log does not keep the level of each message: a message is only stored if at least one
+ * sink takes its level, and the flush sends it to every sink that is not LOG_LEVEL_OFF, like
+ * LOG_RAW(). Per-sink levels below the lowest one are therefore not applied to flushed output.
+ *
+ * @note Thread context only.
+ */
+void LOGGER_PERSIST_FLUSH(void);
+
+#endif // LOG_PERSIST == LOG_PERSIST_BUFFERED
+
+#endif // LOG_PERSIST != LOG_PERSIST_OFF
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+
+/*!
+ * @brief Logger task queue statistics (RTOS mode only).
+ */
+typedef struct
+{
+    uint32_t high_water;  //!< Highest number of records waiting in the queue
+    uint32_t dropped;     //!< Records dropped because the queue was full
+    uint32_t avg_latency; //!< Average time between posting and transmitting a record, in ticks
+} log_queue_stats_t;
+
+/*!
+ * @brief Creates the logger task queue.
+ *
+ * Call it before the scheduler starts (it is also called by LOGGER_TASK()). Until then,
+ * messages are transmitted directly with the blocking HAL call.
+ */
+void LOGGER_RTOS_INIT(void);
+
+/*!
+ * @brief Logger task entry point (RTOS mode only).
+ *
+ * Create it with the lowest application priority: it is the only user of `LOG_UART`, so producer
+ * tasks never wait on the UART nor on a mutex, whatever their priority.
+ *
+ * @param argument Unused.
+ */
+void LOGGER_TASK(void *argument);
+
+/*!
+ * @brief Copies the logger task queue statistics.
+ *
+ * @param[out] stats Destination of the statistics.
+ */
+void LOGGER_GET_QUEUE_STATS(log_queue_stats_t *stats);
+
+#endif // LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+
+/* =======================================================================
+ * [CHANNELS]
+ * =======================================================================
+ */
+
+/**
+ * @brief Number of output channels, including the console.
+ *
+ * A channel is an independent logger output with its own level and counters. Modules are bound to
+ * one with LOG_MODULE_REGISTER_ON(), so that a high-volume module can be moved off the console,
+ * e.g. to a second UART or to SWO, without slowing down the others. The console (channel 0) is the
+ * output described above: the global level, the sinks, persistence and deduplication.
+ */
+#ifndef LOG_MAX_CHANNELS
+#define LOG_MAX_CHANNELS 1
+#endif
+
+#if LOG_MAX_CHANNELS < 1 || LOG_MAX_CHANNELS > 255
+#error "LOG_MAX_CHANNELS must be between 1 and 255"
+#endif
+
+/** @brief The console channel: messages of global logging, LOG_RAW() and unbound modules. */
+#define LOG_CHANNEL_CONSOLE 0
+
+/** @brief Number of DMA rings for log_sink_uart_dma(), besides the built-in one (DMA mode only). */
+#ifndef LOG_DMA_RINGS
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+#define LOG_DMA_RINGS (LOG_MAX_CHANNELS - 1)
 #else
+#define LOG_DMA_RINGS 0
+#endif
+#endif
+
+#if LOG_MAX_CHANNELS > 1
+
+/*!
+ * @brief Traffic of an output channel since boot.
+ *
+ * Counters updated by concurrent contexts are not synchronized and may miss a few events.
+ */
+typedef struct
+{
+    uint32_t writes;  //!< Lines or deferred records sent
+    uint32_t bytes;   //!< Bytes sent
+    uint32_t dropped; //!< Messages dropped: ring full, or channel not initialized
+} log_channel_stats_t;
+
+/*!
+ * @brief Sets up a channel and its output.
+ *
+ * The modules registered on the channel stay silent until it is initialized. Call it during
+ * initialization, like LOGGER_ADD_SINK().
+ *
+ * @param channel Channel number, from 1 to LOG_MAX_CHANNELS - 1.
+ * @param write   Output of the channel, e.g. log_sink_uart_dma() or log_sink_itm().
+ * @param ctx     Context pointer passed to `write`.
+ * @param level   Minimum severity of the channel, the counterpart of the global level.
+ *
+ * @return 0 on success, -1 if `channel` or `write` is invalid or no DMA ring is left.
+ *
+ * @example
+ * // radio.c: LOG_MODULE_REGISTER_ON(radio, 1, LOG_LEVEL_DEBUG);
+ * LOGGER_CHANNEL_INIT(1, log_sink_uart_dma, &huart2, LOG_LEVEL_DEBUG);
+ */
+int LOGGER_CHANNEL_INIT(int channel, log_sink_write_t write, void *ctx, log_level_t level);
+
+/*!
+ * @brief Sets the minimum severity of a channel (LOG_LEVEL_OFF silences it).
+ *
+ * For LOG_CHANNEL_CONSOLE it is LOGGER_SET_LOGGING_LEVEL().
+ */
+void LOGGER_CHANNEL_SET_LEVEL(int channel, log_level_t level);
+
+/*!
+ * @brief Copies the traffic counters of a channel.
+ *
+ * For the console, `dropped` is LOGGER_GET_DROPPED().
+ *
+ * @param channel    Channel number.
+ * @param[out] stats Destination of the counters.
+ */
+void LOGGER_GET_CHANNEL_STATS(int channel, log_channel_stats_t *stats);
+
+#endif // LOG_MAX_CHANNELS > 1
 
 /* =======================================================================
- * [NON-MODULE LOGGING MACROS]
+ * [STATISTICS]
  * =======================================================================
  */
 
+#if LOG_STATS
+
 /*!
- * @brief Logs a DEBUG-level message.
+ * @brief Cost and traffic of the logger since boot or the last LOGGER_RESET_STATS().
+ *
+ * Counters updated by concurrent contexts are not synchronized and may miss a few events.
  */
-#define LOG_DEBUG(fmt, ...)                                                                        \
-        do                                                                                         \
+typedef struct
+{
+    uint32_t messages[LOG_LEVEL_COUNT]; //!< Logging calls per level
+    uint32_t raw;                       //!< LOG_RAW() calls
+    uint32_t bytes;                     //!< Bytes handed to the output (log_write())
+    uint32_t truncated;                 //!< Messages cut at LOG_BUFFER_SIZE (LOGGER_GET_TRUNCATED())
+    uint32_t dropped;                   //!< Messages dropped (LOGGER_GET_DROPPED())
+    uint32_t cycles_min;                //!< Fewest CPU cycles spent in a logging call
+    uint32_t cycles_avg;                //!< Average CPU cycles per logging call
+    uint32_t cycles_max;                //!< Most CPU cycles spent in a logging call
+    uint32_t peak;                      //!< Peak output backlog: ring bytes (DMA), queued records
+                                        //!< (RTOS) or staged interrupt messages (blocking)
+} log_stats_t;
+
+/*!
+ * @brief Copies the logger statistics.
+ *
+ * `truncated` and `dropped` always count since boot.
+ *
+ * @param[out] stats Destination of the statistics.
+ */
+void LOGGER_GET_STATS(log_stats_t *stats);
+
+/*!
+ * @brief Clears the message, byte, cycle and peak statistics.
+ */
+void LOGGER_RESET_STATS(void);
+
+/*!
+ * @brief Prints the statistics with LOG_RAW().
+ */
+void LOGGER_DUMP_STATS(void);
+
+#endif // LOG_STATS
+
+/* =======================================================================
+ * [RATE LIMITING]
+ * =======================================================================
+ */
+
+/*!
+ * @brief Token bucket of a rate-limited call site.
+ */
+typedef struct
+{
+    uint32_t last;       //!< `HAL_GetTick()` of the last refill
+    uint32_t credit;     //!< Available tokens, in thousandths of a message
+    uint32_t suppressed; //!< Messages dropped since the last one that was sent
+    uint8_t started;     //!< Set by the first call; tick 0 is a valid `last`
+} log_ratelimit_t;
+
+/*!
+ * @brief Takes a token from a call-site bucket that refills at `per_sec` messages per second.
+ *
+ * The bucket starts full and holds at most one second worth of messages.
+ *
+ * @param rl         Call-site state.
+ * @param per_sec    Allowed messages per second.
+ * @param suppressed Set to the number of messages dropped since the previous one was sent.
+ *
+ * @return 1 if the message may be sent, 0 if it must be dropped.
+ */
+int log_ratelimit(log_ratelimit_t *rl, uint32_t per_sec, uint32_t *suppressed);
+
+/* =======================================================================
+ * [LOGGING MACROS]
+ * =======================================================================
+ */
+
+#ifdef MODULE_REGISTRED
+
+/*!
+ * @brief Helper macro, checks a severity against the compile-time, global and module levels.
+ *
+ * The global and module levels are folded into the module's cached `threshold`, so a filtered
+ * message costs one load and one compare. The level of a constant module is already part of its
+ * compile-time threshold, only the global level is left to check.
+ */
+#define LOG_FILTER_PASSES(severity)                                                                \
+        (LOG_MODULE_COMPILE_ENABLED(severity) &&                                                   \
+         (CURRENT_LOG_MODULE_FIXED ? CHECK_LOG_LEVEL(severity)                                     \
+                                   : (int) (severity) >= CURRENT_LOG_MODULE->threshold))
+
+/** @brief Helper macro, the current module. */
+#define LOG_CURRENT_MODULE (CURRENT_LOG_MODULE)
+
+#else
+
+/*!
+ * @brief Helper macro, checks a severity against the global level.
+ */
+#define LOG_FILTER_PASSES(severity) CHECK_LOG_LEVEL(severity)
+
+/** @brief Helper macro, the current module (none without logger_module.h). */
+#define LOG_CURRENT_MODULE NULL
+
+#endif // MODULE_REGISTRED
+
+/** @brief Helper macro, function name passed to log_emit() (none if not printed). */
+#if LOG_PREFIX_FUNC
+#define LOG_CURRENT_FUNC __func__
+#else
+#define LOG_CURRENT_FUNC NULL
+#endif
+
+/*!
+ * @brief Checks whether a message of the given severity would be logged from here.
+ *
+ * Same compile-time, global and module checks as the `LOG_*` macros. Below the compile-time
+ * threshold it is the constant 0, so the code it guards is removed from the image.
+ *
+ * @example
+ * if (LOG_ENABLED(LOG_LEVEL_DEBUG) && fifo_level() > 0)
+ * {
+ *     LOG_HEXDUMP(LOG_LEVEL_DEBUG, fifo, fifo_level());
+ * }
+ */
+#define LOG_ENABLED(severity)                                                                      \
+        ((int) (severity) >= LOG_LEVEL_COMPILE_MIN && LOG_FILTER_PASSES(severity))
+
+/*!
+ * @brief Runs the statement or block that follows only if LOG_ENABLED(severity).
+ *
+ * For diagnostics that are expensive to compute: the work is skipped when the level is disabled at
+ * runtime, and compiled out below the compile-time threshold.
+ *
+ * @example
+ * LOG_IF(LOG_LEVEL_DEBUG)
+ * {
+ *     char state[64];
+ *     dump_state(state, sizeof(state));
+ *     LOG_DEBUG("state: %s\r\n", state);
+ * }
+ */
+#define LOG_IF(severity)                                                                           \
+        if (!LOG_ENABLED(severity))                                                                \
         {                                                                                          \
-            if (CHECK_LOG_LEVEL(LOG_LEVEL_DEBUG))                                                  \
-            {                                                                                      \
-                char msg[LOG_BUFFER_SIZE];                                                         \
-                (void) snprintf(msg, LOG_BUFFER_SIZE, KWHT "[DBG][%s:%d]: " fmt KNRM, __func__,    \
-                                __LINE__, ##__VA_ARGS__);                                          \
-                HAL_UART_Transmit(&huart1, (uint8_t *) msg, strlen(msg), HAL_MAX_DELAY);           \
-            }                                                                                      \
-        } while (0)
+        }                                                                                          \
+        else
+
+#if LOGGER_DEFERRED
+#define LOG_EMIT(severity, fmt, ...)                                                               \
+        LOG_DEFERRED(severity, LOG_CURRENT_MODULE, fmt, ##__VA_ARGS__)
+#else
+#define LOG_EMIT(severity, fmt, ...)                                                               \
+        log_emit(severity, LOG_CURRENT_MODULE, LOG_CURRENT_FUNC, __LINE__, fmt, ##__VA_ARGS__)
+#endif // LOGGER_DEFERRED
 
 /*!
- * @brief Logs an INFO-level message.
+ * @brief Logs a message with the given severity if it passes the level filters.
+ *
+ * The arguments are only evaluated when the message is logged.
  */
-#define LOG_INFO(fmt, ...)                                                                         \
+#define LOG_AT_LEVEL(severity, fmt, ...)                                                           \
         do                                                                                         \
         {                                                                                          \
-            if (CHECK_LOG_LEVEL(LOG_LEVEL_INFO))                                                   \
+            if (LOG_ENABLED(severity))                                                             \
             {                                                                                      \
-                char msg[LOG_BUFFER_SIZE];                                                         \
-                (void) snprintf(msg, LOG_BUFFER_SIZE, KGRN "[INF][%s:%d]: " KNRM fmt, __func__,    \
-                                __LINE__, ##__VA_ARGS__);                                          \
-                HAL_UART_Transmit(&huart1, (uint8_t *) msg, strlen(msg), HAL_MAX_DELAY);           \
+                LOG_EMIT(severity, fmt, ##__VA_ARGS__);                                            \
             }                                                                                      \
         } while (0)
 
 /*!
- * @brief Logs a WARNING-level message.
+ * @brief Logs a message at most `per_sec` times per second from this call site.
+ *
+ * When messages were dropped, the next message that is sent is preceded by a
+ * "N messages suppressed" line at the same level.
  */
-#define LOG_WARNING(fmt, ...)                                                                      \
+#define LOG_AT_LEVEL_RATELIMIT(severity, per_sec, fmt, ...)                                        \
         do                                                                                         \
         {                                                                                          \
-            if (CHECK_LOG_LEVEL(LOG_LEVEL_WARNING))                                                \
+            static log_ratelimit_t log_rl_;                                                        \
+            uint32_t log_suppressed_;                                                              \
+            if (LOG_ENABLED(severity) &&                                                           \
+                log_ratelimit(&log_rl_, (per_sec), &log_suppressed_))                              \
             {                                                                                      \
-                char msg[LOG_BUFFER_SIZE];                                                         \
-                (void) snprintf(msg, LOG_BUFFER_SIZE, KYEL "[WRN][%s:%d]: " KNRM fmt, __func__,    \
-                                __LINE__, ##__VA_ARGS__);                                          \
-                HAL_UART_Transmit(&huart1, (uint8_t *) msg, strlen(msg), HAL_MAX_DELAY);           \
+                if (log_suppressed_ != 0)                                                          \
+                {                                                                                  \
+                    LOG_EMIT(severity, "%lu messages suppressed\r\n",                              \
+                             (unsigned long) log_suppressed_);                                     \
+                }                                                                                  \
+                LOG_EMIT(severity, fmt, ##__VA_ARGS__);                                            \
             }                                                                                      \
         } while (0)
 
+#if LOGGER_DEFERRED
+#define LOG_EMIT_HEXDUMP(severity, ptr, len)                                                       \
+        LOG_DEFERRED_HEXDUMP(severity, LOG_CURRENT_MODULE, ptr, len)
+#else
+#define LOG_EMIT_HEXDUMP(severity, ptr, len)                                                       \
+        log_hexdump(severity, LOG_CURRENT_MODULE, LOG_CURRENT_FUNC, __LINE__, ptr, len)
+#endif // LOGGER_DEFERRED
+
 /*!
- * @brief Logs an ERROR-level message.
+ * @brief Logs a binary buffer as a hex dump if the severity passes the level filters.
+ *
+ * In deferred mode the raw bytes are sent and the host decoder renders the hex dump. In interrupt
+ * context in the blocking and RTOS modes, every line takes a staging slot: only the first
+ * LOG_ISR_SLOTS - 2 rows are dumped, followed by a line with the number of bytes left out.
+ *
+ * @example
+ * LOG_HEXDUMP(LOG_LEVEL_DEBUG, frame.data, frame.dlc);
  */
-#define LOG_ERROR(fmt, ...)                                                                        \
+#define LOG_HEXDUMP(severity, ptr, len)                                                            \
         do                                                                                         \
         {                                                                                          \
-            if (CHECK_LOG_LEVEL(LOG_LEVEL_ERROR))                                                  \
+            if (LOG_ENABLED(severity))                                                             \
             {                                                                                      \
-                char msg[LOG_BUFFER_SIZE];                                                         \
-                (void) snprintf(msg, LOG_BUFFER_SIZE, KRED "[ERR][%s:%d]: " KNRM fmt, __func__,    \
-                                __LINE__, ##__VA_ARGS__);                                          \
-                HAL_UART_Transmit(&huart1, (uint8_t *) msg, strlen(msg), HAL_MAX_DELAY);           \
+                LOG_EMIT_HEXDUMP(severity, ptr, len);                                              \
             }                                                                                      \
         } while (0)
 
-#endif // MODULE_REGISTRED
+/*!
+ * @brief Logs a raw, unformatted message without severity or color codes.
+ */
+#if LOGGER_DEFERRED
+#define LOG_RAW(fmt, ...) LOG_DEFERRED(LOG_SITE_RAW, NULL, fmt, ##__VA_ARGS__)
+#else
+#define LOG_RAW(fmt, ...) log_raw(fmt, ##__VA_ARGS__)
+#endif
+
+/*!
+ * @brief Logs a DEBUG-level message.
+ */
+#define LOG_DEBUG(fmt, ...) LOG_AT_LEVEL(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+/*!
+ * @brief Logs an INFO-level message.
+ */
+#define LOG_INFO(fmt, ...) LOG_AT_LEVEL(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+
+/*!
+ * @brief Logs a WARNING-level message.
+ */
+#define LOG_WARNING(fmt, ...) LOG_AT_LEVEL(LOG_LEVEL_WARNING, fmt, ##__VA_ARGS__)
+
+/*!
+ * @brief Logs an ERROR-level message.
+ */
+#define LOG_ERROR(fmt, ...) LOG_AT_LEVEL(LOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+
+/*!
+ * @brief Rate-limited variants of the leveled macros, see LOG_AT_LEVEL_RATELIMIT().
+ *
+ * @example
+ * // At most 5 lines per second, even if the fault repeats in a tight loop.
+ * LOG_WARNING_RATELIMIT(5, "CRC error on frame %u\r\n", frame);
+ */
+#define LOG_DEBUG_RATELIMIT(per_sec, fmt, ...)                                                     \
+        LOG_AT_LEVEL_RATELIMIT(LOG_LEVEL_DEBUG, per_sec, fmt, ##__VA_ARGS__)
+#define LOG_INFO_RATELIMIT(per_sec, fmt, ...)                                                      \
+        LOG_AT_LEVEL_RATELIMIT(LOG_LEVEL_INFO, per_sec, fmt, ##__VA_ARGS__)
+#define LOG_WARNING_RATELIMIT(per_sec, fmt, ...)                                                   \
+        LOG_AT_LEVEL_RATELIMIT(LOG_LEVEL_WARNING, per_sec, fmt, ##__VA_ARGS__)
+#define LOG_ERROR_RATELIMIT(per_sec, fmt, ...)                                                     \
+        LOG_AT_LEVEL_RATELIMIT(LOG_LEVEL_ERROR, per_sec, fmt, ##__VA_ARGS__)
+
+/* =======================================================================
+ * [COMPILE-TIME LEVEL FILTER]
+ * =======================================================================
+ */
+
+#if LOG_LEVEL_COMPILE_MIN > 0
+#undef LOG_DEBUG
+#undef LOG_DEBUG_RATELIMIT
+#define LOG_DEBUG(fmt, ...)                  LOG_DISCARD(fmt, ##__VA_ARGS__)
+#define LOG_DEBUG_RATELIMIT(per_sec, fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL_COMPILE_MIN > 1
+#undef LOG_INFO
+#undef LOG_INFO_RATELIMIT
+#define LOG_INFO(fmt, ...)                  LOG_DISCARD(fmt, ##__VA_ARGS__)
+#define LOG_INFO_RATELIMIT(per_sec, fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL_COMPILE_MIN > 2
+#undef LOG_WARNING
+#undef LOG_WARNING_RATELIMIT
+#define LOG_WARNING(fmt, ...)                  LOG_DISCARD(fmt, ##__VA_ARGS__)
+#define LOG_WARNING_RATELIMIT(per_sec, fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
+
+#if LOG_LEVEL_COMPILE_MIN > 3
+#undef LOG_ERROR
+#undef LOG_ERROR_RATELIMIT
+#define LOG_ERROR(fmt, ...)                  LOG_DISCARD(fmt, ##__VA_ARGS__)
+#define LOG_ERROR_RATELIMIT(per_sec, fmt, ...) LOG_DISCARD(fmt, ##__VA_ARGS__)
+#endif
 
 #endif /* LOGGER_H */
 
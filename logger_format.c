@@ -0,0 +1,602 @@
+/** @file logger_format.c
+ *
+ * @brief Lightweight printf-style formatter used by the logging macros.
+ *
+ * @author Ignacio Brittez
+ *
+ * A small replacement for `snprintf()`, selected with `LOGGER_FORMATTER_BUILTIN`. It avoids
+ * pulling newlib's printf family into the image and uses only a few dozen bytes of stack.
+ *
+ * Supported conversions: `%d %i %u %x %X %o %c %s %p %%` and fixed-point `%f` (at most 9
+ * decimals, `%e`/`%g` are printed as `%f`). Flags `- 0 + space #`, field width and precision,
+ * both also as `*`, and the length modifiers `hh h l ll z j t` are honored. 32-bit values never
+ * use 64-bit division.
+ */
+
+/* =======================================================================
+ * [INCLUDES]
+ * =======================================================================
+ */
+
+#include <float.h>
+#include "logger.h"
+
+/* =======================================================================
+ * [PRIVATE TYPES]
+ * =======================================================================
+ */
+
+/*!
+ * @brief Output cursor: counts every character, stores only what fits.
+ */
+typedef struct
+{
+    char *buf;   //!< Destination buffer
+    size_t size; //!< Destination size, including the terminator
+    size_t pos;  //!< Number of characters produced so far
+} log_fmt_out_t;
+
+/*!
+ * @brief Parsed conversion specification.
+ */
+typedef struct
+{
+    uint8_t left;  //!< '-' flag: left-justify
+    uint8_t zero;  //!< '0' flag: pad numbers with zeros
+    char sign;     //!< '+' or ' ' flag, 0 if none
+    uint8_t alt;   //!< '#' flag: 0x/0 prefix
+    int width;     //!< Minimum field width
+    int precision; //!< Precision, -1 if not given
+} log_fmt_spec_t;
+
+/* =======================================================================
+ * [PRIVATE FUNCTIONS]
+ * =======================================================================
+ */
+
+static inline void log_fmt_putc(log_fmt_out_t *out, char c)
+{
+    if (out->pos + 1 < out->size)
+    {
+        out->buf[out->pos] = c;
+    }
+
+    out->pos++;
+}
+
+static void log_fmt_fill(log_fmt_out_t *out, char c, int count)
+{
+    while (count-- > 0)
+    {
+        log_fmt_putc(out, c);
+    }
+}
+
+/*!
+ * @brief Writes `len` characters of `str` padded to the field width.
+ */
+static void log_fmt_str(log_fmt_out_t *out, const log_fmt_spec_t *spec, const char *str, int len)
+{
+    if (!spec->left)
+    {
+        log_fmt_fill(out, ' ', spec->width - len);
+    }
+
+    for (int i = 0; i < len; i++)
+    {
+        log_fmt_putc(out, str[i]);
+    }
+
+    if (spec->left)
+    {
+        log_fmt_fill(out, ' ', spec->width - len);
+    }
+}
+
+/*!
+ * @brief Converts an unsigned value to digits, stored backwards from `end`.
+ *
+ * @return Pointer to the first digit.
+ */
+static char *log_fmt_utoa(char *end, uint64_t value, unsigned base, uint8_t upper)
+{
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+
+    // Cortex-M3 has no 64-bit divide instruction: stay in 32 bits whenever possible.
+    if (value <= UINT32_MAX)
+    {
+        uint32_t v = (uint32_t) value;
+
+        do
+        {
+            *--end = digits[v % base];
+            v /= base;
+        } while (v != 0);
+
+        return end;
+    }
+
+    do
+    {
+        *--end = digits[value % base];
+        value /= base;
+    } while (value != 0);
+
+    return end;
+}
+
+/*!
+ * @brief Writes an integer with sign, prefix, precision and padding.
+ */
+static void log_fmt_int(log_fmt_out_t *out, const log_fmt_spec_t *spec, uint64_t value,
+                        uint8_t negative, unsigned base, uint8_t upper)
+{
+    char tmp[24];
+    char *end = tmp + sizeof(tmp);
+    char *digits = end;
+    const char *prefix = "";
+
+    // "%.0d" of zero prints no digits at all.
+    if (!(value == 0 && spec->precision == 0))
+    {
+        digits = log_fmt_utoa(end, value, base, upper);
+    }
+
+    int ndigits = (int) (end - digits);
+    int nzeros = (spec->precision > ndigits) ? spec->precision - ndigits : 0;
+
+    if (negative)
+    {
+        prefix = "-";
+    }
+    else if (spec->sign == '+')
+    {
+        prefix = "+";
+    }
+    else if (spec->sign == ' ')
+    {
+        prefix = " ";
+    }
+
+    if (spec->alt && value != 0)
+    {
+        if (base == 16)
+        {
+            prefix = upper ? "0X" : "0x";
+        }
+        else if (base == 8 && nzeros == 0)
+        {
+            prefix = "0";
+        }
+    }
+
+    int nprefix = (int) strlen(prefix);
+    int total = nprefix + nzeros + ndigits;
+
+    if (spec->zero && !spec->left && spec->precision < 0 && spec->width > total)
+    {
+        nzeros += spec->width - total;
+        total = spec->width;
+    }
+
+    if (!spec->left)
+    {
+        log_fmt_fill(out, ' ', spec->width - total);
+    }
+
+    while (*prefix)
+    {
+        log_fmt_putc(out, *prefix++);
+    }
+
+    log_fmt_fill(out, '0', nzeros);
+
+    while (digits < end)
+    {
+        log_fmt_putc(out, *digits++);
+    }
+
+    if (spec->left)
+    {
+        log_fmt_fill(out, ' ', spec->width - total);
+    }
+}
+
+/*!
+ * @brief Writes a double in fixed-point notation, computed with integer arithmetic.
+ */
+static void log_fmt_fixed(log_fmt_out_t *out, const log_fmt_spec_t *spec, double value)
+{
+    static const uint32_t pow10[] = {1,      10,      100,      1000,      10000,
+                                     100000, 1000000, 10000000, 100000000, 1000000000};
+    int precision = (spec->precision < 0) ? 6 : spec->precision;
+
+    if (precision > 9)
+    {
+        precision = 9;
+    }
+
+    if (value != value)
+    {
+        log_fmt_str(out, spec, "nan", 3);
+        return;
+    }
+
+    uint8_t negative = (value < 0);
+
+    if (negative)
+    {
+        value = -value;
+    }
+
+    if (value > DBL_MAX)
+    {
+        log_fmt_str(out, spec, negative ? "-inf" : "inf", negative ? 4 : 3);
+        return;
+    }
+
+    // Past 2^53 every double is an integer. Beyond 1e19 the integer part no longer fits in
+    // 64 bits: scale it down and print the dropped powers of ten as zeros.
+    int exp10 = 0;
+
+    while (value >= 1e19)
+    {
+        value /= 10;
+        exp10++;
+    }
+
+    uint32_t scale = pow10[precision];
+    uint64_t ipart = (uint64_t) value;
+    uint32_t fpart = exp10 ? 0 : (uint32_t) ((value - (double) ipart) * scale + 0.5);
+
+    if (fpart >= scale)
+    {
+        ipart++;
+        fpart -= scale;
+    }
+
+    char tmp[40];
+    char *end = tmp + sizeof(tmp);
+    char *p = end;
+
+    if (precision > 0)
+    {
+        char *frac = log_fmt_utoa(end, fpart, 10, 0);
+
+        while (end - frac < precision)
+        {
+            *--frac = '0';
+        }
+
+        p = frac;
+        *--p = '.';
+    }
+    else if (spec->alt)
+    {
+        *--p = '.';
+    }
+
+    char *point = p;
+    char sign = negative ? '-' : spec->sign;
+
+    p = log_fmt_utoa(p, ipart, 10, 0);
+
+    int len = (int) (end - p) + exp10 + (sign != 0);
+    int pad = (spec->width > len) ? spec->width - len : 0;
+
+    if (!spec->left && !spec->zero)
+    {
+        log_fmt_fill(out, ' ', pad);
+    }
+
+    if (sign)
+    {
+        log_fmt_putc(out, sign);
+    }
+
+    // Zeros go between the sign and the digits.
+    if (!spec->left && spec->zero)
+    {
+        log_fmt_fill(out, '0', pad);
+    }
+
+    while (p < point)
+    {
+        log_fmt_putc(out, *p++);
+    }
+
+    log_fmt_fill(out, '0', exp10);
+
+    while (p < end)
+    {
+        log_fmt_putc(out, *p++);
+    }
+
+    if (spec->left)
+    {
+        log_fmt_fill(out, ' ', pad);
+    }
+}
+
+/* =======================================================================
+ * [PUBLIC FUNCTIONS]
+ * =======================================================================
+ */
+
+int log_vsnprintf(char *buf, size_t size, const char *fmt, va_list ap)
+{
+    log_fmt_out_t out = {buf, size, 0};
+
+    while (*fmt)
+    {
+        if (*fmt != '%')
+        {
+            log_fmt_putc(&out, *fmt++);
+            continue;
+        }
+
+        fmt++;
+
+        log_fmt_spec_t spec = {0, 0, 0, 0, 0, -1};
+
+        for (;; fmt++)
+        {
+            if (*fmt == '-')
+            {
+                spec.left = 1;
+            }
+            else if (*fmt == '0')
+            {
+                spec.zero = 1;
+            }
+            else if (*fmt == '+' || (*fmt == ' ' && spec.sign != '+'))
+            {
+                spec.sign = *fmt;
+            }
+            else if (*fmt == '#')
+            {
+                spec.alt = 1;
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        if (*fmt == '*')
+        {
+            spec.width = va_arg(ap, int);
+            fmt++;
+
+            if (spec.width < 0)
+            {
+                spec.left = 1;
+                spec.width = -spec.width;
+            }
+        }
+        else
+        {
+            while (*fmt >= '0' && *fmt <= '9')
+            {
+                spec.width = spec.width * 10 + (*fmt++ - '0');
+            }
+        }
+
+        if (*fmt == '.')
+        {
+            fmt++;
+            spec.precision = 0;
+
+            if (*fmt == '*')
+            {
+                spec.precision = va_arg(ap, int);
+                fmt++;
+
+                if (spec.precision < 0)
+                {
+                    spec.precision = -1;
+                }
+            }
+            else
+            {
+                while (*fmt >= '0' && *fmt <= '9')
+                {
+                    spec.precision = spec.precision * 10 + (*fmt++ - '0');
+                }
+            }
+        }
+
+        // Length modifier: 0 = int, 1 = long, 2 = long long, 3 = size_t/ptrdiff_t, 4 = intmax_t,
+        // 5 = short, 6 = char.
+        uint8_t length = 0;
+
+        if (*fmt == 'h')
+        {
+            length = (fmt[1] == 'h') ? 6 : 5;
+            fmt += (length == 6) ? 2 : 1;
+        }
+        else if (*fmt == 'l')
+        {
+            length = (fmt[1] == 'l') ? 2 : 1;
+            fmt += length;
+        }
+        else if (*fmt == 'z' || *fmt == 't')
+        {
+            length = 3;
+            fmt++;
+        }
+        else if (*fmt == 'j')
+        {
+            length = 4;
+            fmt++;
+        }
+
+        char conv = *fmt;
+
+        if (conv == '\0')
+        {
+            break;
+        }
+
+        fmt++;
+
+        switch (conv)
+        {
+        case 'd':
+        case 'i':
+        {
+            int64_t v;
+
+            if (length == 2)
+            {
+                v = va_arg(ap, long long);
+            }
+            else if (length == 4)
+            {
+                v = va_arg(ap, intmax_t);
+            }
+            else if (length == 3)
+            {
+                v = va_arg(ap, ptrdiff_t);
+            }
+            else if (length == 1)
+            {
+                v = va_arg(ap, long);
+            }
+            else if (length == 5)
+            {
+                v = (short) va_arg(ap, int);
+            }
+            else if (length == 6)
+            {
+                v = (signed char) va_arg(ap, int);
+            }
+            else
+            {
+                v = va_arg(ap, int);
+            }
+
+            uint64_t magnitude = (v < 0) ? (uint64_t) 0 - (uint64_t) v : (uint64_t) v;
+            log_fmt_int(&out, &spec, magnitude, v < 0, 10, 0);
+            break;
+        }
+
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        {
+            uint64_t v;
+
+            if (length == 2)
+            {
+                v = va_arg(ap, unsigned long long);
+            }
+            else if (length == 4)
+            {
+                v = va_arg(ap, uintmax_t);
+            }
+            else if (length == 3)
+            {
+                v = va_arg(ap, size_t);
+            }
+            else if (length == 1)
+            {
+                v = va_arg(ap, unsigned long);
+            }
+            else if (length == 5)
+            {
+                v = (unsigned short) va_arg(ap, unsigned int);
+            }
+            else if (length == 6)
+            {
+                v = (unsigned char) va_arg(ap, unsigned int);
+            }
+            else
+            {
+                v = va_arg(ap, unsigned int);
+            }
+
+            unsigned base = (conv == 'u') ? 10 : (conv == 'o') ? 8 : 16;
+            log_fmt_int(&out, &spec, v, 0, base, conv == 'X');
+            break;
+        }
+
+        case 'p':
+        {
+            log_fmt_spec_t ptr = {0, 1, 0, 0, 0, -1};
+
+            log_fmt_putc(&out, '0');
+            log_fmt_putc(&out, 'x');
+            ptr.width = (int) (2 * sizeof(void *));
+            log_fmt_int(&out, &ptr, (uintptr_t) va_arg(ap, void *), 0, 16, 0);
+            break;
+        }
+
+        case 'c':
+        {
+            char c = (char) va_arg(ap, int);
+            log_fmt_str(&out, &spec, &c, 1);
+            break;
+        }
+
+        case 's':
+        {
+            const char *str = va_arg(ap, const char *);
+            int len = 0;
+
+            if (str == NULL)
+            {
+                str = "(null)";
+            }
+
+            while (str[len] != '\0' && (spec.precision < 0 || len < spec.precision))
+            {
+                len++;
+            }
+
+            log_fmt_str(&out, &spec, str, len);
+            break;
+        }
+
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+            log_fmt_fixed(&out, &spec, va_arg(ap, double));
+            break;
+
+        case '%':
+            log_fmt_putc(&out, '%');
+            break;
+
+        default:
+            // Unknown conversion: print it verbatim.
+            log_fmt_putc(&out, '%');
+            log_fmt_putc(&out, conv);
+            break;
+        }
+    }
+
+    if (size != 0)
+    {
+        buf[(out.pos < size) ? out.pos : size - 1] = '\0';
+    }
+
+    return (int) out.pos;
+}
+
+int log_snprintf(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    int len = log_vsnprintf(buf, size, fmt, ap);
+    va_end(ap);
+
+    return len;
+}
+
+/*** end of file ***/
@@ -4,9 +4,14 @@
  *
  * It provides:
  *  - `LOG_MODULE_REGISTER()` to create a module-specific logger.
+ *  - `LOG_MODULE_REGISTER_CONST()` to create one whose level is fixed at build time.
+ *  - `LOG_MODULE_REGISTER_ON()` to create one that logs to another output channel.
  *  - `LOG_MODULE_DECLARE()` to reference and use an already registered module.
  *  - `LOG_MODULE_EXTERN()` to reference other modules without altering the current one.
  *  - `LOG_MODULE_SET_LEVEL()` to dynamically change a module’s log level at runtime.
+ *  - A registry of every registered module (`LOG_MODULE_COUNT()`, `LOG_MODULE_GET()`,
+ *    `LOG_MODULE_FIND()`) and a small command shell to list and set module levels over UART
+ *    (`LOGGER_SHELL_RX()`), implemented in `logger_shell.c`.
  *
  * @note
  *  - Always include this header instead of `logger.h` if you plan to use module-based logging.
@@ -25,30 +30,51 @@
 #include "logger.h"
 
 /* =======================================================================
- * [TYPEDEF]
+ * [MACROS]
  * ======================================================================= */
 
 /**
- * @brief Logging instance for a specific module.
+ * @brief Linker section holding a pointer to every registered module.
+ *
+ * The name is a valid C identifier so the linker provides `__start_` and `__stop_` symbols
+ * around it. It only contains constant pointers, so it is placed in flash with no linker script
+ * change.
  */
-typedef struct
-{
-    const char *name;  /**< Module name (used as log prefix). */
-    log_level_t level; /**< Minimum severity level to log for this module. */
-} log_instance_t;
+#define LOG_MODULE_SECTION logger_modules
 
-/* =======================================================================
- * [MACROS]
- * ======================================================================= */
+#define LOG_MODULE_STR_(x) #x
+#define LOG_MODULE_STR(x)  LOG_MODULE_STR_(x)
+
+/**
+ * @brief Helper macros, return the optional argument if given, `def` otherwise.
+ */
+#define LOG_OPT_ARG(def, ...)    LOG_OPT_ARG_(0, ##__VA_ARGS__, def)
+#define LOG_OPT_ARG_(_0, a, ...) a
+
+/**
+ * @brief Helper macro, checks a severity against the module's compile-time threshold.
+ *
+ * The threshold is a constant, so disabled messages are folded away by the compiler.
+ */
+#define LOG_MODULE_COMPILE_ENABLED(severity)                                                       \
+    ((int) (severity) >= (int) CURRENT_LOG_MODULE_COMPILE_MIN)
+
+/**
+ * @brief Helper macro, the higher of a constant module level and `LOG_LEVEL_COMPILE_MIN`.
+ */
+#define LOG_MODULE_CONST_MIN(level)                                                                \
+    ((int) (level) > LOG_LEVEL_COMPILE_MIN ? (int) (level) : LOG_LEVEL_COMPILE_MIN)
 
 /**
  * @brief Registers a log instance for the current module.
  *
- * Defines a static `log_instance_t` named `log_inst_<name>` and sets
- * `CURRENT_LOG_MODULE` to point to it.
+ * Defines a static `log_instance_t` named `log_inst_<name>`, adds it to the module registry and
+ * sets `CURRENT_LOG_MODULE` to point to it.
  *
  * @param name  Identifier name of the module (used as log prefix).
  * @param level Initial minimum severity level for this module.
+ * @param ...   Optional compile-time minimum severity for this file. Messages below it are
+ *              removed from the image. Defaults to `LOG_LEVEL_COMPILE_MIN`.
  *
  * @warning
  *  - A module must only be registered once.
@@ -57,10 +83,73 @@ typedef struct
  * @example
  * // Register the device01 logging module.
  * LOG_MODULE_REGISTER(device01, LOG_LEVEL_DEBUG);
+ *
+ * // Register the device02 logging module, without DEBUG messages in the image.
+ * LOG_MODULE_REGISTER(device02, LOG_LEVEL_INFO, LOG_LEVEL_INFO);
  */
-#define LOG_MODULE_REGISTER(name, level)                                                           \
-    log_instance_t log_inst_##name = {#name, level};                                               \
-    static log_instance_t *const CURRENT_LOG_MODULE = &log_inst_##name
+#define LOG_MODULE_REGISTER(name, level, ...)                                                      \
+    LOG_MODULE_REGISTER_ON(name, LOG_CHANNEL_CONSOLE, level, ##__VA_ARGS__)
+
+/**
+ * @brief Registers a log instance bound to an output channel.
+ *
+ * Same as LOG_MODULE_REGISTER(), but the messages of the module go to `channel` instead of the
+ * console. Its threshold combines the module level with the channel level (set by
+ * LOGGER_CHANNEL_INIT()) instead of the global level, and it stays silent until the channel is
+ * initialized.
+ *
+ * @param name    Identifier name of the module (used as log prefix).
+ * @param channel Channel number, a constant below LOG_MAX_CHANNELS.
+ * @param level   Initial minimum severity level for this module.
+ * @param ...     Optional compile-time minimum severity for this file.
+ *
+ * @example
+ * // The radio traces go to channel 1, e.g. a second UART, instead of the console.
+ * LOG_MODULE_REGISTER_ON(radio, 1, LOG_LEVEL_DEBUG);
+ */
+#define LOG_MODULE_REGISTER_ON(name, channel, level, ...)                                          \
+    _Static_assert((channel) < LOG_MAX_CHANNELS, "LOG_MODULE_REGISTER_ON(): no such channel");     \
+    log_instance_t log_inst_##name = {                                                             \
+        #name, level, 0, ((channel) == LOG_CHANNEL_CONSOLE) ? (level) : LOG_LEVEL_OFF, (channel),  \
+        0};                                                                                        \
+    static log_instance_t *const log_entry_##name                                                  \
+        __attribute__((section(LOG_MODULE_STR(LOG_MODULE_SECTION)), used)) = &log_inst_##name;     \
+    enum                                                                                           \
+    {                                                                                              \
+        CURRENT_LOG_MODULE_COMPILE_MIN = LOG_OPT_ARG(LOG_LEVEL_COMPILE_MIN, ##__VA_ARGS__),        \
+        CURRENT_LOG_MODULE_FIXED = 0                                                               \
+    };                                                                                             \
+    static log_instance_t *const CURRENT_LOG_MODULE __attribute__((unused)) = &log_inst_##name
+
+/**
+ * @brief Registers a module whose level is a compile-time constant.
+ *
+ * The instance is `const` and lives in flash: it uses no RAM, and the logging macros compare the
+ * severity against `level` at compile time, so the module check costs nothing at runtime and
+ * disabled messages are removed from the image. The global level still applies.
+ *
+ * The module is listed in the registry, but LOG_MODULE_SET_LEVEL() and the shell leave its level
+ * unchanged. It always logs to the console. Use LOG_MODULE_REGISTER() for modules that need
+ * runtime control.
+ *
+ * @param name  Identifier name of the module (used as log prefix).
+ * @param level Fixed minimum severity level for this module.
+ *
+ * @example
+ * // The bootloader only ever reports warnings and errors.
+ * LOG_MODULE_REGISTER_CONST(boot, LOG_LEVEL_WARNING);
+ */
+#define LOG_MODULE_REGISTER_CONST(name, level)                                                     \
+    const log_instance_t log_inst_##name = {#name, level, 1, level, LOG_CHANNEL_CONSOLE, 0};       \
+    static log_instance_t *const log_entry_##name                                                  \
+        __attribute__((section(LOG_MODULE_STR(LOG_MODULE_SECTION)), used)) =                       \
+            (log_instance_t *) &log_inst_##name;                                                   \
+    enum                                                                                           \
+    {                                                                                              \
+        CURRENT_LOG_MODULE_COMPILE_MIN = LOG_MODULE_CONST_MIN(level),                              \
+        CURRENT_LOG_MODULE_FIXED = 1                                                               \
+    };                                                                                             \
+    static const log_instance_t *const CURRENT_LOG_MODULE __attribute__((unused)) = &log_inst_##name
 
 /**
  * @brief Declares an existing log instance defined elsewhere.
@@ -71,14 +160,46 @@ typedef struct
  * Also sets `CURRENT_LOG_MODULE` so all `LOG_*` macros use the declared instance.
  *
  * @param name Name of the previously defined module log instance.
+ * @param ...  Optional compile-time minimum severity for this file, as in LOG_MODULE_REGISTER().
  *
  * @example
  * // Set the current source file's logging module to the already defined device01 module.
  * LOG_MODULE_DECLARE(device01);
  */
-#define LOG_MODULE_DECLARE(name)                                                                   \
+#define LOG_MODULE_DECLARE(name, ...)                                                              \
     extern log_instance_t log_inst_##name;                                                         \
-    static log_instance_t *const CURRENT_LOG_MODULE = &log_inst_##name
+    enum                                                                                           \
+    {                                                                                              \
+        CURRENT_LOG_MODULE_COMPILE_MIN = LOG_OPT_ARG(LOG_LEVEL_COMPILE_MIN, ##__VA_ARGS__),        \
+        CURRENT_LOG_MODULE_FIXED = 0                                                               \
+    };                                                                                             \
+    static log_instance_t *const CURRENT_LOG_MODULE __attribute__((unused)) = &log_inst_##name
+
+/**
+ * @brief Declares a LOG_MODULE_REGISTER_CONST() module defined elsewhere.
+ *
+ * @param name  Name of the module.
+ * @param level Its fixed level. It must match the registration: share it through a macro in the
+ *              module's header.
+ *
+ * @example
+ * // boot.h
+ * #define BOOT_LOG_LEVEL LOG_LEVEL_WARNING
+ *
+ * // boot.c
+ * LOG_MODULE_REGISTER_CONST(boot, BOOT_LOG_LEVEL);
+ *
+ * // boot_flash.c
+ * LOG_MODULE_DECLARE_CONST(boot, BOOT_LOG_LEVEL);
+ */
+#define LOG_MODULE_DECLARE_CONST(name, level)                                                      \
+    extern const log_instance_t log_inst_##name;                                                   \
+    enum                                                                                           \
+    {                                                                                              \
+        CURRENT_LOG_MODULE_COMPILE_MIN = LOG_MODULE_CONST_MIN(level),                              \
+        CURRENT_LOG_MODULE_FIXED = 1                                                               \
+    };                                                                                             \
+    static const log_instance_t *const CURRENT_LOG_MODULE __attribute__((unused)) = &log_inst_##name
 
 /**
  * @brief Returns a pointer to a named log instance.
@@ -98,6 +219,9 @@ typedef struct
 /**
  * @brief Sets the minimum severity level for a log instance.
  *
+ * Modules registered with LOG_MODULE_REGISTER_CONST() are left unchanged (their
+ * LOG_MODULE_NAME() is a pointer to const, so passing it directly does not even compile).
+ *
  * @param[in,out] inst  Pointer to the log instance.
  * @param[in]     level New severity level to assign.
  *
@@ -110,9 +234,10 @@ typedef struct
  */
 static inline void LOG_MODULE_SET_LEVEL(log_instance_t *inst, log_level_t level)
 {
-    if (inst)
+    if (inst && !inst->fixed)
     {
         inst->level = level;
+        inst->threshold = log_module_threshold(level, inst->channel);
     }
 }
 
@@ -134,6 +259,78 @@ static inline void LOG_MODULE_SET_LEVEL(log_instance_t *inst, log_level_t level)
  */
 #define LOG_MODULE_EXTERN(name) extern log_instance_t log_inst_##name
 
+/* =======================================================================
+ * [MODULE REGISTRY]
+ * ======================================================================= */
+
+/** @brief Size of the command line buffer of the logger shell. */
+#ifndef LOG_SHELL_LINE_SIZE
+#define LOG_SHELL_LINE_SIZE 32
+#endif
+
+/**
+ * @brief Returns the number of registered modules.
+ */
+size_t LOG_MODULE_COUNT(void);
+
+/**
+ * @brief Returns a registered module by ID, the module's index in the registry.
+ *
+ * IDs follow the link order, so they are stable for a given firmware image.
+ *
+ * @param id Module ID, from 0 to LOG_MODULE_COUNT() - 1.
+ * @return Pointer to the module, or NULL if `id` is out of range.
+ */
+log_instance_t *LOG_MODULE_GET(size_t id);
+
+/**
+ * @brief Looks up a registered module by name.
+ *
+ * @param name Module name, as given to LOG_MODULE_REGISTER().
+ * @return Pointer to the module, or NULL if no module has that name.
+ */
+log_instance_t *LOG_MODULE_FIND(const char *name);
+
+/**
+ * @brief Runs one logger shell command. Replies are written with LOG_RAW().
+ *
+ * Commands:
+ *  - `log list`: lists every module with its ID and level (and channel, with LOG_MAX_CHANNELS).
+ *  - `log set <name|id> <level>`: sets a module level.
+ *  - `log global <level>`: sets the global level (`off` is not accepted).
+ *
+ * Levels are given as `dbg`, `inf`, `wrn`, `err`, `off`, or as a number.
+ *
+ * @param line Null-terminated command line.
+ *
+ * @example
+ * // From the application's own command interpreter:
+ * LOGGER_SHELL_EXEC("log set device01 dbg");
+ */
+void LOGGER_SHELL_EXEC(const char *line);
+
+/**
+ * @brief Feeds one received character to the logger shell.
+ *
+ * Safe to call from the UART receive interrupt. A line is complete on `\r` or `\n`, and is run by
+ * the next LOGGER_SHELL_PROCESS() call.
+ *
+ * @example
+ * void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+ * {
+ *     LOGGER_SHELL_RX(rx_byte);
+ *     HAL_UART_Receive_IT(huart, &rx_byte, 1);
+ * }
+ */
+void LOGGER_SHELL_RX(uint8_t c);
+
+/**
+ * @brief Runs the command line completed by LOGGER_SHELL_RX(), if any.
+ *
+ * @note Thread context only, e.g. from the main loop.
+ */
+void LOGGER_SHELL_PROCESS(void);
+
 #endif /* LOGGER_MODULE_H */
 
 /*** end of file ***/
@@ -0,0 +1,314 @@
+/** @file logger_shell.c
+ *
+ * @brief Module registry and runtime level shell of the logging module.
+ *
+ * @author Ignacio Brittez
+ *
+ * Every LOG_MODULE_REGISTER() adds a pointer to its `log_instance_t` to the `logger_modules`
+ * linker section. The section is the registry: module IDs are indices into it, so looking a module
+ * up by ID is a single load.
+ *
+ * On top of the registry, a tiny line-based shell lets a terminal list the modules and change
+ * their levels at runtime, without reflashing:
+ *
+ *     log list
+ *     log set device01 dbg
+ *     log set 3 off
+ *     log global wrn
+ */
+
+/* =======================================================================
+ * [INCLUDES]
+ * =======================================================================
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include "logger_module.h"
+
+/* =======================================================================
+ * [EXTERNAL DATA DECLARATION]
+ * =======================================================================
+ */
+
+// Provided by the linker; weak so that an image without modules still links.
+extern log_instance_t *const __start_logger_modules[] __attribute__((weak));
+extern log_instance_t *const __stop_logger_modules[] __attribute__((weak));
+
+/* =======================================================================
+ * [PRIVATE DATA]
+ * =======================================================================
+ */
+
+static const char *const kLevelName[LOG_LEVEL_COUNT] = {"dbg", "inf", "wrn", "err"};
+
+static char sLine[LOG_SHELL_LINE_SIZE]; //!< Line being received
+static volatile size_t sLineLen;        //!< Characters in `sLine`
+static volatile uint8_t sLineReady;     //!< A complete line waits for LOGGER_SHELL_PROCESS()
+
+/* =======================================================================
+ * [PRIVATE FUNCTIONS]
+ * =======================================================================
+ */
+
+static const char *log_level_name(log_level_t level)
+{
+    return (level < LOG_LEVEL_COUNT) ? kLevelName[level] : "off";
+}
+
+/*!
+ * @brief Parses a level name or number.
+ *
+ * @return 0 on success, -1 if `str` is not a level.
+ */
+static int log_parse_level(const char *str, log_level_t *level)
+{
+    if (strcmp(str, "off") == 0)
+    {
+        *level = LOG_LEVEL_OFF;
+        return 0;
+    }
+
+    for (int i = 0; i < LOG_LEVEL_COUNT; i++)
+    {
+        if (strcmp(str, kLevelName[i]) == 0)
+        {
+            *level = (log_level_t) i;
+            return 0;
+        }
+    }
+
+    if (str[0] >= '0' && str[0] < '0' + LOG_LEVEL_COUNT && str[1] == '\0')
+    {
+        *level = (log_level_t) (str[0] - '0');
+        return 0;
+    }
+
+    return -1;
+}
+
+/*!
+ * @brief Looks up a module by ID (all digits) or by name.
+ */
+static log_instance_t *log_parse_module(const char *str)
+{
+    char *end;
+    unsigned long id = strtoul(str, &end, 10);
+
+    if (end != str && *end == '\0')
+    {
+        return LOG_MODULE_GET((size_t) id);
+    }
+
+    return LOG_MODULE_FIND(str);
+}
+
+/*!
+ * @brief Splits a command line in place into at most `max` space-separated words.
+ *
+ * @return Number of words, or `max + 1` if the line has more: `argv` then holds the first `max`.
+ */
+static int log_split(char *line, char **argv, int max)
+{
+    int argc = 0;
+
+    for (;;)
+    {
+        while (isspace((unsigned char) *line))
+        {
+            *line++ = '\0';
+        }
+
+        if (*line == '\0')
+        {
+            return argc;
+        }
+
+        if (argc == max)
+        {
+            return max + 1;
+        }
+
+        argv[argc++] = line;
+
+        while (*line && !isspace((unsigned char) *line))
+        {
+            line++;
+        }
+    }
+}
+
+/* =======================================================================
+ * [PUBLIC FUNCTIONS]
+ * =======================================================================
+ */
+
+size_t LOG_MODULE_COUNT(void)
+{
+    return (__start_logger_modules == NULL)
+               ? 0
+               : (size_t) (__stop_logger_modules - __start_logger_modules);
+}
+
+log_instance_t *LOG_MODULE_GET(size_t id)
+{
+    return (id < LOG_MODULE_COUNT()) ? __start_logger_modules[id] : NULL;
+}
+
+log_instance_t *LOG_MODULE_FIND(const char *name)
+{
+    size_t count = LOG_MODULE_COUNT();
+
+    for (size_t i = 0; name != NULL && i < count; i++)
+    {
+        if (strcmp(__start_logger_modules[i]->name, name) == 0)
+        {
+            return __start_logger_modules[i];
+        }
+    }
+
+    return NULL;
+}
+
+int log_module_id(const log_instance_t *inst)
+{
+    if (inst == NULL)
+    {
+        return -1;
+    }
+
+    if (inst->id != 0)
+    {
+        return inst->id - 1;
+    }
+
+    size_t count = LOG_MODULE_COUNT();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (__start_logger_modules[i] == inst)
+        {
+            // Writers racing here store the same value.
+            if (!inst->fixed && i < UINT8_MAX)
+            {
+                ((log_instance_t *) inst)->id = (uint8_t) (i + 1);
+            }
+
+            return (int) i;
+        }
+    }
+
+    return -1;
+}
+
+void LOGGER_SHELL_EXEC(const char *line)
+{
+    char buf[LOG_SHELL_LINE_SIZE];
+    char *argv[4];
+    log_level_t level;
+
+    strncpy(buf, line, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    int argc = log_split(buf, argv, 4);
+
+    if (argc == 0 || strcmp(argv[0], "log") != 0)
+    {
+        return;
+    }
+
+    if (argc == 2 && strcmp(argv[1], "list") == 0)
+    {
+        LOG_RAW("global %s\r\n", log_level_name(gLogLevel));
+
+        for (size_t i = 0; i < LOG_MODULE_COUNT(); i++)
+        {
+            const log_instance_t *inst = LOG_MODULE_GET(i);
+#if LOG_MAX_CHANNELS > 1
+            LOG_RAW("%3u %s %s ch%u%s\r\n", (unsigned) i, inst->name, log_level_name(inst->level),
+                    (unsigned) inst->channel, inst->fixed ? " (fixed)" : "");
+#else
+            LOG_RAW("%3u %s %s%s\r\n", (unsigned) i, inst->name, log_level_name(inst->level),
+                    inst->fixed ? " (fixed)" : "");
+#endif
+        }
+    }
+    else if (argc == 4 && strcmp(argv[1], "set") == 0)
+    {
+        log_instance_t *inst = log_parse_module(argv[2]);
+
+        if (inst == NULL)
+        {
+            LOG_RAW("unknown module %s\r\n", argv[2]);
+        }
+        else if (log_parse_level(argv[3], &level) != 0)
+        {
+            LOG_RAW("unknown level %s\r\n", argv[3]);
+        }
+        else if (inst->fixed)
+        {
+            LOG_RAW("%s level is fixed\r\n", inst->name);
+        }
+        else
+        {
+            LOG_MODULE_SET_LEVEL(inst, level);
+            LOG_RAW("%s %s\r\n", inst->name, log_level_name(level));
+        }
+    }
+    else if (argc == 3 && strcmp(argv[1], "global") == 0)
+    {
+        // The global level cannot be turned off, only raised up to ERROR.
+        if (log_parse_level(argv[2], &level) != 0 || level == LOG_LEVEL_OFF)
+        {
+            LOG_RAW("unknown level %s\r\n", argv[2]);
+        }
+        else
+        {
+            LOGGER_SET_LOGGING_LEVEL(level);
+            LOG_RAW("global %s\r\n", log_level_name(level));
+        }
+    }
+    else
+    {
+        LOG_RAW("usage: log list | log set <module|id> <level> | log global <level>\r\n");
+    }
+}
+
+void LOGGER_SHELL_RX(uint8_t c)
+{
+    // The previous line has not been processed yet: ignore input until it is.
+    if (sLineReady)
+    {
+        return;
+    }
+
+    if (c == '\r' || c == '\n')
+    {
+        if (sLineLen > 0)
+        {
+            sLine[sLineLen] = '\0';
+            sLineReady = 1;
+        }
+    }
+    else if ((c == '\b' || c == 0x7F) && sLineLen > 0)
+    {
+        sLineLen--;
+    }
+    else if (sLineLen + 1 < sizeof(sLine) && isprint(c))
+    {
+        sLine[sLineLen++] = (char) c;
+    }
+}
+
+void LOGGER_SHELL_PROCESS(void)
+{
+    if (!sLineReady)
+    {
+        return;
+    }
+
+    LOGGER_SHELL_EXEC(sLine);
+
+    sLineLen = 0;
+    sLineReady = 0;
+}
@@ -0,0 +1,114 @@
+/** @file logger_sink.c
+ *
+ * @brief Optional output sinks of the logging module.
+ *
+ * @author Ignacio Brittez
+ *
+ * Write functions for LOGGER_ADD_SINK(), besides the UART sinks implemented in `logger.c`
+ * (they share its staging slots and DMA rings):
+ *  - log_sink_itm(): an ITM stimulus port, read by the debugger through SWO.
+ *  - log_sink_rtt(): a SEGGER RTT up-buffer (`LOG_SINK_RTT=1`).
+ *  - log_sink_usb_cdc(): the USB CDC device of the CubeMX middleware (`LOG_SINK_USB_CDC=1`).
+ *
+ * SWO and RTT run at memory or trace-port speed, which makes them a better fit than a 115200 baud
+ * UART for high-rate debug traffic.
+ */
+
+/* =======================================================================
+ * [INCLUDES]
+ * =======================================================================
+ */
+
+#include "logger.h"
+
+#if LOG_SINK_RTT
+#include "SEGGER_RTT.h"
+#endif
+
+#if LOG_SINK_USB_CDC
+#include "usbd_cdc_if.h"
+#endif
+
+/* =======================================================================
+ * [EXTERNAL DATA DECLARATION]
+ * =======================================================================
+ */
+
+#if LOG_SINK_USB_CDC
+extern USBD_HandleTypeDef hUsbDeviceFS;
+#endif
+
+/* =======================================================================
+ * [PUBLIC FUNCTIONS]
+ * =======================================================================
+ */
+
+void log_sink_itm(void *ctx, const uint8_t *data, size_t len)
+{
+    uint32_t port = (uint32_t) (uintptr_t) ctx;
+
+    if (port > 31 || (ITM->TCR & ITM_TCR_ITMENA_Msk) == 0 || (ITM->TER & (1UL << port)) == 0)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < len; i++)
+    {
+        uint32_t polls = LOG_ITM_WAIT_POLLS;
+
+        // Interrupts are only masked between the FIFO check and the write of one byte, so that a
+        // handler logging meanwhile cannot fill the FIFO in between.
+        for (;;)
+        {
+            uint32_t primask = __get_PRIMASK();
+            __disable_irq();
+
+            // The port reads as 0 while its FIFO is full.
+            if (ITM->PORT[port].u32 != 0)
+            {
+                ITM->PORT[port].u8 = data[i];
+                __set_PRIMASK(primask);
+                break;
+            }
+
+            __set_PRIMASK(primask);
+
+            // Nobody drains the port: give up on the rest of the message.
+            if (--polls == 0)
+            {
+                return;
+            }
+        }
+    }
+}
+
+#if LOG_SINK_RTT
+
+void log_sink_rtt(void *ctx, const uint8_t *data, size_t len)
+{
+    SEGGER_RTT_Write((unsigned) (uintptr_t) ctx, data, (unsigned) len);
+}
+
+#endif // LOG_SINK_RTT
+
+#if LOG_SINK_USB_CDC
+
+void log_sink_usb_cdc(void *ctx, const uint8_t *data, size_t len)
+{
+    // CDC_Transmit_FS() does not copy the data: it must stay valid until the transfer ends.
+    static uint8_t buf[LOG_BUFFER_SIZE < 256 ? 256 : LOG_BUFFER_SIZE];
+    USBD_CDC_HandleTypeDef *hcdc = (USBD_CDC_HandleTypeDef *) hUsbDeviceFS.pClassData;
+
+    (void) ctx;
+
+    if (hcdc == NULL || hcdc->TxState != 0)
+    {
+        return;
+    }
+
+    len = (len < sizeof(buf)) ? len : sizeof(buf);
+    memcpy(buf, data, len);
+    CDC_Transmit_FS(buf, (uint16_t) len);
+}
+
+#endif // LOG_SINK_USB_CDC
@@ -0,0 +1,352 @@
+/** @file bench_contention.c
+ *
+ * @brief Contention stress test of the lock-free DMA ring, against a critical-section queue.
+ *
+ * @author Ignacio Brittez
+ *
+ * Usage: bench_contention [messages per producer] [task producers]
+ *
+ * Host threads stand for the tasks of the target: each task producer logs its messages as fast as
+ * it can, one more producer does the same from simulated interrupt context, and a consumer thread
+ * completes the DMA transfers. The same load then goes through a reference queue that copies each
+ * message under `__disable_irq()`, drained by the consumer under the same lock.
+ *
+ * For both queues, the latency of every call is measured per producer (host time, mean, 99th
+ * percentile and maximum). With the lock-free ring, the interrupt producer never waits for a task
+ * that masked interrupts (the simulated interrupt lock is only taken by the consumer's completion
+ * interrupt), while with the reference queue every copy excludes it.
+ *
+ * The output of the ring is checked too: every line must arrive whole, and the messages of each
+ * producer in order, except for the ones counted as dropped. The program fails otherwise.
+ */
+
+/* =======================================================================
+ * [INCLUDES]
+ * =======================================================================
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "logger.h"
+
+/* =======================================================================
+ * [PUBLIC DATA]
+ * =======================================================================
+ */
+
+UART_HandleTypeDef huart1;
+
+/* =======================================================================
+ * [PRIVATE DATA]
+ * =======================================================================
+ */
+
+#if LOGGER_OUTPUT_MODE != LOGGER_OUTPUT_DMA
+#error "bench_contention measures the DMA ring: build it with LOGGER_OUTPUT_MODE=1"
+#endif
+
+/** @brief Maximum number of producers, the interrupt producer included. */
+#define BENCH_MAX_PRODUCERS 8
+
+/** @brief IPSR of the simulated interrupt producer (TIM2). */
+#define BENCH_IRQ (16U + 28U)
+
+typedef struct
+{
+    int id;             //!< Producer number, written in its messages
+    int isr;            //!< Logs from simulated interrupt context
+    int count;          //!< Messages to log
+    uint64_t *latency;  //!< Host time of every call, in ns
+} bench_producer_t;
+
+/** @brief Queue that copies messages under a critical section, for comparison. */
+static struct
+{
+    uint8_t buf[LOG_RING_SIZE];
+    uint32_t head; //!< Write index (free running)
+    uint32_t tail; //!< Read index (free running)
+    uint32_t dropped;
+} sLocked;
+
+static int (*sWrite)(int id, uint32_t seq); //!< Queue under test
+static volatile int sProducing;             //!< Producers still running
+
+/* =======================================================================
+ * [HELPERS]
+ * =======================================================================
+ */
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+    LOGGER_TX_CPLT_CALLBACK(huart);
+}
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a;
+    uint64_t y = *(const uint64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/* =======================================================================
+ * [QUEUES]
+ * =======================================================================
+ */
+
+static int ring_write(int id, uint32_t seq)
+{
+    LOG_RAW("p%d %lu\r\n", id, (unsigned long) seq);
+    return 0;
+}
+
+static int locked_write(int id, uint32_t seq)
+{
+    char msg[LOG_BUFFER_SIZE];
+    int len = snprintf(msg, sizeof(msg), "p%d %lu\r\n", id, (unsigned long) seq);
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+
+    if ((uint32_t) len <= LOG_RING_SIZE - (sLocked.head - sLocked.tail))
+    {
+        for (int i = 0; i < len; i++)
+        {
+            sLocked.buf[(sLocked.head + (uint32_t) i) & (LOG_RING_SIZE - 1)] = (uint8_t) msg[i];
+        }
+
+        sLocked.head += (uint32_t) len;
+    }
+    else
+    {
+        sLocked.dropped++;
+    }
+
+    __set_PRIMASK(primask);
+    return 0;
+}
+
+/* =======================================================================
+ * [THREADS]
+ * =======================================================================
+ */
+
+static void *bench_producer(void *arg)
+{
+    bench_producer_t *producer = arg;
+
+    for (int i = 0; i < producer->count; i++)
+    {
+        uint64_t start = bench_now_ns();
+
+        if (producer->isr)
+        {
+            stub_irq_enter(BENCH_IRQ);
+            sWrite(producer->id, (uint32_t) i);
+            stub_irq_exit();
+        }
+        else
+        {
+            sWrite(producer->id, (uint32_t) i);
+        }
+
+        producer->latency[i] = bench_now_ns() - start;
+
+        // The work of the task between two messages; lets the others run on a single core.
+        sched_yield();
+    }
+
+    __atomic_sub_fetch(&sProducing, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+/*!
+ * @brief Completes the DMA transfers of the ring, or empties the reference queue, until the
+ *        producers are done and nothing is left.
+ */
+static void *bench_consumer(void *arg)
+{
+    (void) arg;
+
+    for (;;)
+    {
+        int done = __atomic_load_n(&sProducing, __ATOMIC_SEQ_CST) == 0;
+        int progress;
+
+        if (sWrite == ring_write)
+        {
+            progress = stub_dma_complete(&huart1);
+        }
+        else
+        {
+            uint32_t primask = __get_PRIMASK();
+
+            __disable_irq();
+            progress = sLocked.head != sLocked.tail;
+            sLocked.tail = sLocked.head;
+            __set_PRIMASK(primask);
+        }
+
+        if (done && !progress && (sWrite != ring_write || LOGGER_IS_IDLE()))
+        {
+            return NULL;
+        }
+
+        if (!progress)
+        {
+            sched_yield();
+        }
+    }
+}
+
+/* =======================================================================
+ * [BENCHMARK]
+ * =======================================================================
+ */
+
+static void bench_run(const char *name, int (*write)(int id, uint32_t seq),
+                      bench_producer_t *producers, int count)
+{
+    pthread_t threads[BENCH_MAX_PRODUCERS];
+    pthread_t consumer;
+
+    sWrite = write;
+    sProducing = count;
+    pthread_create(&consumer, NULL, bench_consumer, NULL);
+
+    for (int i = 0; i < count; i++)
+    {
+        pthread_create(&threads[i], NULL, bench_producer, &producers[i]);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_join(consumer, NULL);
+
+    for (int i = 0; i < count; i++)
+    {
+        bench_producer_t *producer = &producers[i];
+        uint64_t total = 0;
+
+        for (int j = 0; j < producer->count; j++)
+        {
+            total += producer->latency[j];
+        }
+
+        qsort(producer->latency, (size_t) producer->count, sizeof(uint64_t), bench_compare);
+        printf("%-7s %-5s%d  calls %7d  mean %8.0f ns  p99 %8lu ns  max %9lu ns\n", name,
+               producer->isr ? "isr" : "task", producer->id, producer->count,
+               (double) total / producer->count,
+               (unsigned long) producer->latency[producer->count * 99 / 100],
+               (unsigned long) producer->latency[producer->count - 1]);
+    }
+}
+
+/*!
+ * @brief Checks that the ring delivered whole lines, in order for each producer.
+ *
+ * @return Number of problems found.
+ */
+static int bench_check(const bench_producer_t *producers, int count, uint32_t dropped)
+{
+    const char *out = stub_uart_text(&huart1);
+    long next[BENCH_MAX_PRODUCERS] = {0};
+    uint32_t received = 0;
+    uint32_t sent = 0;
+    int errors = 0;
+
+    for (const char *line = out; *line != '\0';)
+    {
+        const char *end = strstr(line, "\r\n");
+        int id;
+        unsigned long seq;
+
+        if (end == NULL || sscanf(line, "p%d %lu\r", &id, &seq) != 2 || id < 0 || id >= count ||
+            (long) seq < next[id])
+        {
+            fprintf(stderr, "torn or out-of-order line at offset %ld\n", (long) (line - out));
+            errors++;
+            break;
+        }
+
+        next[id] = (long) seq + 1;
+        received++;
+        line = end + 2;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        sent += (uint32_t) producers[i].count;
+    }
+
+    if (received + dropped != sent)
+    {
+        fprintf(stderr, "%lu lines received, %lu dropped, %lu sent\n", (unsigned long) received,
+                (unsigned long) dropped, (unsigned long) sent);
+        errors++;
+    }
+
+    return errors;
+}
+
+/* =======================================================================
+ * [MAIN]
+ * =======================================================================
+ */
+
+int main(int argc, char **argv)
+{
+    bench_producer_t producers[BENCH_MAX_PRODUCERS];
+    int messages = (argc > 1) ? atoi(argv[1]) : 20000;
+    int tasks = (argc > 2) ? atoi(argv[2]) : 3;
+    int count = tasks + 1;
+    int errors;
+
+    if (messages <= 0 || tasks <= 0 || count > BENCH_MAX_PRODUCERS)
+    {
+        fprintf(stderr, "usage: %s [messages per producer] [task producers, 1-%d]\n", argv[0],
+                BENCH_MAX_PRODUCERS - 1);
+        return 2;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        producers[i].id = i;
+        producers[i].isr = (i == tasks);
+        producers[i].count = messages;
+        producers[i].latency = malloc((size_t) messages * sizeof(uint64_t));
+    }
+
+    stub_uart_init(&huart1, USART1, 115200);
+
+    bench_run("ring", ring_write, producers, count);
+    errors = bench_check(producers, count, LOGGER_GET_DROPPED());
+    printf("ring    dropped %lu\n", (unsigned long) LOGGER_GET_DROPPED());
+
+    bench_run("locked", locked_write, producers, count);
+    printf("locked  dropped %lu\n", (unsigned long) sLocked.dropped);
+
+    for (int i = 0; i < count; i++)
+    {
+        free(producers[i].latency);
+    }
+
+    return (errors == 0) ? 0 : 1;
+}
+
+/*** end of file ***/
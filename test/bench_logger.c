@@ -0,0 +1,264 @@
+/** @file bench_logger.c
+ *
+ * @brief Host benchmark of the logger, built once per configuration (see CMakeLists.txt).
+ *
+ * @author Ignacio Brittez
+ *
+ * Usage: bench_logger [iterations]
+ *
+ * For a few reference messages, reports:
+ *  - `format`: host time of the formatter alone (LOG_VSNPRINTF), per call.
+ *  - `call`: host time of the whole `LOG_INFO()` call as seen by the producer, backend included
+ *    (the stub UART sends instantly; DMA transfers and the logger task run between batches).
+ *  - `bytes`: bytes sent per message, prefix or record framing included.
+ *  - `hal`: HAL transmit calls per message, to see the effect of batching.
+ *  - `line`: messages per second that a UART sustains at 115200 and 2000000 baud.
+ *  - `drops`: messages dropped by the backend over the run.
+ *
+ * Host times only compare configurations and formatters with each other; target cycles come from
+ * the DWT counter (LOG_STATS).
+ */
+
+/* =======================================================================
+ * [INCLUDES]
+ * =======================================================================
+ */
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "logger_module.h"
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+#include "task.h"
+#endif
+
+/* =======================================================================
+ * [MODULE]
+ * =======================================================================
+ */
+
+LOG_MODULE_REGISTER(bench, LOG_LEVEL_DEBUG);
+
+/* =======================================================================
+ * [PUBLIC DATA]
+ * =======================================================================
+ */
+
+UART_HandleTypeDef huart1;
+
+/* =======================================================================
+ * [PRIVATE DATA]
+ * =======================================================================
+ */
+
+#ifndef BENCH_CONFIG
+#define BENCH_CONFIG "default"
+#endif
+
+/** @brief Messages logged between two runs of the backend (DMA completions, logger task). */
+#define BENCH_BATCH 8
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+static jmp_buf sTaskExit;
+static int sTaskYields;
+#endif
+
+static volatile int sSink; //!< Keeps the formatter results alive
+
+/* =======================================================================
+ * [HELPERS]
+ * =======================================================================
+ */
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+    LOGGER_TX_CPLT_CALLBACK(huart);
+}
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+
+static void bench_task_yield(void)
+{
+    if (++sTaskYields >= 2)
+    {
+        longjmp(sTaskExit, 1);
+    }
+}
+
+#endif // LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+
+/*!
+ * @brief Lets the backend send everything queued so far.
+ */
+static void bench_drain(void)
+{
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+    stub_dma_run();
+#elif LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+    sTaskYields = 0;
+    stub_task_yield = bench_task_yield;
+
+    if (setjmp(sTaskExit) == 0)
+    {
+        LOGGER_TASK(NULL);
+    }
+
+    stub_task_yield = NULL;
+#else
+    LOGGER_PROCESS();
+#endif
+}
+
+static int bench_format(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    va_start(args, fmt);
+    len = LOG_VSNPRINTF(buf, size, fmt, args);
+    va_end(args);
+    return len;
+}
+
+/* =======================================================================
+ * [REFERENCE MESSAGES]
+ * =======================================================================
+ */
+
+typedef struct
+{
+    const char *name;
+    void (*format)(char *buf, size_t size, int i);
+    void (*log)(int i);
+} bench_message_t;
+
+static void format_short(char *buf, size_t size, int i)
+{
+    (void) i;
+    sSink += bench_format(buf, size, "tick\r\n");
+}
+
+static void log_short(int i)
+{
+    (void) i;
+    LOG_INFO("tick\r\n");
+}
+
+static void format_ints(char *buf, size_t size, int i)
+{
+    sSink += bench_format(buf, size, "adc %d temp %u.%02u\r\n", i - 500, 21U, (unsigned) i % 100U);
+}
+
+static void log_ints(int i)
+{
+    LOG_INFO("adc %d temp %u.%02u\r\n", i - 500, 21U, (unsigned) i % 100U);
+}
+
+static void format_mixed(char *buf, size_t size, int i)
+{
+    sSink += bench_format(buf, size, "state %s -> %s at 0x%08lx, %.3f V\r\n", "idle", "run",
+                          (unsigned long) i, 3.3 * (double) (i & 7));
+}
+
+static void log_mixed(int i)
+{
+    LOG_INFO("state %s -> %s at 0x%08lx, %.3f V\r\n", "idle", "run", (unsigned long) i,
+             3.3 * (double) (i & 7));
+}
+
+static const bench_message_t kMessages[] = {
+    {"short", format_short, log_short},
+    {"ints", format_ints, log_ints},
+    {"mixed", format_mixed, log_mixed},
+};
+
+/* =======================================================================
+ * [BENCHMARK]
+ * =======================================================================
+ */
+
+static void bench_message(const bench_message_t *message, int iterations)
+{
+    char buf[LOG_BUFFER_SIZE];
+    stub_uart_stats_t before;
+    stub_uart_stats_t after;
+    uint32_t dropped = LOGGER_GET_DROPPED();
+    uint64_t format_ns = 0;
+    uint64_t call_ns = 0;
+    uint64_t start;
+
+    start = bench_now_ns();
+    for (int i = 0; i < iterations; i++)
+    {
+        message->format(buf, sizeof(buf), i);
+    }
+    format_ns = bench_now_ns() - start;
+
+    bench_drain();
+    stub_uart_stats(&huart1, &before);
+
+    for (int i = 0; i < iterations; i += BENCH_BATCH)
+    {
+        start = bench_now_ns();
+        for (int j = i; j < i + BENCH_BATCH && j < iterations; j++)
+        {
+            message->log(j);
+        }
+        call_ns += bench_now_ns() - start;
+        bench_drain();
+    }
+
+    stub_uart_stats(&huart1, &after);
+
+    double bytes = (double) (after.bytes - before.bytes) / iterations;
+
+    printf("%-10s %-6s format %8.1f ns  call %8.1f ns  bytes %6.1f  hal %5.2f  "
+           "line %7.0f/%8.0f msg/s  drops %lu\n",
+           BENCH_CONFIG, message->name, (double) format_ns / iterations,
+           (double) call_ns / iterations, bytes, (double) (after.calls - before.calls) / iterations,
+           bytes > 0 ? 11520.0 / bytes : 0.0, bytes > 0 ? 200000.0 / bytes : 0.0,
+           (unsigned long) (LOGGER_GET_DROPPED() - dropped));
+}
+
+/* =======================================================================
+ * [MAIN]
+ * =======================================================================
+ */
+
+int main(int argc, char **argv)
+{
+    int iterations = (argc > 1) ? atoi(argv[1]) : 100000;
+
+    if (iterations <= 0)
+    {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 2;
+    }
+
+    stub_uart_init(&huart1, USART1, 115200);
+    stub_uart_capture(&huart1, 0);
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+    LOGGER_RTOS_INIT();
+#endif
+
+    for (size_t i = 0; i < sizeof(kMessages) / sizeof(kMessages[0]); i++)
+    {
+        bench_message(&kMessages[i], iterations);
+    }
+
+    return 0;
+}
+
+/*** end of file ***/
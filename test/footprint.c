@@ -0,0 +1,105 @@
+/** @file footprint.c
+ *
+ * @brief Reference firmware image of the footprint report (`cmake --build <dir> --target
+ *        footprint`, needs arm-none-eabi-gcc).
+ *
+ * @author Ignacio Brittez
+ *
+ * Uses the typical set of logger features of an application, so that the linker keeps what such
+ * an application pays for. The HAL functions are empty stand-ins: their size is not the logger's
+ * and is reported under this object.
+ */
+
+/* =======================================================================
+ * [INCLUDES]
+ * =======================================================================
+ */
+
+#include "logger_module.h"
+
+/* =======================================================================
+ * [MODULE]
+ * =======================================================================
+ */
+
+LOG_MODULE_REGISTER(app, LOG_LEVEL_INFO);
+
+/* =======================================================================
+ * [HAL STAND-INS]
+ * =======================================================================
+ */
+
+UART_HandleTypeDef huart1;
+USART_TypeDef stub_usart[4];
+DWT_Type stub_dwt;
+CoreDebug_Type stub_core_debug;
+ITM_Type stub_itm;
+SCB_Type stub_scb;
+uint32_t SystemCoreClock = 72000000U;
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t size,
+                                    uint32_t timeout)
+{
+    (void) huart;
+    (void) data;
+    (void) size;
+    (void) timeout;
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, const uint8_t *data,
+                                        uint16_t size)
+{
+    (void) huart;
+    (void) data;
+    (void) size;
+    return HAL_OK;
+}
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+    LOGGER_TX_CPLT_CALLBACK(huart);
+}
+
+uint32_t HAL_GetTick(void)
+{
+    return stub_dwt.CYCCNT;
+}
+
+void HAL_Delay(uint32_t delay)
+{
+    (void) delay;
+}
+
+int stub_uart_get_flag(UART_HandleTypeDef *huart, uint32_t flag)
+{
+    return (huart->Instance->SR & flag) != 0U;
+}
+
+/* =======================================================================
+ * [APPLICATION]
+ * =======================================================================
+ */
+
+int main(void)
+{
+    static const uint8_t frame[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    int value = (int) HAL_GetTick();
+
+    huart1.Instance = USART1;
+
+    LOG_INFO("boot %d\r\n", value);
+    LOG_WARNING("adc %d temp %u.%02u\r\n", value - 500, 21U, (unsigned) value % 100U);
+    LOG_ERROR("state %s\r\n", "fault");
+    LOG_RAW("raw %lu\r\n", (unsigned long) value);
+    LOG_HEXDUMP(LOG_LEVEL_INFO, frame, sizeof(frame));
+    LOG_INFO_RATELIMIT(10, "tick\r\n");
+    LOGGER_SHELL_EXEC("log set app dbg");
+
+    for (;;)
+    {
+        LOGGER_PROCESS();
+    }
+}
+
+/*** end of file ***/
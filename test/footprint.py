@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""Flash, RAM and stack report of a firmware image, from its GNU ld map and GCC .su files.
+
+Usage:
+    python3 test/footprint.py firmware.map --su build/ [--top 15] [--require logger.c.o]
+
+Sizes are summed per object file from the input sections of the map: code, constants and the
+initial values of `.data` count as flash; `.data`, `.bss` and `.noinit` as RAM. The stack usage
+files (`-fstack-usage`) give the frame of every function; `dynamic` frames depend on the call and
+are marked with `+`. `--require` fails unless that object takes some flash, for CI checks.
+"""
+
+import argparse
+import collections
+import os
+import re
+import sys
+
+# Input section line of the memory map: " .text.name  0xADDR  0xSIZE  object", possibly with the
+# section name alone on the previous line when it is long.
+SECTION_RE = re.compile(r"^ (\S+)?\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S.*)$")
+OUTPUT_RE = re.compile(r"^(\S+)")
+
+NOT_LOADED = (".debug", ".comment", ".ARM.attributes", ".stab", ".gnu.attributes", "/DISCARD/",
+              ".note.GNU-stack")
+RAM_ONLY = (".bss", ".tbss", ".noinit", ".heap", ".stack", "._user_heap_stack")
+RAM_AND_FLASH = (".data", ".tdata", "logger_modules")
+
+
+def object_name(path):
+    """Short name of an input object: `logger.c.o`, or `libc.a(printf.o)` for archive members."""
+    member = re.match(r"^(.*\.a)\((.*)\)$", path)
+    if member:
+        return f"{os.path.basename(member.group(1))}({member.group(2)})"
+    return os.path.basename(path)
+
+
+def parse_map(path):
+    """Returns {object: [flash, ram]} from the memory map part of a GNU ld map file."""
+    sizes = collections.defaultdict(lambda: [0, 0])
+    output = None
+    pending = None
+    in_map = False
+
+    with open(path, "r", errors="replace") as f:
+        for line in f:
+            line = line.rstrip("\n")
+            if not in_map:
+                in_map = line.startswith("Linker script and memory map")
+                continue
+
+            out = OUTPUT_RE.match(line)
+            if out and not line.startswith(" "):
+                output = out.group(1)
+                pending = None
+                continue
+
+            match = SECTION_RE.match(line)
+            if not match:
+                # A long input section name stands alone, its address and size follow.
+                name = line.strip()
+                pending = name if line.startswith(" ") and " " not in name else None
+                continue
+
+            name = match.group(1) or pending
+            pending = None
+            addr, size, obj = int(match.group(2), 16), int(match.group(3), 16), match.group(4)
+            if name is None or name == "*fill*" or size == 0 or output is None:
+                continue
+            if output.startswith(NOT_LOADED) or (addr == 0 and not output.startswith(RAM_ONLY)):
+                continue
+
+            entry = sizes[object_name(obj.strip())]
+            if output.startswith(RAM_ONLY) or name == "COMMON":
+                entry[1] += size
+            elif output.startswith(RAM_AND_FLASH):
+                entry[0] += size
+                entry[1] += size
+            else:
+                entry[0] += size
+
+    return sizes
+
+
+def parse_su(dirs):
+    """Returns (function, bytes, qualifier, file) for every entry of the .su files under `dirs`."""
+    frames = []
+    for top in dirs:
+        for root, _, files in os.walk(top):
+            for name in files:
+                if not name.endswith(".su"):
+                    continue
+                with open(os.path.join(root, name), "r", errors="replace") as f:
+                    for line in f:
+                        fields = line.rstrip("\n").split("\t")
+                        if len(fields) < 3:
+                            continue
+                        location, size, qualifier = fields[:3]
+                        source, _, func = location.rpartition(":")
+                        source = source.split(":")[0]
+                        frames.append((func, int(size), qualifier, os.path.basename(source)))
+    return frames
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("map", help="GNU ld map file (-Wl,-Map=<file>)")
+    parser.add_argument("--su", action="append", default=[], metavar="DIR",
+                        help="directory searched for .su files (repeatable)")
+    parser.add_argument("--top", type=int, default=15, help="functions listed by stack frame")
+    parser.add_argument("--require", action="append", default=[], metavar="OBJECT",
+                        help="fail unless this object takes some flash (repeatable)")
+    opts = parser.parse_args()
+
+    sizes = parse_map(opts.map)
+    logger = {k: v for k, v in sizes.items() if k.startswith("logger")}
+    others = [sum(v[0] for k, v in sizes.items() if k not in logger),
+              sum(v[1] for k, v in sizes.items() if k not in logger)]
+
+    print(f"{'object':<32} {'flash':>8} {'ram':>8}")
+    for name in sorted(logger):
+        print(f"{name:<32} {logger[name][0]:>8} {logger[name][1]:>8}")
+    print(f"{'logger total':<32} {sum(v[0] for v in logger.values()):>8} "
+          f"{sum(v[1] for v in logger.values()):>8}")
+    print(f"{'rest of the image':<32} {others[0]:>8} {others[1]:>8}")
+
+    frames = parse_su(opts.su)
+    if frames:
+        print()
+        print(f"{'function':<32} {'stack':>8}  file")
+        for func, size, qualifier, source in sorted(frames, key=lambda f: -f[1])[:opts.top]:
+            mark = "+" if "dynamic" in qualifier else " "
+            print(f"{func:<32} {size:>7}{mark}  {source}")
+
+    missing = [name for name in opts.require if sizes.get(name, [0, 0])[0] == 0]
+    for name in missing:
+        print(f"{opts.map}: no flash taken by {name}", file=sys.stderr)
+    return 1 if missing else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,52 @@
+/** @file FreeRTOS.h
+ *
+ * @brief Host stand-in for the FreeRTOS kernel types used by the logger (see `rtos_stub.c`).
+ *
+ * @author Ignacio Brittez
+ */
+
+#ifndef INC_FREERTOS_H
+#define INC_FREERTOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE ((BaseType_t) 0)
+#define pdTRUE  ((BaseType_t) 1)
+#define pdPASS  pdTRUE
+#define pdFAIL  pdFALSE
+
+#define portMAX_DELAY     ((TickType_t) 0xFFFFFFFFUL)
+#define configTICK_RATE_HZ 1000U
+#define pdMS_TO_TICKS(ms) ((TickType_t) (((TickType_t) (ms) * configTICK_RATE_HZ) / 1000U))
+
+#ifndef configSUPPORT_STATIC_ALLOCATION
+#define configSUPPORT_STATIC_ALLOCATION 1
+#endif
+
+#ifndef configNUM_THREAD_LOCAL_STORAGE_POINTERS
+#define configNUM_THREAD_LOCAL_STORAGE_POINTERS 5
+#endif
+
+/*!
+ * @brief Queue control block, public here so that xQueueCreateStatic() can use it as is.
+ */
+typedef struct QueueDefinition
+{
+    uint8_t *storage;      //!< `length * item_size` bytes
+    UBaseType_t length;    //!< Capacity, in items
+    UBaseType_t item_size; //!< Size of an item
+    UBaseType_t head;      //!< Next item to receive
+    UBaseType_t count;     //!< Items waiting
+} StaticQueue_t;
+
+void *pvPortMalloc(size_t xSize);
+void vPortFree(void *pv);
+
+#endif /* INC_FREERTOS_H */
+
+/*** end of file ***/
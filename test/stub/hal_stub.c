@@ -0,0 +1,512 @@
+/** @file hal_stub.c
+ *
+ * @brief Host implementation of the HAL and CMSIS stand-in declared in `stm32f1xx_hal.h`.
+ *
+ * @author Ignacio Brittez
+ */
+
+/* =======================================================================
+ * [INCLUDES]
+ * =======================================================================
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stm32f1xx_hal.h"
+
+/* =======================================================================
+ * [PRIVATE TYPES]
+ * =======================================================================
+ */
+
+/** @brief Number of simulated USARTs. */
+#define STUB_UARTS ((int) (sizeof(stub_usart) / sizeof(stub_usart[0])))
+
+/** @brief Data register value once its byte was collected: no byte write can produce it. */
+#define STUB_DR_EMPTY 0xFFFFFFFFUL
+
+/** @brief Deepest nesting of simulated interrupt handlers. */
+#define STUB_IRQ_DEPTH 8
+
+/*!
+ * @brief State of a simulated UART.
+ */
+typedef struct
+{
+    UART_HandleTypeDef *huart;   //!< Handle bound by stub_uart_init(), NULL if unused
+    DMA_HandleTypeDef hdma;      //!< Its transmit DMA handle
+    DMA_Channel_TypeDef channel; //!< Its transmit DMA channel
+    const uint8_t *dma_data;     //!< Source of the running DMA transfer
+    uint16_t dma_size;           //!< Size of the running DMA transfer
+    char *buf;                   //!< Captured bytes, null-terminated
+    size_t len;                  //!< Captured bytes
+    size_t cap;                  //!< Capacity of `buf`
+    int discard;                 //!< Count the bytes without storing them
+    stub_uart_stats_t stats;     //!< Traffic counters
+} stub_uart_t;
+
+/* =======================================================================
+ * [PUBLIC DATA]
+ * =======================================================================
+ */
+
+USART_TypeDef stub_usart[4];
+DWT_Type stub_dwt;
+CoreDebug_Type stub_core_debug;
+ITM_Type stub_itm;
+SCB_Type stub_scb;
+uint32_t SystemCoreClock = 72000000U;
+
+/* =======================================================================
+ * [PRIVATE DATA]
+ * =======================================================================
+ */
+
+static stub_uart_t sUart[4];
+static pthread_mutex_t sUartLock = PTHREAD_MUTEX_INITIALIZER; //!< Guards `sUart` and the clock
+static uint64_t sTimeNs;                                      //!< Simulated clock
+
+// Held by the thread that masks interrupts or runs a simulated interrupt handler.
+static pthread_mutex_t sIrqLock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread uint32_t tPrimask;
+static __thread uint32_t tIpsr[STUB_IRQ_DEPTH];
+static __thread int tIrqDepth;
+static __thread volatile uint32_t *tExclusive; //!< Address tagged by the last __LDREXW()
+static __thread uint32_t tExclusiveValue;      //!< Value it read
+
+/* =======================================================================
+ * [PRIVATE FUNCTIONS]
+ * =======================================================================
+ */
+
+static stub_uart_t *stub_uart_find(const UART_HandleTypeDef *huart)
+{
+    for (int i = 0; huart != NULL && i < STUB_UARTS; i++)
+    {
+        if (sUart[i].huart == huart)
+        {
+            return &sUart[i];
+        }
+    }
+
+    fprintf(stderr, "stub: UART handle %p used before stub_uart_init()\n", (const void *) huart);
+    abort();
+}
+
+/*!
+ * @brief Stores bytes sent by a UART and advances the clock by their time on the wire.
+ *
+ * @note Called with `sUartLock` held.
+ */
+static void stub_uart_put(stub_uart_t *uart, const uint8_t *data, size_t len)
+{
+    uart->stats.bytes += len;
+    sTimeNs += (uint64_t) len * 10U * 1000000000ULL / uart->huart->Init.BaudRate;
+
+    if (uart->discard)
+    {
+        return;
+    }
+
+    if (uart->len + len + 1 > uart->cap)
+    {
+        size_t cap = (uart->cap != 0) ? uart->cap : 4096;
+
+        while (uart->len + len + 1 > cap)
+        {
+            cap *= 2;
+        }
+
+        uart->buf = realloc(uart->buf, cap);
+        uart->cap = cap;
+
+        if (uart->buf == NULL)
+        {
+            abort();
+        }
+    }
+
+    memcpy(&uart->buf[uart->len], data, len);
+    uart->len += len;
+    uart->buf[uart->len] = '\0';
+}
+
+/*!
+ * @brief Collects the byte left in the data register by a polled write, if any.
+ *
+ * @note Called with `sUartLock` held.
+ */
+static void stub_uart_shift(stub_uart_t *uart)
+{
+    USART_TypeDef *usart = uart->huart->Instance;
+
+    if (usart->DR != STUB_DR_EMPTY)
+    {
+        uint8_t byte = (uint8_t) usart->DR;
+
+        usart->DR = STUB_DR_EMPTY;
+        stub_uart_put(uart, &byte, 1);
+    }
+}
+
+static inline int stub_irq_locked(void)
+{
+    return tPrimask != 0 || tIrqDepth > 0;
+}
+
+/* =======================================================================
+ * [PUBLIC FUNCTIONS]
+ * =======================================================================
+ */
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size,
+                                    uint32_t Timeout)
+{
+    stub_uart_t *uart = stub_uart_find(huart);
+    HAL_StatusTypeDef status = HAL_OK;
+
+    (void) Timeout;
+    pthread_mutex_lock(&sUartLock);
+
+    if (tIrqDepth > 0)
+    {
+        uart->stats.from_isr++;
+    }
+
+    if ((uart->channel.CCR & DMA_CCR_EN) != 0)
+    {
+        uart->stats.busy++;
+        status = HAL_BUSY;
+    }
+    else
+    {
+        uart->stats.calls++;
+        stub_uart_shift(uart);
+        stub_uart_put(uart, pData, Size);
+        huart->TxXferCount = 0;
+    }
+
+    pthread_mutex_unlock(&sUartLock);
+    return status;
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, const uint8_t *pData,
+                                        uint16_t Size)
+{
+    stub_uart_t *uart = stub_uart_find(huart);
+    HAL_StatusTypeDef status = HAL_OK;
+
+    pthread_mutex_lock(&sUartLock);
+
+    if ((uart->channel.CCR & DMA_CCR_EN) != 0)
+    {
+        uart->stats.busy++;
+        status = HAL_BUSY;
+    }
+    else
+    {
+        uart->stats.calls++;
+        uart->dma_data = pData;
+        uart->dma_size = Size;
+        uart->channel.CNDTR = Size;
+        uart->channel.CCR |= DMA_CCR_EN;
+        huart->Instance->CR3 |= USART_CR3_DMAT;
+    }
+
+    pthread_mutex_unlock(&sUartLock);
+    return status;
+}
+
+__attribute__((weak)) void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+    (void) huart;
+}
+
+uint32_t HAL_GetTick(void)
+{
+    return (uint32_t) (stub_time_us() / 1000U);
+}
+
+void HAL_Delay(uint32_t Delay)
+{
+    stub_time_advance((uint64_t) Delay * 1000U);
+}
+
+uint32_t __get_PRIMASK(void)
+{
+    return tPrimask;
+}
+
+void __set_PRIMASK(uint32_t priMask)
+{
+    if (priMask & 1U)
+    {
+        __disable_irq();
+    }
+    else
+    {
+        __enable_irq();
+    }
+}
+
+void __disable_irq(void)
+{
+    if (!stub_irq_locked())
+    {
+        pthread_mutex_lock(&sIrqLock);
+    }
+
+    tPrimask = 1;
+}
+
+void __enable_irq(void)
+{
+    if (tPrimask != 0)
+    {
+        tPrimask = 0;
+
+        if (!stub_irq_locked())
+        {
+            pthread_mutex_unlock(&sIrqLock);
+        }
+    }
+}
+
+uint32_t __get_IPSR(void)
+{
+    return (tIrqDepth > 0) ? tIpsr[tIrqDepth - 1] : 0;
+}
+
+void __DMB(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+uint32_t __LDREXW(volatile uint32_t *addr)
+{
+    uint32_t value = __atomic_load_n(addr, __ATOMIC_SEQ_CST);
+
+    tExclusive = addr;
+    tExclusiveValue = value;
+    return value;
+}
+
+uint32_t __STREXW(uint32_t value, volatile uint32_t *addr)
+{
+    uint32_t expected = tExclusiveValue;
+
+    if (tExclusive != addr)
+    {
+        return 1;
+    }
+
+    tExclusive = NULL;
+
+    // Fails like the real monitor when another context stored to the address in between.
+    return __atomic_compare_exchange_n(addr, &expected, value, 0, __ATOMIC_SEQ_CST,
+                                       __ATOMIC_SEQ_CST)
+               ? 0
+               : 1;
+}
+
+void __CLREX(void)
+{
+    tExclusive = NULL;
+}
+
+void stub_uart_init(UART_HandleTypeDef *huart, USART_TypeDef *usart, uint32_t baud)
+{
+    stub_uart_t *uart = &sUart[usart - stub_usart];
+
+    pthread_mutex_lock(&sUartLock);
+
+    free(uart->buf);
+    memset(uart, 0, sizeof(*uart));
+    memset(usart, 0, sizeof(*usart));
+    usart->SR = UART_FLAG_TXE | UART_FLAG_TC;
+    usart->DR = STUB_DR_EMPTY;
+
+    uart->huart = huart;
+    uart->hdma.Instance = &uart->channel;
+    huart->Instance = usart;
+    huart->Init.BaudRate = baud;
+    huart->hdmatx = &uart->hdma;
+
+    pthread_mutex_unlock(&sUartLock);
+}
+
+int stub_uart_get_flag(UART_HandleTypeDef *huart, uint32_t flag)
+{
+    stub_uart_t *uart = stub_uart_find(huart);
+    uint32_t sr = UART_FLAG_TXE;
+
+    pthread_mutex_lock(&sUartLock);
+    stub_uart_shift(uart);
+
+    if ((uart->channel.CCR & DMA_CCR_EN) == 0)
+    {
+        sr |= UART_FLAG_TC;
+    }
+
+    pthread_mutex_unlock(&sUartLock);
+    return (sr & flag) == flag;
+}
+
+const char *stub_uart_text(UART_HandleTypeDef *huart)
+{
+    stub_uart_t *uart = stub_uart_find(huart);
+
+    pthread_mutex_lock(&sUartLock);
+    stub_uart_shift(uart);
+    pthread_mutex_unlock(&sUartLock);
+
+    return (uart->buf != NULL) ? uart->buf : "";
+}
+
+size_t stub_uart_length(UART_HandleTypeDef *huart)
+{
+    stub_uart_text(huart);
+    return stub_uart_find(huart)->len;
+}
+
+void stub_uart_clear(UART_HandleTypeDef *huart)
+{
+    stub_uart_t *uart = stub_uart_find(huart);
+
+    pthread_mutex_lock(&sUartLock);
+    stub_uart_shift(uart);
+    uart->len = 0;
+
+    if (uart->buf != NULL)
+    {
+        uart->buf[0] = '\0';
+    }
+
+    pthread_mutex_unlock(&sUartLock);
+}
+
+void stub_uart_capture(UART_HandleTypeDef *huart, int enable)
+{
+    stub_uart_find(huart)->discard = !enable;
+}
+
+void stub_uart_stats(UART_HandleTypeDef *huart, stub_uart_stats_t *stats)
+{
+    stub_uart_t *uart = stub_uart_find(huart);
+
+    pthread_mutex_lock(&sUartLock);
+    *stats = uart->stats;
+    pthread_mutex_unlock(&sUartLock);
+}
+
+void stub_dma_progress(UART_HandleTypeDef *huart, uint32_t count)
+{
+    stub_uart_t *uart = stub_uart_find(huart);
+
+    pthread_mutex_lock(&sUartLock);
+
+    if ((uart->channel.CCR & DMA_CCR_EN) != 0)
+    {
+        count = (count < uart->channel.CNDTR) ? count : uart->channel.CNDTR;
+        stub_uart_put(uart, uart->dma_data + uart->dma_size - uart->channel.CNDTR, count);
+        uart->channel.CNDTR -= count;
+    }
+
+    pthread_mutex_unlock(&sUartLock);
+}
+
+int stub_dma_complete(UART_HandleTypeDef *huart)
+{
+    stub_uart_t *uart = stub_uart_find(huart);
+
+    pthread_mutex_lock(&sUartLock);
+
+    if ((uart->channel.CCR & DMA_CCR_EN) == 0)
+    {
+        pthread_mutex_unlock(&sUartLock);
+        return 0;
+    }
+
+    stub_uart_put(uart, uart->dma_data + uart->dma_size - uart->channel.CNDTR,
+                  uart->channel.CNDTR);
+    uart->channel.CNDTR = 0;
+    uart->channel.CCR &= ~DMA_CCR_EN;
+
+    pthread_mutex_unlock(&sUartLock);
+
+    // USART1 global interrupt; which one does not matter to the logger.
+    stub_irq_enter(16U + 37U);
+    HAL_UART_TxCpltCallback(huart);
+    stub_irq_exit();
+    return 1;
+}
+
+int stub_dma_run(void)
+{
+    int completed = 0;
+    int progress = 1;
+
+    while (progress)
+    {
+        progress = 0;
+
+        for (int i = 0; i < STUB_UARTS; i++)
+        {
+            if (sUart[i].huart != NULL && stub_dma_complete(sUart[i].huart))
+            {
+                completed++;
+                progress = 1;
+            }
+        }
+    }
+
+    return completed;
+}
+
+uint64_t stub_time_us(void)
+{
+    pthread_mutex_lock(&sUartLock);
+    uint64_t ns = sTimeNs;
+    pthread_mutex_unlock(&sUartLock);
+
+    return ns / 1000U;
+}
+
+void stub_time_advance(uint64_t us)
+{
+    pthread_mutex_lock(&sUartLock);
+    sTimeNs += us * 1000U;
+    pthread_mutex_unlock(&sUartLock);
+}
+
+void stub_irq_enter(uint32_t irq)
+{
+    if (!stub_irq_locked())
+    {
+        pthread_mutex_lock(&sIrqLock);
+    }
+
+    if (tIrqDepth == STUB_IRQ_DEPTH)
+    {
+        abort();
+    }
+
+    tIpsr[tIrqDepth++] = irq;
+}
+
+void stub_irq_exit(void)
+{
+    // The exception return clears the monitor of the code that was interrupted.
+    tExclusive = NULL;
+    tIrqDepth--;
+
+    if (!stub_irq_locked())
+    {
+        pthread_mutex_unlock(&sIrqLock);
+    }
+}
+
+/*** end of file ***/
@@ -0,0 +1,227 @@
+/** @file rtos_stub.c
+ *
+ * @brief Host implementation of the FreeRTOS stand-in: one task per host thread, queues that
+ *        never block.
+ *
+ * @author Ignacio Brittez
+ *
+ * The tick count is the simulated clock of `hal_stub.c`, in milliseconds. Queues are guarded by a
+ * mutex but never wait: an empty queue read with a timeout calls `stub_task_yield` instead, after
+ * advancing the clock by the timeout.
+ */
+
+/* =======================================================================
+ * [INCLUDES]
+ * =======================================================================
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stm32f1xx_hal.h"
+#include "FreeRTOS.h"
+#include "queue.h"
+#include "task.h"
+
+/* =======================================================================
+ * [PUBLIC DATA]
+ * =======================================================================
+ */
+
+BaseType_t stub_scheduler_state = taskSCHEDULER_RUNNING;
+void (*stub_task_yield)(void);
+
+/* =======================================================================
+ * [PRIVATE DATA]
+ * =======================================================================
+ */
+
+static pthread_mutex_t sQueueLock = PTHREAD_MUTEX_INITIALIZER;
+static __thread void *tTls[configNUM_THREAD_LOCAL_STORAGE_POINTERS];
+static __thread uint8_t tTask; //!< Its address is the handle of the calling task
+
+/* =======================================================================
+ * [PRIVATE FUNCTIONS]
+ * =======================================================================
+ */
+
+/*!
+ * @brief Moves the oldest item of a queue to `item`.
+ *
+ * @return pdTRUE, or pdFALSE if the queue is empty.
+ */
+static BaseType_t stub_queue_take(QueueHandle_t queue, void *item)
+{
+    BaseType_t taken = pdFALSE;
+
+    pthread_mutex_lock(&sQueueLock);
+
+    if (queue->count != 0)
+    {
+        memcpy(item, &queue->storage[queue->head * queue->item_size], queue->item_size);
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        taken = pdTRUE;
+    }
+
+    pthread_mutex_unlock(&sQueueLock);
+    return taken;
+}
+
+/* =======================================================================
+ * [PUBLIC FUNCTIONS]
+ * =======================================================================
+ */
+
+void *pvPortMalloc(size_t xSize)
+{
+    return malloc(xSize);
+}
+
+void vPortFree(void *pv)
+{
+    free(pv);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize)
+{
+    StaticQueue_t *queue = malloc(sizeof(*queue));
+    uint8_t *storage = malloc(uxQueueLength * uxItemSize);
+
+    if (queue == NULL || storage == NULL)
+    {
+        free(queue);
+        free(storage);
+        return NULL;
+    }
+
+    return xQueueCreateStatic(uxQueueLength, uxItemSize, storage, queue);
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t uxQueueLength, UBaseType_t uxItemSize,
+                                 uint8_t *pucQueueStorage, StaticQueue_t *pxQueueBuffer)
+{
+    pxQueueBuffer->storage = pucQueueStorage;
+    pxQueueBuffer->length = uxQueueLength;
+    pxQueueBuffer->item_size = uxItemSize;
+    pxQueueBuffer->head = 0;
+    pxQueueBuffer->count = 0;
+    return pxQueueBuffer;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t xQueue, const void *pvItemToQueue,
+                            TickType_t xTicksToWait)
+{
+    BaseType_t sent = pdFALSE;
+
+    (void) xTicksToWait;
+    pthread_mutex_lock(&sQueueLock);
+
+    if (xQueue->count < xQueue->length)
+    {
+        UBaseType_t tail = (xQueue->head + xQueue->count) % xQueue->length;
+
+        memcpy(&xQueue->storage[tail * xQueue->item_size], pvItemToQueue, xQueue->item_size);
+        xQueue->count++;
+        sent = pdTRUE;
+    }
+
+    pthread_mutex_unlock(&sQueueLock);
+    return sent;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+    if (stub_queue_take(xQueue, pvBuffer))
+    {
+        return pdTRUE;
+    }
+
+    // A poll never gives the processor away.
+    if (xTicksToWait == 0)
+    {
+        return pdFALSE;
+    }
+
+    HAL_Delay(xTicksToWait);
+
+    if (stub_task_yield != NULL)
+    {
+        stub_task_yield();
+    }
+
+    return stub_queue_take(xQueue, pvBuffer);
+}
+
+BaseType_t xQueueReceiveFromISR(QueueHandle_t xQueue, void *pvBuffer,
+                                BaseType_t *pxHigherPriorityTaskWoken)
+{
+    if (pxHigherPriorityTaskWoken != NULL)
+    {
+        *pxHigherPriorityTaskWoken = pdFALSE;
+    }
+
+    return stub_queue_take(xQueue, pvBuffer);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue)
+{
+    pthread_mutex_lock(&sQueueLock);
+    UBaseType_t count = xQueue->count;
+    pthread_mutex_unlock(&sQueueLock);
+
+    return count;
+}
+
+UBaseType_t uxQueueMessagesWaitingFromISR(QueueHandle_t xQueue)
+{
+    return uxQueueMessagesWaiting(xQueue);
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t xQueue)
+{
+    return xQueue->length - uxQueueMessagesWaiting(xQueue);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t) HAL_GetTick();
+}
+
+BaseType_t xTaskGetSchedulerState(void)
+{
+    return stub_scheduler_state;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return &tTask;
+}
+
+void vTaskDelay(TickType_t xTicksToDelay)
+{
+    HAL_Delay(xTicksToDelay);
+
+    if (stub_task_yield != NULL)
+    {
+        stub_task_yield();
+    }
+}
+
+void *pvTaskGetThreadLocalStoragePointer(TaskHandle_t xTaskToQuery, BaseType_t xIndex)
+{
+    (void) xTaskToQuery;
+    return (xIndex >= 0 && xIndex < configNUM_THREAD_LOCAL_STORAGE_POINTERS) ? tTls[xIndex] : NULL;
+}
+
+void vTaskSetThreadLocalStoragePointer(TaskHandle_t xTaskToSet, BaseType_t xIndex, void *pvValue)
+{
+    (void) xTaskToSet;
+
+    if (xIndex >= 0 && xIndex < configNUM_THREAD_LOCAL_STORAGE_POINTERS)
+    {
+        tTls[xIndex] = pvValue;
+    }
+}
+
+/*** end of file ***/
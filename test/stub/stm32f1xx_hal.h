@@ -0,0 +1,317 @@
+/** @file stm32f1xx_hal.h
+ *
+ * @brief Host stand-in for the parts of the STM32F1 HAL and CMSIS used by the logger.
+ *
+ * @author Ignacio Brittez
+ *
+ * Lets the logger build on a PC for the regression tests and benchmarks in `test/`:
+ *  - The UARTs transmit into capture buffers and advance a simulated clock by the time the bytes
+ *    take on the wire at the configured baud rate. `HAL_GetTick()` reads that clock.
+ *  - A DMA transfer stays pending until the test completes it (stub_dma_complete()), which then
+ *    calls `HAL_UART_TxCpltCallback()` in simulated interrupt context.
+ *  - Bytes written to the USART data register (panic output) are collected when the status
+ *    register is polled, like a shift register.
+ *  - IPSR, PRIMASK and the exclusive monitor are emulated per thread, so that host threads can
+ *    stand for concurrent tasks and interrupt handlers. Masking interrupts takes a global lock,
+ *    which a simulated interrupt handler holds while it runs.
+ *
+ * Built for an ARM target (the footprint image), only the types and the CMSIS intrinsics are used.
+ */
+
+#ifndef STM32F1XX_HAL_H
+#define STM32F1XX_HAL_H
+
+/* =======================================================================
+ * [INCLUDES]
+ * =======================================================================
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* =======================================================================
+ * [HAL]
+ * =======================================================================
+ */
+
+typedef enum
+{
+    HAL_OK = 0x00U,
+    HAL_ERROR = 0x01U,
+    HAL_BUSY = 0x02U,
+    HAL_TIMEOUT = 0x03U
+} HAL_StatusTypeDef;
+
+#define HAL_MAX_DELAY 0xFFFFFFFFU
+
+typedef struct
+{
+    volatile uint32_t SR;
+    volatile uint32_t DR;
+    volatile uint32_t BRR;
+    volatile uint32_t CR1;
+    volatile uint32_t CR2;
+    volatile uint32_t CR3;
+    volatile uint32_t GTPR;
+} USART_TypeDef;
+
+typedef struct
+{
+    volatile uint32_t CCR;
+    volatile uint32_t CNDTR;
+    volatile uint32_t CPAR;
+    volatile uint32_t CMAR;
+} DMA_Channel_TypeDef;
+
+typedef struct
+{
+    DMA_Channel_TypeDef *Instance;
+} DMA_HandleTypeDef;
+
+typedef struct
+{
+    uint32_t BaudRate;
+} UART_InitTypeDef;
+
+typedef struct
+{
+    USART_TypeDef *Instance;
+    UART_InitTypeDef Init;
+    DMA_HandleTypeDef *hdmatx;
+    volatile uint16_t TxXferCount;
+} UART_HandleTypeDef;
+
+#define UART_FLAG_TC      0x00000040U
+#define UART_FLAG_TXE     0x00000080U
+#define USART_CR3_DMAT    0x00000080U
+#define DMA_CCR_EN        0x00000001U
+
+extern USART_TypeDef stub_usart[4];
+#define USART1 (&stub_usart[0])
+#define USART2 (&stub_usart[1])
+#define USART3 (&stub_usart[2])
+#define UART4  (&stub_usart[3])
+
+// Reads of the status register go through the stub, which collects the data register first.
+#define __HAL_UART_GET_FLAG(huart, flag) stub_uart_get_flag((huart), (flag))
+#define __HAL_DMA_DISABLE(hdma)          ((hdma)->Instance->CCR &= ~DMA_CCR_EN)
+#define __HAL_DMA_GET_COUNTER(hdma)      ((hdma)->Instance->CNDTR)
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *pData, uint16_t Size,
+                                    uint32_t Timeout);
+HAL_StatusTypeDef HAL_UART_Transmit_DMA(UART_HandleTypeDef *huart, const uint8_t *pData,
+                                        uint16_t Size);
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart);
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+
+/* =======================================================================
+ * [CMSIS]
+ * =======================================================================
+ */
+
+#define __CORTEX_M 3U
+
+typedef struct
+{
+    volatile uint32_t CTRL;
+    volatile uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct
+{
+    volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct
+{
+    volatile union
+    {
+        volatile uint8_t u8;
+        volatile uint16_t u16;
+        volatile uint32_t u32;
+    } PORT[32];
+    volatile uint32_t TER;
+    volatile uint32_t TCR;
+} ITM_Type;
+
+typedef struct
+{
+    volatile uint32_t CFSR;
+    volatile uint32_t HFSR;
+    volatile uint32_t MMFAR;
+    volatile uint32_t BFAR;
+} SCB_Type;
+
+extern DWT_Type stub_dwt;
+extern CoreDebug_Type stub_core_debug;
+extern ITM_Type stub_itm;
+extern SCB_Type stub_scb;
+extern uint32_t SystemCoreClock;
+
+#define DWT       (&stub_dwt)
+#define CoreDebug (&stub_core_debug)
+#define ITM       (&stub_itm)
+#define SCB       (&stub_scb)
+
+#define DWT_CTRL_CYCCNTENA_Msk     (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+#define ITM_TCR_ITMENA_Msk         (1UL << 0)
+#define SCB_CFSR_MEMFAULTSR_Pos    0U
+
+#if defined(__arm__)
+
+static inline uint32_t __get_PRIMASK(void)
+{
+    uint32_t result;
+    __asm volatile("mrs %0, primask" : "=r"(result)::"memory");
+    return result;
+}
+
+static inline void __set_PRIMASK(uint32_t priMask)
+{
+    __asm volatile("msr primask, %0" ::"r"(priMask) : "memory");
+}
+
+static inline void __disable_irq(void)
+{
+    __asm volatile("cpsid i" ::: "memory");
+}
+
+static inline void __enable_irq(void)
+{
+    __asm volatile("cpsie i" ::: "memory");
+}
+
+static inline uint32_t __get_IPSR(void)
+{
+    uint32_t result;
+    __asm volatile("mrs %0, ipsr" : "=r"(result));
+    return result;
+}
+
+static inline void __DMB(void)
+{
+    __asm volatile("dmb 0xF" ::: "memory");
+}
+
+static inline uint32_t __LDREXW(volatile uint32_t *addr)
+{
+    uint32_t result;
+    __asm volatile("ldrex %0, %1" : "=r"(result) : "Q"(*addr));
+    return result;
+}
+
+static inline uint32_t __STREXW(uint32_t value, volatile uint32_t *addr)
+{
+    uint32_t result;
+    __asm volatile("strex %0, %2, %1" : "=&r"(result), "=Q"(*addr) : "r"(value));
+    return result;
+}
+
+static inline void __CLREX(void)
+{
+    __asm volatile("clrex" ::: "memory");
+}
+
+#else
+
+uint32_t __get_PRIMASK(void);
+void __set_PRIMASK(uint32_t priMask);
+void __disable_irq(void);
+void __enable_irq(void);
+uint32_t __get_IPSR(void);
+void __DMB(void);
+uint32_t __LDREXW(volatile uint32_t *addr);
+uint32_t __STREXW(uint32_t value, volatile uint32_t *addr);
+void __CLREX(void);
+
+#endif // __arm__
+
+/* =======================================================================
+ * [STUB CONTROL]
+ * =======================================================================
+ */
+
+/*!
+ * @brief Binds a UART handle to a USART, a DMA channel of its own and a baud rate.
+ *
+ * Also clears its capture and statistics.
+ */
+void stub_uart_init(UART_HandleTypeDef *huart, USART_TypeDef *usart, uint32_t baud);
+
+/*!
+ * @brief Status register read of `__HAL_UART_GET_FLAG()`.
+ *
+ * TXE is always set; TC is cleared while a DMA transfer is running.
+ */
+int stub_uart_get_flag(UART_HandleTypeDef *huart, uint32_t flag);
+
+/*!
+ * @brief Returns what a UART sent so far, null-terminated (a binary capture may contain zeros:
+ *        use stub_uart_length()).
+ */
+const char *stub_uart_text(UART_HandleTypeDef *huart);
+
+/** @brief Number of bytes captured on a UART. */
+size_t stub_uart_length(UART_HandleTypeDef *huart);
+
+/** @brief Empties the capture of a UART. */
+void stub_uart_clear(UART_HandleTypeDef *huart);
+
+/*!
+ * @brief Stops storing the bytes of a UART (for benchmarks); they are still counted.
+ */
+void stub_uart_capture(UART_HandleTypeDef *huart, int enable);
+
+/*!
+ * @brief Traffic of a UART since stub_uart_init().
+ */
+typedef struct
+{
+    uint64_t bytes;    //!< Bytes sent
+    uint32_t calls;    //!< HAL_UART_Transmit() and HAL_UART_Transmit_DMA() calls
+    uint32_t busy;     //!< Calls refused with HAL_BUSY
+    uint32_t from_isr; //!< Blocking transmits called from interrupt context
+} stub_uart_stats_t;
+
+void stub_uart_stats(UART_HandleTypeDef *huart, stub_uart_stats_t *stats);
+
+/*!
+ * @brief Moves `count` bytes of the running DMA transfer of a UART out, without completing it.
+ */
+void stub_dma_progress(UART_HandleTypeDef *huart, uint32_t count);
+
+/*!
+ * @brief Completes the running DMA transfer of a UART and runs its transmit-complete interrupt.
+ *
+ * @return 1 if a transfer was completed, 0 if none was running.
+ */
+int stub_dma_complete(UART_HandleTypeDef *huart);
+
+/*!
+ * @brief Completes DMA transfers of every UART until none is left.
+ *
+ * @return Number of transfers completed.
+ */
+int stub_dma_run(void);
+
+/** @brief Current time of the simulated clock, in microseconds. */
+uint64_t stub_time_us(void);
+
+/** @brief Advances the simulated clock. */
+void stub_time_advance(uint64_t us);
+
+/*!
+ * @brief Enters simulated interrupt context: IPSR reads `irq` until stub_irq_exit().
+ *
+ * Nests. The outermost level takes the interrupt lock, so it waits for contexts that masked
+ * interrupts, and blocks them while it runs.
+ */
+void stub_irq_enter(uint32_t irq);
+
+void stub_irq_exit(void);
+
+#endif /* STM32F1XX_HAL_H */
+
+/*** end of file ***/
@@ -0,0 +1,43 @@
+/** @file task.h
+ *
+ * @brief Host stand-in for the FreeRTOS task API used by the logger (see `rtos_stub.c`).
+ *
+ * @author Ignacio Brittez
+ */
+
+#ifndef INC_TASK_H
+#define INC_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+
+#define taskSCHEDULER_SUSPENDED   ((BaseType_t) 0)
+#define taskSCHEDULER_NOT_STARTED ((BaseType_t) 1)
+#define taskSCHEDULER_RUNNING     ((BaseType_t) 2)
+
+TickType_t xTaskGetTickCount(void);
+BaseType_t xTaskGetSchedulerState(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+void vTaskDelay(TickType_t xTicksToDelay);
+void *pvTaskGetThreadLocalStoragePointer(TaskHandle_t xTaskToQuery, BaseType_t xIndex);
+void vTaskSetThreadLocalStoragePointer(TaskHandle_t xTaskToSet, BaseType_t xIndex, void *pvValue);
+
+/* =======================================================================
+ * [STUB CONTROL]
+ * =======================================================================
+ */
+
+/** @brief Value returned by xTaskGetSchedulerState(), taskSCHEDULER_RUNNING by default. */
+extern BaseType_t stub_scheduler_state;
+
+/*!
+ * @brief Called instead of blocking when xQueueReceive() with a timeout finds the queue empty,
+ *        and by vTaskDelay(): lets a test run the other tasks, or leave LOGGER_TASK() with
+ *        longjmp().
+ */
+extern void (*stub_task_yield)(void);
+
+#endif /* INC_TASK_H */
+
+/*** end of file ***/
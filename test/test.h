@@ -0,0 +1,138 @@
+/** @file test.h
+ *
+ * @brief Minimal check helpers of the host regression tests.
+ *
+ * @author Ignacio Brittez
+ *
+ * A failed check prints its location and the values involved, and the test goes on. Each test
+ * program runs its test functions with TEST_RUN() and returns test_finish() from main(), which
+ * is non-zero if any check failed.
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+/* =======================================================================
+ * [INCLUDES]
+ * =======================================================================
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+/* =======================================================================
+ * [MACROS]
+ * =======================================================================
+ */
+
+#define TEST_CHECK(cond) test_check((cond) ? 1 : 0, #cond, __FILE__, __LINE__)
+
+#define TEST_CHECK_INT(actual, expected)                                                           \
+    test_check_int((long long) (actual), (long long) (expected), #actual, __FILE__, __LINE__)
+
+#define TEST_CHECK_STR(actual, expected)                                                           \
+    test_check_str((actual), (expected), #actual, __FILE__, __LINE__)
+
+#define TEST_RUN(fn) test_run(#fn, fn)
+
+/* =======================================================================
+ * [PRIVATE DATA]
+ * =======================================================================
+ */
+
+static int sTestChecks;
+static int sTestFailures;
+
+/* =======================================================================
+ * [FUNCTIONS]
+ * =======================================================================
+ */
+
+/*!
+ * @brief Prints a string with its control characters escaped, so escape codes stay readable.
+ */
+static inline void test_print_escaped(const char *str)
+{
+    for (; str != NULL && *str; str++)
+    {
+        unsigned char c = (unsigned char) *str;
+
+        if (c == '\r')
+        {
+            fputs("\\r", stderr);
+        }
+        else if (c == '\n')
+        {
+            fputs("\\n", stderr);
+        }
+        else if (c < 0x20 || c >= 0x7F)
+        {
+            fprintf(stderr, "\\x%02x", c);
+        }
+        else
+        {
+            fputc(c, stderr);
+        }
+    }
+}
+
+static inline int test_check(int ok, const char *what, const char *file, int line)
+{
+    sTestChecks++;
+
+    if (!ok)
+    {
+        sTestFailures++;
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, what);
+    }
+
+    return ok;
+}
+
+static inline int test_check_int(long long actual, long long expected, const char *what,
+                                 const char *file, int line)
+{
+    int ok = test_check(actual == expected, what, file, line);
+
+    if (!ok)
+    {
+        fprintf(stderr, "    actual   %lld\n    expected %lld\n", actual, expected);
+    }
+
+    return ok;
+}
+
+static inline int test_check_str(const char *actual, const char *expected, const char *what,
+                                 const char *file, int line)
+{
+    int ok = test_check(actual != NULL && strcmp(actual, expected) == 0, what, file, line);
+
+    if (!ok)
+    {
+        fputs("    actual   \"", stderr);
+        test_print_escaped(actual);
+        fputs("\"\n    expected \"", stderr);
+        test_print_escaped(expected);
+        fputs("\"\n", stderr);
+    }
+
+    return ok;
+}
+
+static inline void test_run(const char *name, void (*fn)(void))
+{
+    int failures = sTestFailures;
+
+    fn();
+    printf("%-40s %s\n", name, (sTestFailures == failures) ? "ok" : "FAILED");
+}
+
+static inline int test_finish(void)
+{
+    printf("%d checks, %d failed\n", sTestChecks, sTestFailures);
+    return (sTestFailures == 0) ? 0 : 1;
+}
+
+#endif /* TEST_H */
+
+/*** end of file ***/
@@ -0,0 +1,163 @@
+/** @file test_deferred.c
+ *
+ * @brief Producer of the deferred-mode regression test (see `test_logdecode.py`).
+ *
+ * @author Ignacio Brittez
+ *
+ * Usage: test_deferred <capture> <expected> <warnings>
+ *
+ * Logs a fixed set of messages in deferred mode and writes the binary stream sent on `huart1` to
+ * `<capture>`, and the text the host decoder must rebuild from it (with `--timestamps`) to
+ * `<expected>`, except for the last record, which comes from the `radio` module. A second sink
+ * only takes warnings and errors: its stream goes to `<warnings>`.
+ */
+
+/* =======================================================================
+ * [INCLUDES]
+ * =======================================================================
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "logger_module.h"
+#include "test_module.h"
+
+/* =======================================================================
+ * [MODULE]
+ * =======================================================================
+ */
+
+LOG_MODULE_REGISTER(test, LOG_LEVEL_DEBUG);
+
+/* =======================================================================
+ * [PUBLIC DATA]
+ * =======================================================================
+ */
+
+UART_HandleTypeDef huart1;
+
+/* =======================================================================
+ * [PRIVATE DATA]
+ * =======================================================================
+ */
+
+static FILE *sExpected;
+static uint8_t sWarnings[512]; //!< Output of the LOG_LEVEL_WARNING sink
+static size_t sWarningsLen;
+
+/* =======================================================================
+ * [HELPERS]
+ * =======================================================================
+ */
+
+/*!
+ * @brief Appends the decoded form of the next record to the expected text.
+ *
+ * @param tag    Level tag, or NULL for raw output.
+ * @param module Module name, or NULL.
+ */
+static void test_expect(const char *tag, const char *module, const char *func, int line,
+                        const char *text)
+{
+    fprintf(sExpected, "[%10lu] ", (unsigned long) HAL_GetTick());
+
+    if (tag != NULL)
+    {
+        fprintf(sExpected, "[%s]", tag);
+        if (module != NULL)
+        {
+            fprintf(sExpected, "[%s]", module);
+        }
+        fprintf(sExpected, "[%s:%d]: ", func, line);
+    }
+
+    fputs(text, sExpected);
+}
+
+static void test_warning_sink(void *ctx, const uint8_t *data, size_t len)
+{
+    (void) ctx;
+
+    if (len <= sizeof(sWarnings) - sWarningsLen)
+    {
+        memcpy(&sWarnings[sWarningsLen], data, len);
+        sWarningsLen += len;
+    }
+}
+
+/** @brief Logs a message and records the text expected from the decoder. */
+#define TEST_LOG(level, tag, text, ...)                                                            \
+        do                                                                                         \
+        {                                                                                          \
+            test_expect(tag, "test", __func__, __LINE__, text); LOG_##level(__VA_ARGS__);          \
+        } while (0)
+
+/* =======================================================================
+ * [MAIN]
+ * =======================================================================
+ */
+
+int main(int argc, char **argv)
+{
+    FILE *capture;
+    FILE *warnings;
+
+    if (argc != 4)
+    {
+        fprintf(stderr, "usage: %s <capture> <expected> <warnings>\n", argv[0]);
+        return 2;
+    }
+
+    sExpected = fopen(argv[2], "w");
+    capture = fopen(argv[1], "wb");
+    warnings = fopen(argv[3], "wb");
+
+    if (sExpected == NULL || capture == NULL || warnings == NULL)
+    {
+        perror("test_deferred");
+        return 2;
+    }
+
+    stub_uart_init(&huart1, USART1, 115200);
+    stub_time_advance(5000U);
+    LOGGER_ADD_SINK(test_warning_sink, NULL, LOG_LEVEL_WARNING);
+
+    TEST_LOG(INFO, "INF", "value 42, ok\r\n", "value %d, %s\r\n", 42, "ok");
+    TEST_LOG(DEBUG, "DBG", "neg -3 0x1f 3.50\r\n", "neg %d 0x%x %.2f\r\n", -3, 0x1fU, 3.5);
+    stub_time_advance(2000U);
+    TEST_LOG(WARNING, "WRN", "wide 1234567890123 end\r\n", "wide %lld end\r\n", 1234567890123LL);
+    stub_time_advance(70000000U);
+    TEST_LOG(ERROR, "ERR", "error 7 x\r\n", "error %u %c\r\n", 7U, 'x');
+
+    // A byte buffer is sent as a pointer, never read as a string.
+    static const uint8_t kFrame[4] = {'b', 'y', 't', 'e'};
+
+    test_expect("INF", "test", __func__, __LINE__ + 1, "");
+    LOG_INFO("frame %p\r\n", kFrame);
+    fprintf(sExpected, "frame 0x%08lx\r\n", (unsigned long) (uint32_t) (uintptr_t) kFrame);
+
+    // Enough records to cross a compact synchronization point.
+    for (int i = 0; i < LOG_COMPACT_SYNC + 2; i++)
+    {
+        stub_time_advance(300U);
+        test_expect("INF", "test", __func__, __LINE__ + 1, "");
+        LOG_INFO("loop %d\r\n", -i);
+        fprintf(sExpected, "loop %d\r\n", -i);
+    }
+
+    test_expect(NULL, NULL, NULL, 0, "raw 255\r\n");
+    LOG_RAW("raw %u\r\n", 255U);
+
+    // Last record, checked on its own: its line is in test_module.c.
+    test_radio_log(9);
+
+    LOGGER_PROCESS();
+    fclose(sExpected);
+    fwrite(stub_uart_text(&huart1), 1, stub_uart_length(&huart1), capture);
+    fclose(capture);
+    fwrite(sWarnings, 1, sWarningsLen, warnings);
+    fclose(warnings);
+    return 0;
+}
+
+/*** end of file ***/
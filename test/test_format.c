@@ -0,0 +1,132 @@
+/** @file test_format.c
+ *
+ * @brief Host regression tests of the built-in formatter (`logger_format.c`).
+ *
+ * @author Ignacio Brittez
+ *
+ * Every case is formatted by log_snprintf() and by the C library, and both results must match.
+ * Very large `%f` values are only printed with about 17 exact digits by the built-in formatter:
+ * for them the length and the leading digits are compared.
+ */
+
+/* =======================================================================
+ * [INCLUDES]
+ * =======================================================================
+ */
+
+#include <math.h>
+#include "logger.h"
+#include "test.h"
+
+/* =======================================================================
+ * [PUBLIC DATA]
+ * =======================================================================
+ */
+
+UART_HandleTypeDef huart1;
+
+/* =======================================================================
+ * [HELPERS]
+ * =======================================================================
+ */
+
+/** @brief Formats a case with both formatters and checks that they agree. */
+#define TEST_FORMAT(...)                                                                           \
+        do                                                                                         \
+        {                                                                                          \
+            char expected_[128];                                                                   \
+            char actual_[128];                                                                     \
+            int expected_len_ = snprintf(expected_, sizeof(expected_), __VA_ARGS__);               \
+            int actual_len_ = log_snprintf(actual_, sizeof(actual_), __VA_ARGS__);                 \
+            TEST_CHECK_STR(actual_, expected_);                                                    \
+            TEST_CHECK_INT(actual_len_, expected_len_);                                            \
+        } while (0)
+
+/* =======================================================================
+ * [TESTS]
+ * =======================================================================
+ */
+
+static void test_integers(void)
+{
+    TEST_FORMAT("%d %i %u", -42, 17, 3000000000U);
+    TEST_FORMAT("[%5d] [%-5d] [%05d] [%+d] [% d] [%.3d] [%.0d]", 42, 42, -42, 7, 7, 5, 0);
+    TEST_FORMAT("%x %X %#x %#o %o %08.3x", 0xbeefU, 0xbeefU, 255U, 8U, 0U, 0xabU);
+    TEST_FORMAT("%ld %lu %lld %llu", -5L, 5UL, -1234567890123LL, 18446744073709551615ULL);
+    TEST_FORMAT("%zu %td %jd", (size_t) 12, (ptrdiff_t) -3, (intmax_t) -9);
+    TEST_FORMAT("%*d|%-*d|%.*d", 6, 1, 4, 2, 3, 3);
+}
+
+static void test_short_lengths(void)
+{
+    // Arguments are promoted to int: h and hh convert them back to the narrow type.
+    TEST_FORMAT("%hhx %hhu %hhd %hhd", -1, 300, 200, -1);
+    TEST_FORMAT("%hx %hu %hd %hd", -1, -1, 70000, 40000);
+    TEST_FORMAT("%hho %#hhx %hhX", 511, 0x1ff, 0xabc);
+    TEST_FORMAT("%5hhu|%-6hd|%04hx", 257, -2, 0x12345);
+}
+
+static void test_strings(void)
+{
+    TEST_FORMAT("%s|%8s|%-8s|%.2s|%c%c", "log", "log", "log", "log", 'o', 'k');
+    TEST_FORMAT("%%|%5c|%-3c|", 'a', 'b');
+}
+
+static void test_fixed(void)
+{
+    TEST_FORMAT("%f %.2f %.0f %#.0f", 3.14159, -2.5, 2.6, 3.0);
+    TEST_FORMAT("%8.3f|%-8.3f|%08.3f|%+.1f|% .1f", 1.5, 1.5, -1.5, 2.0, 2.0);
+    TEST_FORMAT("%.9f %.3f %f", 0.123456789, 999.9995, 0.0);
+    TEST_FORMAT("%f %.1f", 1e15, 123456789012345678.0);
+    TEST_FORMAT("%f %f %5f %-6f|", INFINITY, -INFINITY, INFINITY, -INFINITY);
+
+    // Powers of ten are exact down to 1e22.
+    TEST_FORMAT("%f %.2f %f", 1e19, -1e20, 1e22);
+    TEST_FORMAT("%30.1f|%-30.1f|%030.1f", 2e19, 2e19, -2e19);
+}
+
+static void test_large_fixed(void)
+{
+    static const double kValues[] = {1.8446744073709552e19, 3.5e19, -6.02214076e23, 1e100,
+                                     1.7976931348623157e308};
+
+    for (size_t i = 0; i < sizeof(kValues) / sizeof(kValues[0]); i++)
+    {
+        char expected[400];
+        char actual[400];
+        int expected_len = snprintf(expected, sizeof(expected), "%.3f", kValues[i]);
+        int actual_len = log_snprintf(actual, sizeof(actual), "%.3f", kValues[i]);
+
+        TEST_CHECK_INT(actual_len, expected_len);
+        TEST_CHECK(strncmp(actual, expected, 15) == 0);
+        TEST_CHECK_STR(actual + actual_len - 4, ".000");
+    }
+}
+
+static void test_truncation(void)
+{
+    char buf[8];
+
+    TEST_CHECK_INT(log_snprintf(buf, sizeof(buf), "%s-%d", "abcdef", 123), 10);
+    TEST_CHECK_STR(buf, "abcdef-");
+    TEST_CHECK_INT(log_snprintf(NULL, 0, "%f", 1e25), 33);
+}
+
+/* =======================================================================
+ * [MAIN]
+ * =======================================================================
+ */
+
+int main(void)
+{
+    TEST_RUN(test_integers);
+    TEST_RUN(test_short_lengths);
+    TEST_RUN(test_strings);
+    TEST_RUN(test_fixed);
+    TEST_RUN(test_large_fixed);
+    TEST_RUN(test_truncation);
+
+    return test_finish();
+}
+
+/*** end of file ***/
@@ -0,0 +1,124 @@
+#!/usr/bin/env python3
+"""Regression test of tools/logdecode.py against a host build of the deferred mode.
+
+Usage:
+    python3 test/test_logdecode.py <test_deferred binary> [--cobs] [--compact]
+
+Runs the producer (test/test_deferred.c), decodes its capture with the symbols of the same binary
+and compares the result with the text the producer expects.
+"""
+
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import unittest
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "tools"))
+
+import logdecode  # noqa: E402
+
+BINARY = None
+COBS = False
+COMPACT = False
+
+
+def decode(capture, **options):
+    """Decodes a whole capture, returns the text and the notes."""
+    decoder = logdecode.Decoder(logdecode.ElfImage(BINARY), timestamps=True, compact=COMPACT,
+                                **options)
+    notes = []
+
+    def note(text):
+        decoder.resync()
+        notes.append(text)
+
+    payloads = logdecode.frames([capture], note) if COBS else logdecode.records([capture])
+    return "".join(decoder.decode(payload) for payload in payloads), notes
+
+
+class DeferredTest(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        with tempfile.TemporaryDirectory() as tmp:
+            capture = os.path.join(tmp, "capture.bin")
+            expected = os.path.join(tmp, "expected.txt")
+            warnings = os.path.join(tmp, "warnings.bin")
+            subprocess.run([BINARY, capture, expected, warnings], check=True)
+            with open(capture, "rb") as f:
+                cls.capture = f.read()
+            with open(warnings, "rb") as f:
+                cls.warnings = f.read()
+            with open(expected, "r", newline="") as f:
+                cls.expected = f.read()
+
+    def test_records(self):
+        text, notes = decode(self.capture)
+        self.assertEqual(notes, [])
+        self.assertTrue(text.startswith(self.expected))
+        self.assertRegex(text[len(self.expected):],
+                         r"^\[ *\d+\] \[INF\]\[radio\]\[test_radio_log:\d+\]: radio 9\r\n$")
+
+    def test_seconds(self):
+        text, _ = decode(self.capture, ts_hz=1000.0)
+        self.assertRegex(text, r"^\[\d+\.\d{6}\] \[")
+
+    def test_filters(self):
+        text, _ = decode(self.capture, min_level=2)
+        self.assertEqual(re.findall(r"\[(DBG|INF|WRN|ERR)\]", text), ["WRN", "ERR"])
+        self.assertIn("raw 255\r\n", text)
+
+        text, _ = decode(self.capture, modules=["radio"])
+        self.assertEqual(text.count("\r\n"), 1)
+        self.assertIn("radio 9", text)
+
+    def test_sink_level(self):
+        # The records below the level of the sink leave no gap and no wrong delta in its stream.
+        text, notes = decode(self.warnings)
+        self.assertEqual(notes, [])
+        self.assertEqual(re.findall(r"\[(DBG|INF|WRN|ERR)\]", text), ["WRN", "ERR"])
+
+        def warnings(text):
+            return [line for line in text.splitlines() if "[WRN]" in line or "[ERR]" in line]
+
+        self.assertEqual(warnings(text), warnings(decode(self.capture)[0]))
+
+    def test_damaged_record(self):
+        # Truncated headers are reported, in both encodings, instead of stopping the decoder.
+        for compact, payload in ((True, b"\x80"), (False, b"\x01\x02")):
+            text = logdecode.Decoder(None, compact=compact).decode(payload)
+            self.assertTrue(text.startswith("<undecodable record: "), text)
+
+    @unittest.skipUnless("--cobs" in sys.argv, "COBS framing only")
+    def test_reordered_frames(self):
+        # A frame overtaken by the next one (a preempted writer) is put back in place, not lost.
+        frames = self.capture.split(b"\0")
+        frames[1], frames[2] = frames[2], frames[1]
+        self.assertEqual(decode(b"\0".join(frames)), decode(self.capture))
+
+    @unittest.skipUnless("--cobs" in sys.argv, "COBS framing only")
+    def test_lost_frame(self):
+        # Dropping the second frame shows up as one lost record, the rest still decodes.
+        frames = self.capture.split(b"\0")
+        text, notes = decode(b"\0".join(frames[:1] + frames[2:]))
+        self.assertEqual(notes, ["<1 records lost>\n"])
+        self.assertNotIn("neg -3", text)
+        self.assertIn("wide 1234567890123 end", text)
+
+    @unittest.skipUnless("--cobs" in sys.argv, "COBS framing only")
+    def test_corrupted_frame(self):
+        frames = self.capture.split(b"\0")
+        frames[0] = frames[0][:-1] + bytes([frames[0][-1] ^ 0x55])
+        text, notes = decode(b"\0".join(frames))
+        self.assertEqual(notes[0], "<corrupted frame>\n")
+        self.assertNotIn("value 42", text)
+        self.assertIn("neg -3", text)
+
+
+if __name__ == "__main__":
+    BINARY = sys.argv[1]
+    COBS = "--cobs" in sys.argv
+    COMPACT = "--compact" in sys.argv
+    unittest.main(argv=[sys.argv[0]])
@@ -0,0 +1,893 @@
+/** @file test_logger.c
+ *
+ * @brief Host regression tests of the logger, built once per configuration (see CMakeLists.txt).
+ *
+ * @author Ignacio Brittez
+ *
+ * Every test logs through the public macros and checks the bytes captured by the HAL stub on
+ * `huart1`. test_output() first lets the backend finish: it completes the DMA transfers in DMA
+ * mode and runs the logger task in RTOS mode. The panic test goes last: the logger stays in panic
+ * mode afterwards.
+ */
+
+/* =======================================================================
+ * [INCLUDES]
+ * =======================================================================
+ */
+
+#include <setjmp.h>
+#include "logger_module.h"
+#include "test.h"
+#include "test_module.h"
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+#include "task.h"
+#endif
+
+/* =======================================================================
+ * [MODULE]
+ * =======================================================================
+ */
+
+LOG_MODULE_REGISTER(test, LOG_LEVEL_DEBUG);
+
+/* =======================================================================
+ * [PUBLIC DATA]
+ * =======================================================================
+ */
+
+UART_HandleTypeDef huart1;
+UART_HandleTypeDef huart2;
+
+/* =======================================================================
+ * [PRIVATE DATA]
+ * =======================================================================
+ */
+
+/** @brief IPSR of the simulated interrupt handler (EXTI0). */
+#define TEST_IRQ (16U + 6U)
+
+static char sSink[2048]; //!< Bytes received by test_sink()
+static size_t sSinkLen;
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+static jmp_buf sTaskExit;
+static int sTaskYields;
+static void (*sTaskHook)(void); //!< Run by test_task_yield() while the task waits
+#if LOG_BATCH_SIZE > 0
+static int sBatchIdle; //!< LOGGER_IS_IDLE() while the task gathers a batch
+#endif
+#endif
+
+/* =======================================================================
+ * [HELPERS]
+ * =======================================================================
+ */
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+    LOGGER_TX_CPLT_CALLBACK(huart);
+}
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+
+/*!
+ * @brief Leaves LOGGER_TASK() once the queue and the staging slots are empty.
+ */
+static void test_task_yield(void)
+{
+    if (sTaskHook != NULL)
+    {
+        sTaskHook();
+    }
+
+    // The first empty receive lets the task drain the staging slots, the second one leaves.
+    if (++sTaskYields >= 2)
+    {
+        longjmp(sTaskExit, 1);
+    }
+}
+
+static void test_task_run(void)
+{
+    sTaskYields = 0;
+    stub_task_yield = test_task_yield;
+
+    if (setjmp(sTaskExit) == 0)
+    {
+        LOGGER_TASK(NULL);
+    }
+
+    stub_task_yield = NULL;
+}
+
+/*!
+ * @brief Lets the logger task run while a task waits in LOGGER_FLUSH().
+ */
+static void test_flush_yield(void)
+{
+    test_task_run();
+    stub_task_yield = test_flush_yield;
+}
+
+#if LOG_BATCH_SIZE > 0
+
+/*!
+ * @brief Samples LOGGER_IS_IDLE() at the first wait of the task, for the next record of a batch.
+ */
+static void test_batch_idle_hook(void)
+{
+    sBatchIdle = LOGGER_IS_IDLE();
+    sTaskHook = NULL;
+}
+
+/*!
+ * @brief Faults at the first wait of the task, with a line in the batch and one in the queue.
+ *
+ * The task never resumes, as after a real fault.
+ */
+static void test_batch_panic_hook(void)
+{
+    sTaskHook = NULL;
+    LOG_INFO("second\r\n");
+    LOGGER_PANIC_FLUSH();
+    longjmp(sTaskExit, 1);
+}
+
+#endif // LOG_BATCH_SIZE > 0
+
+#endif // LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+
+/*!
+ * @brief Lets the backend send everything queued so far.
+ */
+static void test_drain(void)
+{
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+    stub_dma_run();
+#elif LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+    test_task_run();
+#else
+    LOGGER_PROCESS();
+#endif
+}
+
+/*!
+ * @brief Returns everything `huart` sent since the last test_reset().
+ */
+static const char *test_output_of(UART_HandleTypeDef *huart)
+{
+    test_drain();
+    return stub_uart_text(huart);
+}
+
+static const char *test_output(void)
+{
+    return test_output_of(&huart1);
+}
+
+/*!
+ * @brief Returns the output with the timestamp prefixes ("[seconds.micros]") of its lines removed.
+ */
+static const char *test_untimed(const char *out)
+{
+    static char text[2048];
+    size_t len = 0;
+    int line_start = 1;
+
+    while (*out != '\0' && len < sizeof(text) - 1)
+    {
+        size_t skip = (line_start && *out == '[') ? strspn(out + 1, "0123456789.") : 0;
+
+        if (skip > 0 && out[1 + skip] == ']')
+        {
+            out += skip + 2;
+        }
+
+        line_start = (*out == '\n');
+        text[len++] = *out++;
+    }
+
+    text[len] = '\0';
+    return text;
+}
+
+/*!
+ * @brief Sends whatever is pending and clears the captures and the test sink.
+ */
+static void test_reset(void)
+{
+    test_drain();
+    stub_uart_clear(&huart1);
+    stub_uart_clear(&huart2);
+    sSinkLen = 0;
+    sSink[0] = '\0';
+}
+
+static void test_sink(void *ctx, const uint8_t *data, size_t len)
+{
+    (void) ctx;
+
+    if (sSinkLen + len < sizeof(sSink))
+    {
+        memcpy(&sSink[sSinkLen], data, len);
+        sSinkLen += len;
+        sSink[sSinkLen] = '\0';
+    }
+}
+
+/*!
+ * @brief Builds the line the logger prints for a message, with the configured prefix.
+ */
+static const char *test_line(log_level_t level, const char *module, const char *func, int line,
+                             const char *text)
+{
+    static const char *const kColor[] = {KWHT, KGRN, KYEL, KRED};
+    static const char *const kTag[] = {"[DBG]", "[INF]", "[WRN]", "[ERR]"};
+    static char out[512];
+    size_t len = 0;
+
+    (void) module;
+    (void) func;
+    (void) line;
+    out[0] = '\0';
+
+#if LOG_PREFIX_COLOR
+    len += (size_t) snprintf(out + len, sizeof(out) - len, "%s", kColor[level]);
+#else
+    (void) kColor;
+#endif
+#if LOG_PREFIX_LEVEL == LOG_PREFIX_LEVEL_CHAR
+    len += (size_t) snprintf(out + len, sizeof(out) - len, "%c", kTag[level][1]);
+#else
+    len += (size_t) snprintf(out + len, sizeof(out) - len, "%s", kTag[level]);
+#endif
+#if LOG_PREFIX_MODULE == LOG_PREFIX_MODULE_NAME
+    if (module != NULL)
+    {
+        len += (size_t) snprintf(out + len, sizeof(out) - len, "[%s]", module);
+    }
+#elif LOG_PREFIX_MODULE == LOG_PREFIX_MODULE_ID
+    for (size_t id = 0; module != NULL && id < LOG_MODULE_COUNT(); id++)
+    {
+        if (strcmp(LOG_MODULE_GET(id)->name, module) == 0)
+        {
+            len += (size_t) snprintf(out + len, sizeof(out) - len, "[%u]", (unsigned) id);
+        }
+    }
+#endif
+#if LOG_PREFIX_FUNC && LOG_PREFIX_LINE
+    len += (size_t) snprintf(out + len, sizeof(out) - len, "[%s:%d]", func, line);
+#elif LOG_PREFIX_FUNC
+    len += (size_t) snprintf(out + len, sizeof(out) - len, "[%s]", func);
+#elif LOG_PREFIX_LINE
+    len += (size_t) snprintf(out + len, sizeof(out) - len, "[%d]", line);
+#endif
+
+    len += (size_t) snprintf(out + len, sizeof(out) - len, ": %s%s%s",
+                             (LOG_PREFIX_COLOR && level != LOG_LEVEL_DEBUG) ? KNRM : "", text,
+                             (LOG_PREFIX_COLOR && level == LOG_LEVEL_DEBUG) ? KNRM : "");
+    return out;
+}
+
+/*!
+ * @brief Counts the occurrences of `needle` in `haystack`.
+ */
+static int test_count(const char *haystack, const char *needle)
+{
+    int count = 0;
+
+    for (const char *p = haystack; (p = strstr(p, needle)) != NULL; p += strlen(needle))
+    {
+        count++;
+    }
+
+    return count;
+}
+
+/* =======================================================================
+ * [TESTS]
+ * =======================================================================
+ */
+
+static void test_format(void)
+{
+    char expected[1024];
+    int line;
+
+    test_reset();
+    LOG_INFO("value %d, %s\r\n", 42, "ok");
+    line = __LINE__ - 1;
+    TEST_CHECK_STR(test_untimed(test_output()),
+                   test_line(LOG_LEVEL_INFO, "test", __func__, line, "value 42, ok\r\n"));
+
+    test_reset();
+    LOG_DEBUG("debug %u\r\n", 7U);
+    line = __LINE__ - 1;
+    TEST_CHECK_STR(test_untimed(test_output()),
+                   test_line(LOG_LEVEL_DEBUG, "test", __func__, line, "debug 7\r\n"));
+
+    test_reset();
+    LOG_WARNING("w\r\n");
+    line = __LINE__ - 1;
+    snprintf(expected, sizeof(expected), "%s",
+             test_line(LOG_LEVEL_WARNING, "test", __func__, line, "w\r\n"));
+    LOG_ERROR("e\r\n");
+    line = __LINE__ - 1;
+    strncat(expected, test_line(LOG_LEVEL_ERROR, "test", __func__, line, "e\r\n"),
+            sizeof(expected) - strlen(expected) - 1);
+    TEST_CHECK_STR(test_untimed(test_output()), expected);
+
+#if LOG_PREFIX_MODULE == LOG_PREFIX_MODULE_ID
+    // The ID found for the first message is cached in the instance.
+    TEST_CHECK(CURRENT_LOG_MODULE->id != 0);
+    TEST_CHECK_INT(log_module_id(CURRENT_LOG_MODULE), CURRENT_LOG_MODULE->id - 1);
+    TEST_CHECK(LOG_MODULE_GET((size_t) log_module_id(CURRENT_LOG_MODULE)) == CURRENT_LOG_MODULE);
+#endif
+
+    test_reset();
+    LOG_RAW("raw %04x\r\n", 0xbeefU);
+    TEST_CHECK_STR(test_output(), "raw beef\r\n");
+}
+
+static void test_levels(void)
+{
+    test_reset();
+    LOG_MODULE_SET_LEVEL(LOG_MODULE_NAME(test), LOG_LEVEL_WARNING);
+    LOG_INFO("hidden\r\n");
+    LOG_WARNING("shown\r\n");
+    TEST_CHECK(strstr(test_output(), "hidden") == NULL);
+    TEST_CHECK(strstr(test_output(), "shown") != NULL);
+    TEST_CHECK(!LOG_ENABLED(LOG_LEVEL_INFO));
+
+    test_reset();
+    LOG_MODULE_SET_LEVEL(LOG_MODULE_NAME(test), LOG_LEVEL_DEBUG);
+    LOGGER_SET_LOGGING_LEVEL(LOG_LEVEL_ERROR);
+    LOG_WARNING("hidden\r\n");
+    LOG_ERROR("shown\r\n");
+    LOG_RAW("raw\r\n");
+    TEST_CHECK(strstr(test_output(), "hidden") == NULL);
+    TEST_CHECK(strstr(test_output(), "shown") != NULL);
+    TEST_CHECK(strstr(test_output(), "raw\r\n") != NULL);
+
+    // An initialized definition of gLogLevel never goes through LOGGER_SET_LOGGING_LEVEL().
+    LOGGER_SET_LOGGING_LEVEL(LOG_LEVEL_DEBUG);
+    test_reset();
+    gLogLevel = LOG_LEVEL_WARNING;
+    LOG_INFO("hidden\r\n");
+    LOG_WARNING("shown\r\n");
+    TEST_CHECK(strstr(test_output(), "hidden") == NULL);
+    TEST_CHECK(strstr(test_output(), "shown") != NULL);
+    TEST_CHECK_INT(CURRENT_LOG_MODULE->threshold, LOG_LEVEL_WARNING);
+
+    LOGGER_SET_LOGGING_LEVEL(LOG_LEVEL_DEBUG);
+    TEST_CHECK(LOG_ENABLED(LOG_LEVEL_DEBUG));
+}
+
+static void test_truncation(void)
+{
+    char text[LOG_BUFFER_SIZE * 2];
+    uint32_t truncated = LOGGER_GET_TRUNCATED();
+
+    memset(text, 'x', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+
+    test_reset();
+    LOG_INFO("%s\r\n", text);
+
+    const char *out = test_output();
+    size_t len = strlen(out);
+
+    TEST_CHECK_INT(len, LOG_BUFFER_SIZE - 1);
+    TEST_CHECK(len >= 5 && strcmp(out + len - 5, "...\r\n") == 0);
+    TEST_CHECK_INT(LOGGER_GET_TRUNCATED(), truncated + 1);
+
+    // The color reset of DEBUG lines is kept after the marker.
+    const char *end = LOG_PREFIX_COLOR ? "...\r\n" KNRM : "...\r\n";
+
+    test_reset();
+    LOG_DEBUG("%s\r\n", text);
+    out = test_output();
+    len = strlen(out);
+
+    TEST_CHECK_INT(len, LOG_BUFFER_SIZE - 1);
+    TEST_CHECK(len >= strlen(end) && strcmp(out + len - strlen(end), end) == 0);
+    TEST_CHECK_INT(LOGGER_GET_TRUNCATED(), truncated + 2);
+
+#if LOG_PREFIX_FUNC
+    // A prefix that fills the line is counted too.
+    test_reset();
+    log_emit(LOG_LEVEL_INFO, NULL, text, __LINE__, "lost\r\n");
+    TEST_CHECK(strstr(test_output(), "lost") == NULL);
+    TEST_CHECK_INT(strlen(test_output()), LOG_BUFFER_SIZE - 1);
+    TEST_CHECK_INT(LOGGER_GET_TRUNCATED(), truncated + 3);
+#endif
+}
+
+#if LOG_TIMESTAMP == LOG_TIMESTAMP_DWT
+
+static void test_timestamp(void)
+{
+    char expected[32];
+
+    // Past 2^64 / 10^6 cycles (71 hours at 72 MHz), which overflowed the microsecond conversion.
+    for (int i = 0; i < 5000; i++)
+    {
+        DWT->CYCCNT = 0xFFFFFFFFU;
+        (void) LOGGER_GET_TIMESTAMP();
+        DWT->CYCCNT = 0;
+        (void) LOGGER_GET_TIMESTAMP();
+    }
+
+    DWT->CYCCNT = SystemCoreClock / 2U + 7U;
+    uint64_t now = LOGGER_GET_TIMESTAMP();
+
+    TEST_CHECK(now > UINT64_MAX / 1000000U);
+    snprintf(expected, sizeof(expected), "[%lu.%06lu]", (unsigned long) (now / SystemCoreClock),
+             (unsigned long) (now % SystemCoreClock / (SystemCoreClock / 1000000U)));
+
+    test_reset();
+    LOG_INFO("timed\r\n");
+    TEST_CHECK(strncmp(test_output(), expected, strlen(expected)) == 0);
+
+    DWT->CYCCNT = 0;
+}
+
+#endif
+
+static void test_hexdump(void)
+{
+    uint8_t data[20];
+
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (uint8_t) (i + 0x3E);
+    }
+
+    test_reset();
+    LOG_HEXDUMP(LOG_LEVEL_INFO, data, sizeof(data));
+
+    const char *out = test_output();
+
+    TEST_CHECK(strstr(out, "20 bytes\r\n") != NULL);
+    TEST_CHECK(strstr(out, "  0000: 3e 3f 40 41 42 43 44 45 46 47 48 49 4a 4b 4c 4d  "
+                           ">?@ABCDEFGHIJKLM\r\n") != NULL);
+    TEST_CHECK(strstr(out, "  0010: 4e 4f 50 51                                      "
+                           "NOPQ\r\n") != NULL);
+
+#if LOGGER_OUTPUT_MODE != LOGGER_OUTPUT_DMA
+    // From an interrupt handler the dump is cut to fit in the staging slots.
+    uint8_t large[LOG_ISR_SLOTS * LOG_HEXDUMP_ROW];
+    uint32_t dropped = LOGGER_GET_DROPPED();
+    size_t rows = (LOG_ISR_SLOTS > 2) ? LOG_ISR_SLOTS - 2 : 0;
+    char more[32];
+
+    memset(large, 0x55, sizeof(large));
+    snprintf(more, sizeof(more), "  ... %u more bytes\r\n",
+             (unsigned) (sizeof(large) - rows * LOG_HEXDUMP_ROW));
+
+    test_reset();
+    stub_irq_enter(TEST_IRQ);
+    LOG_HEXDUMP(LOG_LEVEL_INFO, large, sizeof(large));
+    stub_irq_exit();
+    out = test_output();
+
+    TEST_CHECK_INT(LOGGER_GET_DROPPED(), dropped);
+    TEST_CHECK_INT(test_count(out, "\r\n"), (int) rows + 2);
+    TEST_CHECK(strstr(out, more) != NULL);
+#endif
+}
+
+static void test_interrupts(void)
+{
+    uint32_t dropped = LOGGER_GET_DROPPED();
+
+    test_reset();
+    stub_irq_enter(TEST_IRQ);
+    LOG_INFO("from isr\r\n");
+    stub_irq_exit();
+    LOG_INFO("from thread\r\n");
+
+    const char *out = test_output();
+    const char *isr = strstr(out, "from isr\r\n");
+    const char *thread = strstr(out, "from thread\r\n");
+
+    TEST_CHECK(isr != NULL && thread != NULL);
+#if LOGGER_OUTPUT_MODE != LOGGER_OUTPUT_RTOS
+    // The task drains the staging slots after the queue; the other modes keep the order.
+    TEST_CHECK(isr < thread);
+#endif
+
+#if LOGGER_OUTPUT_MODE != LOGGER_OUTPUT_DMA
+    stub_uart_stats_t stats;
+
+    // Interrupt handlers never call the HAL, only fill LOG_ISR_SLOTS slots.
+    test_reset();
+    stub_irq_enter(TEST_IRQ);
+
+    for (int i = 0; i < LOG_ISR_SLOTS + 1; i++)
+    {
+        LOG_INFO("burst %d\r\n", i);
+    }
+
+    stub_irq_exit();
+    stub_uart_stats(&huart1, &stats);
+
+    TEST_CHECK_INT(stats.from_isr, 0);
+    TEST_CHECK_INT(LOGGER_GET_DROPPED(), dropped + 1);
+    TEST_CHECK_INT(test_count(test_output(), "burst"), LOG_ISR_SLOTS);
+#else
+    (void) dropped;
+#endif
+}
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+
+static void test_ring(void)
+{
+    stub_uart_stats_t before;
+    stub_uart_stats_t after;
+    uint32_t dropped = LOGGER_GET_DROPPED();
+    int sent = 0;
+
+    // The chain must not cross the end of the ring, where a transfer is split: pad up to it.
+    stub_uart_stats(&huart1, &before);
+
+    for (int room = LOG_RING_SIZE - (int) (before.bytes % LOG_RING_SIZE); room < 256;)
+    {
+        int pad = (room < 64) ? room : 64;
+
+        LOG_RAW("%*s", pad, "");
+        room = (room == pad) ? LOG_RING_SIZE : room - pad;
+    }
+
+    // The first message starts a transfer, the next ones wait in the ring for its completion.
+    test_reset();
+    stub_uart_stats(&huart1, &before);
+
+    for (int i = 0; i < 3; i++)
+    {
+        LOG_INFO("chain %d\r\n", i);
+    }
+
+    TEST_CHECK_INT(test_count(test_output(), "chain"), 3);
+    stub_uart_stats(&huart1, &after);
+    TEST_CHECK_INT(after.calls - before.calls, 2);
+
+    // Whole messages only: those that do not fit are dropped and counted.
+    test_reset();
+
+    for (int i = 0; i < LOG_RING_SIZE / 8; i++)
+    {
+        LOG_INFO("fill %d\r\n", i);
+    }
+
+    sent = test_count(test_output(), "\r\n");
+    TEST_CHECK(sent > 0 && sent < LOG_RING_SIZE / 8);
+    TEST_CHECK_INT(LOGGER_GET_DROPPED(), dropped + (uint32_t) (LOG_RING_SIZE / 8 - sent));
+}
+
+#endif // LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+
+static void test_queue(void)
+{
+    log_queue_stats_t stats;
+
+    test_reset();
+    LOG_INFO("queued 1\r\n");
+    LOG_INFO("queued 2\r\n");
+
+    TEST_CHECK_STR(stub_uart_text(&huart1), "");
+    TEST_CHECK_INT(test_count(test_output(), "queued"), 2);
+
+    LOGGER_GET_QUEUE_STATS(&stats);
+    TEST_CHECK(stats.high_water >= 2);
+    TEST_CHECK_INT(stats.dropped, 0);
+
+    // Once every slot is taken the next line is dropped; the task gives them all back.
+    for (int round = 0; round < 2; round++)
+    {
+        test_reset();
+
+        for (int i = 0; i < LOG_QUEUE_DEPTH + 1; i++)
+        {
+            LOG_INFO("slot %d\r\n", i);
+        }
+
+        TEST_CHECK_INT(test_count(test_output(), "\r\n"), LOG_QUEUE_DEPTH);
+        LOGGER_GET_QUEUE_STATS(&stats);
+        TEST_CHECK_INT(stats.dropped, round + 1);
+    }
+
+    // LOGGER_FLUSH() returns once the task has transmitted everything, staged lines included.
+    test_reset();
+    LOG_INFO("flushed 1\r\n");
+    stub_irq_enter(TEST_IRQ);
+    LOG_INFO("flushed 2\r\n");
+    stub_irq_exit();
+    stub_task_yield = test_flush_yield;
+    LOGGER_FLUSH();
+    stub_task_yield = NULL;
+    TEST_CHECK_INT(test_count(stub_uart_text(&huart1), "flushed"), 2);
+
+#if LOG_BATCH_SIZE > 0
+    // Not idle while the task waits for more records: the batch is not sent yet.
+    test_reset();
+    LOG_INFO("batched\r\n");
+    sBatchIdle = -1;
+    sTaskHook = test_batch_idle_hook;
+    test_task_run();
+    TEST_CHECK_INT(sBatchIdle, 0);
+    TEST_CHECK_INT(test_count(stub_uart_text(&huart1), "batched"), 1);
+    TEST_CHECK(LOGGER_IS_IDLE());
+#endif
+}
+
+#endif // LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+
+static void test_sinks(void)
+{
+    int sink = LOGGER_ADD_SINK(test_sink, NULL, LOG_LEVEL_WARNING);
+
+    TEST_CHECK(sink > LOG_SINK_UART);
+
+    test_reset();
+    LOG_INFO("info\r\n");
+    LOG_WARNING("warning\r\n");
+    LOG_RAW("raw\r\n");
+
+    TEST_CHECK(strstr(sSink, "info") == NULL);
+    TEST_CHECK(strstr(sSink, "warning") != NULL);
+    TEST_CHECK(strstr(sSink, "raw") != NULL);
+    TEST_CHECK_INT(test_count(test_output(), "\r\n"), 3);
+
+    LOGGER_SET_SINK_LEVEL(sink, LOG_LEVEL_OFF);
+    test_reset();
+    LOG_ERROR("error\r\n");
+    TEST_CHECK_STR(sSink, "");
+
+    // A blocking UART sink never transmits from an interrupt handler.
+    int uart = LOGGER_ADD_SINK(log_sink_uart_blocking, &huart2, LOG_LEVEL_ERROR);
+    uint32_t dropped = LOGGER_GET_DROPPED();
+    stub_uart_stats_t before;
+    stub_uart_stats_t after;
+
+    TEST_CHECK(uart > sink);
+    test_reset();
+    stub_uart_stats(&huart2, &before);
+    stub_irq_enter(TEST_IRQ);
+    LOG_ERROR("from isr\r\n");
+    stub_irq_exit();
+    stub_uart_stats(&huart2, &after);
+    TEST_CHECK_INT(after.from_isr - before.from_isr, 0);
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+    TEST_CHECK_STR(test_output_of(&huart2), "");
+    TEST_CHECK_INT(LOGGER_GET_DROPPED(), dropped + 1);
+#else
+    TEST_CHECK(strstr(test_output_of(&huart2), "from isr\r\n") != NULL);
+    TEST_CHECK_INT(LOGGER_GET_DROPPED(), dropped);
+#endif
+
+    LOGGER_SET_SINK_LEVEL(uart, LOG_LEVEL_OFF);
+
+    // The ITM sink gives up on a FIFO that nobody drains instead of waiting forever.
+    ITM->TCR = ITM_TCR_ITMENA_Msk;
+    ITM->TER = 1U;
+    ITM->PORT[0].u32 = 0;
+    log_sink_itm((void *) 0, (const uint8_t *) "itm\r\n", 5);
+    TEST_CHECK_INT(ITM->PORT[0].u32, 0);
+    TEST_CHECK_INT(__get_PRIMASK(), 0);
+
+    ITM->PORT[0].u32 = 1;
+    log_sink_itm((void *) 0, (const uint8_t *) "itm\r\n", 5);
+    TEST_CHECK_INT(ITM->PORT[0].u8, '\n');
+    ITM->TCR = 0;
+}
+
+/*!
+ * @brief A single rate-limited call site: each one keeps its own budget.
+ */
+static void test_tick(int i)
+{
+    LOG_INFO_RATELIMIT(2, "tick %d\r\n", i);
+}
+
+static void test_ratelimit(void)
+{
+    test_reset();
+    stub_time_advance(1000000U);
+
+    for (int i = 0; i < 5; i++)
+    {
+        test_tick(i);
+    }
+
+    TEST_CHECK_INT(test_count(test_output(), "\r\n"), 2);
+
+    test_reset();
+    stub_time_advance(1000000U);
+    test_tick(5);
+    TEST_CHECK(strstr(test_output(), "3 messages suppressed\r\n") != NULL);
+
+    // Spent just before the tick count wraps: reaching tick 0 does not refill the bucket.
+    test_reset();
+    stub_time_advance((1ULL << 32) * 1000U - 100000U - stub_time_us());
+    test_tick(6);
+    test_tick(7);
+    stub_time_advance((1ULL << 32) * 1000U - stub_time_us());
+    test_tick(8);
+    stub_time_advance(1000U);
+    test_tick(9);
+    TEST_CHECK(strstr(test_output(), "tick 7\r\n") != NULL);
+    TEST_CHECK(strstr(test_output(), "tick 9\r\n") == NULL);
+}
+
+static void test_shell(void)
+{
+    test_reset();
+    LOGGER_SHELL_EXEC("log set test wrn");
+    TEST_CHECK_STR(test_output(), "test wrn\r\n");
+    LOG_INFO("hidden\r\n");
+    TEST_CHECK(strstr(test_output(), "hidden") == NULL);
+
+    test_reset();
+    LOGGER_SHELL_EXEC("log list");
+    TEST_CHECK(strstr(test_output(), "global dbg\r\n") != NULL);
+    TEST_CHECK(strstr(test_output(), " test wrn") != NULL);
+    TEST_CHECK(strstr(test_output(), " radio dbg") != NULL);
+
+    test_reset();
+    LOGGER_SHELL_EXEC("log set 99 dbg");
+    LOGGER_SHELL_EXEC("log set test loud");
+    LOGGER_SHELL_EXEC("log global off");
+    TEST_CHECK_STR(test_output(),
+                   "unknown module 99\r\nunknown level loud\r\nunknown level off\r\n");
+
+    // Extra words are rejected, not glued to the last one.
+    test_reset();
+    LOGGER_SHELL_EXEC("log set test wrn extra");
+    TEST_CHECK(strstr(test_output(), "usage: ") == test_output());
+    LOGGER_SHELL_EXEC("log set test err ");
+    TEST_CHECK(strstr(test_output(), "test err\r\n") != NULL);
+
+    test_reset();
+    LOGGER_SHELL_RX('l');
+    LOGGER_SHELL_RX('o');
+    LOGGER_SHELL_RX('g');
+    for (const char *p = " set test dbg\r"; *p; p++)
+    {
+        LOGGER_SHELL_RX((uint8_t) *p);
+    }
+    LOGGER_SHELL_PROCESS();
+    TEST_CHECK_STR(test_output(), "test dbg\r\n");
+}
+
+#if LOG_MAX_CHANNELS > 1
+
+static void test_channels(void)
+{
+    log_channel_stats_t stats;
+
+    // Silent until the channel is initialized.
+    test_reset();
+    test_radio_log(1);
+    TEST_CHECK_STR(test_output(), "");
+    TEST_CHECK_STR(test_output_of(&huart2), "");
+
+    TEST_CHECK_INT(LOGGER_CHANNEL_INIT(1, log_sink_uart_dma, &huart2, LOG_LEVEL_DEBUG), 0);
+    test_radio_log(2);
+    LOG_INFO("console\r\n");
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+    // Posted to the logger task: the producer never waits for USART2.
+    TEST_CHECK_STR(stub_uart_text(&huart2), "");
+#endif
+
+    TEST_CHECK(strstr(test_output_of(&huart2), "radio 2\r\n") != NULL);
+    TEST_CHECK(strstr(test_output_of(&huart2), "console") == NULL);
+    TEST_CHECK(strstr(test_output(), "radio") == NULL);
+    TEST_CHECK(strstr(test_output(), "console") != NULL);
+
+    LOGGER_GET_CHANNEL_STATS(1, &stats);
+    TEST_CHECK_INT(stats.writes, 1);
+
+    // Not idle until the last byte has left USART2 too.
+    static const uint8_t kBusy[] = "busy";
+
+    HAL_UART_Transmit_DMA(&huart2, kBusy, sizeof(kBusy) - 1);
+    TEST_CHECK(!LOGGER_IS_IDLE());
+    stub_dma_complete(&huart2);
+    TEST_CHECK(LOGGER_IS_IDLE());
+
+    // The channel level is the global level of its modules.
+    test_reset();
+    LOGGER_CHANNEL_SET_LEVEL(1, LOG_LEVEL_WARNING);
+    test_radio_log(3);
+    TEST_CHECK_STR(test_output_of(&huart2), "");
+    LOGGER_CHANNEL_SET_LEVEL(1, LOG_LEVEL_DEBUG);
+}
+
+#endif // LOG_MAX_CHANNELS > 1
+
+static void test_panic(void)
+{
+    test_reset();
+    LOG_INFO("first\r\n");
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+    // A transfer interrupted midway: the panic flush goes on from the first byte not sent.
+    LOG_INFO("second\r\n");
+    stub_dma_progress(&huart1, 5);
+#elif LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS && LOG_BATCH_SIZE > 0
+    // The first line is in the batch being gathered, its slot already given back.
+    sTaskHook = test_batch_panic_hook;
+    test_task_run();
+#elif LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+    // Still in the queue.
+    LOG_INFO("second\r\n");
+#else
+    stub_irq_enter(TEST_IRQ);
+    LOG_INFO("second\r\n");
+    stub_irq_exit();
+#endif
+
+    LOGGER_PANIC_FLUSH();
+
+    // From then on the UART is polled: a message is sent before the call returns.
+    LOG_INFO("third\r\n");
+    LOG_RAW("fourth\r\n");
+
+    const char *out = stub_uart_text(&huart1);
+
+    TEST_CHECK_INT(test_count(out, "first\r\n"), 1);
+    TEST_CHECK_INT(test_count(out, "second\r\n"), 1);
+    TEST_CHECK_INT(test_count(out, "third\r\n"), 1);
+    TEST_CHECK_INT(test_count(out, "fourth\r\n"), 1);
+    TEST_CHECK(strstr(out, "first") < strstr(out, "second"));
+    TEST_CHECK(strstr(out, "second") < strstr(out, "third"));
+    TEST_CHECK(LOGGER_IS_IDLE());
+}
+
+/* =======================================================================
+ * [MAIN]
+ * =======================================================================
+ */
+
+int main(void)
+{
+    stub_uart_init(&huart1, USART1, 115200);
+    stub_uart_init(&huart2, USART2, 115200);
+
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+    LOGGER_RTOS_INIT();
+#endif
+
+    TEST_RUN(test_format);
+    TEST_RUN(test_levels);
+    TEST_RUN(test_truncation);
+#if LOG_TIMESTAMP == LOG_TIMESTAMP_DWT
+    TEST_RUN(test_timestamp);
+#endif
+    TEST_RUN(test_hexdump);
+    TEST_RUN(test_interrupts);
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_DMA
+    TEST_RUN(test_ring);
+#endif
+#if LOGGER_OUTPUT_MODE == LOGGER_OUTPUT_RTOS
+    TEST_RUN(test_queue);
+#endif
+    TEST_RUN(test_sinks);
+    TEST_RUN(test_ratelimit);
+    TEST_RUN(test_shell);
+#if LOG_MAX_CHANNELS > 1
+    TEST_RUN(test_channels);
+#endif
+    TEST_RUN(test_panic);
+
+    return test_finish();
+}
+
+/*** end of file ***/
@@ -0,0 +1,45 @@
+/** @file test_module.c
+ *
+ * @brief Second logging module of the host regression tests.
+ *
+ * @author Ignacio Brittez
+ *
+ * A module of its own translation unit, bound to channel 1 when the tests are built with
+ * LOG_MAX_CHANNELS > 1.
+ */
+
+/* =======================================================================
+ * [INCLUDES]
+ * =======================================================================
+ */
+
+#include "logger_module.h"
+#include "test_module.h"
+
+/* =======================================================================
+ * [MODULE]
+ * =======================================================================
+ */
+
+#if LOG_MAX_CHANNELS > 1
+LOG_MODULE_REGISTER_ON(radio, 1, LOG_LEVEL_DEBUG);
+#else
+LOG_MODULE_REGISTER(radio, LOG_LEVEL_DEBUG);
+#endif
+
+/* =======================================================================
+ * [PUBLIC FUNCTIONS]
+ * =======================================================================
+ */
+
+log_instance_t *test_radio_module(void)
+{
+    return LOG_MODULE_NAME(radio);
+}
+
+void test_radio_log(int value)
+{
+    LOG_INFO("radio %d\r\n", value);
+}
+
+/*** end of file ***/
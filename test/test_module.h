@@ -0,0 +1,19 @@
+/** @file test_module.h
+ *
+ * @brief Second logging module of the host regression tests (see `test_module.c`).
+ *
+ * @author Ignacio Brittez
+ */
+
+#ifndef TEST_MODULE_H
+#define TEST_MODULE_H
+
+/** @brief Returns the `radio` module instance. */
+log_instance_t *test_radio_module(void);
+
+/** @brief Logs "radio <value>" at INFO level from the `radio` module. */
+void test_radio_log(int value);
+
+#endif /* TEST_MODULE_H */
+
+/*** end of file ***/
@@ -0,0 +1,514 @@
+#!/usr/bin/env python3
+"""Host-side decoder for the deferred (binary) mode of stm32-uart-logger.
+
+Reads the call-site descriptors (`.logger_sites`) and format strings (`.logger_str`) from the
+firmware ELF file, then turns the binary record stream produced with `LOGGER_DEFERRED=1` back into
+the same text the target would have printed.
+
+Usage:
+    python3 tools/logdecode.py firmware.elf /dev/ttyUSB0 --baud 2000000
+
+    python3 tools/logdecode.py firmware.elf capture.bin
+
+The stream is decoded as it arrives, in blocks of whatever the port has received, so the decoder
+keeps up with multi-Mbaud links. The 32-bit record timestamps are extended across wraparounds.
+`--level` and `--module` filter the records on the host, the target sends them all.
+
+With `LOG_FRAMING=LOG_FRAMING_COBS` on the target, add `--cobs`: corrupted frames are skipped,
+overtaken ones put back in order and lost ones reported from the sequence numbers. With
+`LOG_DEFERRED_COMPACT=1`, add `--compact`.
+"""
+
+import argparse
+import binascii
+import functools
+import os
+import re
+import struct
+import sys
+
+LEVELS = {
+    0: ("DBG", "\x1b[37m"),
+    1: ("INF", "\x1b[32m"),
+    2: ("WRN", "\x1b[33m"),
+    3: ("ERR", "\x1b[31m"),
+}
+LEVEL_NAMES = {"dbg": 0, "inf": 1, "wrn": 2, "err": 3}
+LOG_SITE_RAW = 0xFF
+KNRM = "\x1b[0m"
+
+# printf conversion: flags, width, precision, length modifier, conversion character.
+SPEC_RE = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|j|z|t|L|q)?([diouxXeEfFgGaAcspnH%])")
+HEXDUMP_ROW = 16
+REORDER_WINDOW = 8  # frames a late COBS frame can fall behind before it is counted as lost
+
+
+class ElfImage:
+    """Minimal ELF reader: maps target addresses to file contents."""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+
+        if self.data[:4] != b"\x7fELF":
+            raise ValueError(f"{path}: not an ELF file")
+
+        self.is64 = self.data[4] == 2
+        self.endian = "<" if self.data[5] == 1 else ">"
+        self.ptr_size = 8 if self.is64 else 4
+
+        if self.is64:
+            shoff, = struct.unpack_from(self.endian + "Q", self.data, 0x28)
+            shentsize, shnum, shstrndx = struct.unpack_from(self.endian + "HHH", self.data, 0x3A)
+        else:
+            shoff, = struct.unpack_from(self.endian + "I", self.data, 0x20)
+            shentsize, shnum, shstrndx = struct.unpack_from(self.endian + "HHH", self.data, 0x2E)
+
+        raw = []
+        for i in range(shnum):
+            off = shoff + i * shentsize
+            if self.is64:
+                name, stype, _, addr, offset, size = struct.unpack_from(
+                    self.endian + "IIQQQQ", self.data, off)
+            else:
+                name, stype, _, addr, offset, size = struct.unpack_from(
+                    self.endian + "IIIIII", self.data, off)
+            raw.append((name, stype, addr, offset, size))
+
+        strtab = raw[shstrndx]
+        self.sections = {}
+        self.regions = []
+        for name, stype, addr, offset, size in raw:
+            end = self.data.index(b"\0", strtab[3] + name)
+            sname = self.data[strtab[3] + name:end].decode()
+            self.sections[sname] = (addr, offset, size)
+            # SHT_NOBITS (8) sections have no file contents.
+            if stype != 8 and addr != 0 or sname.startswith(".logger_"):
+                self.regions.append((sname, addr, offset, size))
+
+        # Non-loaded (INFO) logger sections are looked up first: they may start at address 0.
+        self.regions.sort(key=lambda r: not r[0].startswith(".logger_"))
+
+    def read(self, addr, size):
+        for _, start, offset, length in self.regions:
+            if start <= addr and addr + size <= start + length:
+                pos = offset + addr - start
+                return self.data[pos:pos + size]
+        raise KeyError(f"address 0x{addr:08x} is not part of the ELF image")
+
+    def read_ptr(self, addr):
+        fmt = self.endian + ("Q" if self.is64 else "I")
+        return struct.unpack(fmt, self.read(addr, self.ptr_size))[0]
+
+    def read_cstr(self, addr):
+        out = bytearray()
+        while True:
+            ch = self.read(addr + len(out), 1)
+            if ch == b"\0":
+                return out.decode("utf-8", "replace")
+            out += ch
+
+
+class Site:
+    def __init__(self, elf, addr):
+        p = elf.ptr_size
+        self.fmt = elf.read_cstr(elf.read_ptr(addr))
+        self.func = elf.read_cstr(elf.read_ptr(addr + p))
+        self.line, self.level = struct.unpack(elf.endian + "HB", elf.read(addr + 2 * p, 3))
+
+
+class Decoder:
+    def __init__(self, elf, color=False, timestamps=False, ts_hz=None, compact=False,
+                 min_level=0, modules=None):
+        self.elf = elf
+        self.color = color
+        self.timestamps = timestamps
+        self.ts_hz = ts_hz
+        self.compact = compact
+        self.min_level = min_level
+        self.only = set(modules) if modules else None  # module names to show, None for all
+        self.sites = {}
+        self.modules = {}
+        self.last_ts = None  # timestamp of the previous compact record, None until synchronized
+        self.wide_ts = None  # previous timestamp extended past 32 bits
+
+    def site(self, site_id):
+        if site_id not in self.sites:
+            self.sites[site_id] = Site(self.elf, self._resolve(site_id))
+        return self.sites[site_id]
+
+    def module(self, addr):
+        if addr == 0:
+            return None
+        if addr not in self.modules:
+            self.modules[addr] = self.elf.read_cstr(self._resolve(addr))
+        return self.modules[addr]
+
+    def _resolve(self, addr32):
+        # Host builds truncate 64-bit addresses to 32 bits; restore the upper half if needed.
+        if self.elf.is64:
+            for _, start, _, length in self.elf.regions:
+                candidate = (start & ~0xFFFFFFFF) | addr32
+                if start <= candidate < start + length:
+                    return candidate
+        return addr32
+
+    def decode(self, payload):
+        """Returns the text of one record, "" if it is filtered out, or a note if it is damaged."""
+        try:
+            if self.compact:
+                return self.decode_compact(payload)
+            site_id, timestamp, module = struct.unpack_from("<III", payload, 0)
+            return self.emit(self.site(site_id), self.module(module), timestamp, payload[12:],
+                             False)
+        except (KeyError, IndexError, struct.error) as err:
+            return f"<undecodable record: {err}>\n"
+
+    def decode_compact(self, payload):
+        site_id, pos = read_varint(payload, 0)
+        module, pos = read_varint(payload, pos)
+        stamp, pos = read_varint(payload, pos)
+
+        if stamp & 1:
+            self.last_ts = stamp >> 1
+        elif self.last_ts is not None:
+            self.last_ts = (self.last_ts + (stamp >> 1)) & 0xFFFFFFFF
+
+        return self.emit(self.site(site_id), self.module(module), self.last_ts, payload[pos:], True)
+
+    def emit(self, site, module, timestamp, args, compact):
+        # Timestamps are tracked for every record, shown or not, so that no wraparound is missed.
+        if timestamp is not None:
+            timestamp = self.extend(timestamp)
+        if not self.wanted(site, module):
+            return ""
+        return self.render(site, module, timestamp, format_args(site.fmt, args, compact))
+
+    def wanted(self, site, module):
+        if site.level == LOG_SITE_RAW:
+            return self.only is None
+        return site.level >= self.min_level and (self.only is None or module in self.only)
+
+    def extend(self, timestamp):
+        """Extends a 32-bit timestamp with the previous one as reference.
+
+        The step is taken as signed, so records that are slightly out of order (a preempted
+        producer) do not count as a wraparound. Needs one record per half counter period.
+        """
+        if self.wide_ts is None:
+            self.wide_ts = timestamp
+        else:
+            step = (timestamp - self.wide_ts) & 0xFFFFFFFF
+            self.wide_ts += step - (1 << 32) if step >= 1 << 31 else step
+        return self.wide_ts
+
+    def resync(self):
+        """Forgets the running timestamp after a lost record."""
+        self.last_ts = None
+
+    def render(self, site, module, timestamp, text):
+        if not self.timestamps:
+            prefix = ""
+        elif timestamp is None:
+            prefix = f"[{'?':>10}] "
+        elif self.ts_hz:
+            prefix = f"[{timestamp / self.ts_hz:.6f}] "
+        else:
+            prefix = f"[{timestamp:>10}] "
+
+        if site.level == LOG_SITE_RAW or site.level not in LEVELS:
+            return prefix + text
+
+        tag, color = LEVELS[site.level]
+        head = f"[{tag}]" + (f"[{module}]" if module else "") + f"[{site.func}:{site.line}]: "
+
+        if not self.color:
+            return prefix + head + text
+        if site.level == 0:
+            return prefix + color + head + text + KNRM
+        return prefix + color + head + KNRM + text
+
+
+def read_varint(data, pos):
+    """Reads an unsigned LEB128 varint, returns it with the position of the next byte."""
+    value = 0
+    shift = 0
+    while True:
+        if pos >= len(data):
+            raise IndexError("truncated varint")
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if byte < 0x80:
+            return value, pos
+
+
+@functools.lru_cache(maxsize=None)
+def parse_format(fmt):
+    """Splits a format string once into (literal text, conversion) pairs and the trailing text."""
+    specs = []
+    pos = 0
+    for match in SPEC_RE.finditer(fmt):
+        specs.append((fmt[pos:match.start()], match.groups()))
+        pos = match.end()
+    return specs, fmt[pos:]
+
+
+def format_args(fmt, args, compact=False):
+    """Renders a C format string with arguments packed by log_emit_deferred()."""
+    out = []
+    cursor = 0
+
+    def take(size, code):
+        nonlocal cursor
+        if compact and code in "iIqQ":
+            value, cursor = read_varint(args, cursor)
+            value = (value >> 1) ^ -(value & 1)
+            return value if code in "iq" else value & ((1 << (8 * size)) - 1)
+        if cursor + size > len(args):
+            raise IndexError
+        value, = struct.unpack_from("<" + code, args, cursor)
+        cursor += size
+        return value
+
+    specs, tail = parse_format(fmt)
+
+    for literal, (flags, width, precision, length, conv) in specs:
+        out.append(literal)
+
+        if conv == "%":
+            out.append("%")
+            continue
+
+        try:
+            if width == "*":
+                width = str(take(4, "i"))
+            if precision == "*":
+                precision = str(take(4, "i"))
+
+            spec = "%" + flags + (width or "") + ("." + precision if precision is not None else "")
+            wide = length in ("ll", "j", "q")
+
+            if conv == "H":
+                size = take(1, "B")
+                out.append(hexdump(args[cursor:cursor + size]))
+                cursor += size
+            elif conv == "s":
+                size = take(1, "B")
+                value = args[cursor:cursor + size].decode("utf-8", "replace")
+                cursor += size
+                out.append((spec + "s") % value)
+            elif conv in "eEfFgGaA":
+                value = take(4, "f")
+                out.append((spec + ("f" if conv in "aA" else conv)) % value)
+            elif conv == "c":
+                out.append((spec + "c") % chr(take(4, "I") & 0xFF))
+            elif conv == "p":
+                out.append("0x%08x" % take(4, "I"))
+            elif conv in "di":
+                out.append((spec + "d") % take(8 if wide else 4, "q" if wide else "i"))
+            elif conv == "n":
+                take(4, "I")
+            else:
+                value = take(8 if wide else 4, "Q" if wide else "I")
+                out.append((spec + ("d" if conv == "u" else conv)) % value)
+        except IndexError:
+            out.append("<?>")
+
+    out.append(tail)
+    return "".join(out)
+
+
+def hexdump(data, row=HEXDUMP_ROW):
+    """Renders the `%H` conversion of LOG_HEXDUMP() records like the target does."""
+    lines = ["\r\n"]
+    digits = 8 if len(data) > 0x10000 else 4
+    for offset in range(0, len(data), row):
+        chunk = data[offset:offset + row]
+        hexes = "".join(f" {b:02x}" for b in chunk).ljust(3 * row)
+        text = "".join(chr(b) if 0x20 <= b < 0x7F else "." for b in chunk)
+        lines.append(f"  {offset:0{digits}x}:{hexes}  {text}\r\n")
+    return "".join(lines)
+
+
+def chunks(stream, idle=None, size=65536):
+    """Yields the input as it arrives, in blocks of whatever is available.
+
+    `idle` is called before each read that may block, e.g. to flush the output.
+    """
+    read = getattr(stream, "read1", stream.read)
+    while True:
+        if idle:
+            idle()
+        data = read(size)
+        if not data:
+            return
+        yield data
+
+
+def records(blocks):
+    """Yields the payload of every length-prefixed record in the stream."""
+    buf = bytearray()
+    for block in blocks:
+        buf += block
+        pos = 0
+        while pos < len(buf) and pos + 1 + buf[pos] <= len(buf):
+            yield bytes(buf[pos + 1:pos + 1 + buf[pos]])
+            pos += 1 + buf[pos]
+        del buf[:pos]
+
+
+def crc16(data, crc=0xFFFF):
+    """CRC-16/CCITT-FALSE, as computed by the target."""
+    return binascii.crc_hqx(data, crc)
+
+
+def cobs_decode(frame):
+    """Undoes the byte stuffing of one frame (without its 0x00 delimiter)."""
+    out = bytearray()
+    pos = 0
+    while pos < len(frame):
+        code = frame[pos]
+        if pos + code > len(frame):
+            raise ValueError("bad COBS block")
+        out += frame[pos + 1:pos + code]
+        pos += code
+        if code < 0xFF and pos < len(frame):
+            out.append(0)
+    return bytes(out)
+
+
+def cobs_frames(blocks, notes):
+    """Yields (sequence number, record payload) for every valid COBS frame, as received."""
+    buf = b""
+    for block in blocks:
+        *complete, buf = (buf + block).split(b"\0")
+        for frame in complete:
+            if not frame:
+                continue
+            try:
+                data = cobs_decode(frame)
+            except ValueError:
+                data = b""
+            crc = struct.unpack_from("<H", data, len(data) - 2)[0] if len(data) >= 4 else None
+            if crc is None or crc16(data[:-2]) != crc:
+                notes("<corrupted frame>\n")
+                continue
+            seq, = struct.unpack_from("<H", data, 0)
+            yield seq, data[2:-2]
+
+
+def frames(blocks, notes):
+    """Yields the record payload of every valid COBS frame in sequence order; problems are passed
+    to `notes`.
+
+    A writer preempted on the target between numbering a frame and sending it lets a later frame
+    through first. The frames past a gap are held until it fills, or until a frame more than
+    REORDER_WINDOW ahead arrives: only then is the gap reported as lost.
+    """
+    expected = None
+    held = {}
+
+    def release(window):
+        nonlocal expected
+        while held:
+            if expected in held:
+                yield held.pop(expected)
+                expected = (expected + 1) & 0xFFFF
+                continue
+            ahead = [(seq - expected) & 0xFFFF for seq in held]
+            if max(ahead) <= window:
+                return
+            notes(f"<{min(ahead)} records lost>\n")
+            expected = (expected + min(ahead)) & 0xFFFF
+
+    for seq, payload in cobs_frames(blocks, notes):
+        if expected is None:
+            expected = seq
+        elif (seq - expected) & 0xFFFF >= 0x8000:
+            # Behind the stream: a frame given up on, or a restarted target.
+            yield from release(-1)
+            expected = seq
+        held[seq] = payload
+        yield from release(REORDER_WINDOW)
+
+    # End of the input: nothing can fill the gaps left.
+    yield from release(-1)
+
+
+def open_input(path, baud):
+    """Opens the capture file or serial device, or stdin for "-"."""
+    if path == "-":
+        return sys.stdin.buffer
+    stream = open(path, "rb", buffering=0)
+    if baud and stream.isatty():
+        set_raw(stream.fileno(), baud)
+    return stream
+
+
+def set_raw(fd, baud):
+    """Puts a serial device in raw mode at `baud`, like `stty raw`. POSIX only."""
+    import termios
+    import tty
+
+    speed = getattr(termios, f"B{baud}", None)
+    if speed is None:
+        raise SystemExit(f"unsupported baud rate {baud}")
+    tty.setraw(fd)
+    attrs = termios.tcgetattr(fd)
+    attrs[4] = attrs[5] = speed
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+
+
+def parse_level(text):
+    if text in LEVEL_NAMES:
+        return LEVEL_NAMES[text]
+    if text in ("0", "1", "2", "3"):
+        return int(text)
+    raise argparse.ArgumentTypeError(f"unknown level {text} (dbg, inf, wrn, err or 0-3)")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("elf", help="firmware ELF file built with LOGGER_DEFERRED=1")
+    parser.add_argument("input", nargs="?", default="-",
+                        help="captured stream or serial device (default: stdin)")
+    parser.add_argument("--color", action="store_true", help="emit ANSI colors like the target")
+    parser.add_argument("-t", "--timestamps", action="store_true", help="prefix the record timestamp")
+    parser.add_argument("--ts-hz", type=float, metavar="HZ",
+                        help="timestamp counter frequency (LOG_TIMESTAMP_HZ), prints seconds")
+    parser.add_argument("--cobs", action="store_true",
+                        help="COBS frames with sequence number and CRC (LOG_FRAMING_COBS)")
+    parser.add_argument("--compact", action="store_true",
+                        help="varint records with delta timestamps (LOG_DEFERRED_COMPACT=1)")
+    parser.add_argument("-b", "--baud", type=int,
+                        help="configure a serial input: raw mode at this baud rate")
+    parser.add_argument("-l", "--level", type=parse_level, default=0,
+                        help="minimum level shown: dbg, inf, wrn, err or 0-3 (raw output is kept)")
+    parser.add_argument("-m", "--module", action="append", metavar="NAME",
+                        help="only show this module (repeatable; global and raw output is hidden)")
+    opts = parser.parse_args()
+
+    decoder = Decoder(ElfImage(opts.elf), color=opts.color, timestamps=opts.timestamps,
+                      ts_hz=opts.ts_hz, compact=opts.compact, min_level=opts.level,
+                      modules=opts.module)
+    blocks = chunks(open_input(opts.input, opts.baud), idle=sys.stdout.flush)
+
+    def note(text):
+        decoder.resync()
+        sys.stdout.write(text)
+
+    try:
+        for payload in (frames(blocks, note) if opts.cobs else records(blocks)):
+            sys.stdout.write(decoder.decode(payload))
+        sys.stdout.flush()
+    except KeyboardInterrupt:
+        sys.stdout.flush()
+    except BrokenPipeError:
+        # The reader (`head`, a pager) went away: exit quietly.
+        os.dup2(os.open(os.devnull, os.O_WRONLY), sys.stdout.fileno())
+
+
+if __name__ == "__main__":
+    main()